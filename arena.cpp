@@ -0,0 +1,28 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+const size_t arena_t::chunk_shift;
+const size_t arena_t::chunk_size;
+
+uint64_t arena_t::alloc(size_t size)
+{
+    if (m_chunks.empty() || m_used + size > chunk_size) {
+        // objects larger than a chunk get one of their own
+        size_t const alloc_size = std::max(size, chunk_size);
+        m_chunks.emplace_back(new char[alloc_size]);
+        m_allocated += alloc_size;
+        m_used = 0;
+    }
+
+    uint64_t const pos = (uint64_t(m_chunks.size() - 1) << chunk_shift) + m_used;
+    m_used += size;
+    return pos;
+}
+
+void arena_t::clear()
+{
+    m_chunks.clear();
+    m_used = 0;
+    m_allocated = 0;
+}
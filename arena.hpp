@@ -0,0 +1,48 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Memory for many small objects, handed out from large chunks without
+ * any per object overhead. Objects are referred to by their position,
+ * which stays valid while the arena grows, and so do pointers to them.
+ * Nothing is freed before clear().
+ */
+class arena_t
+{
+public:
+    arena_t() : m_used(0), m_allocated(0) {}
+
+    /// Reserve size bytes, returns the position of the first one.
+    uint64_t alloc(size_t size);
+
+    char *at(uint64_t pos)
+    {
+        return m_chunks[pos >> chunk_shift].get() + (pos & (chunk_size - 1));
+    }
+
+    const char *at(uint64_t pos) const
+    {
+        return m_chunks[pos >> chunk_shift].get() + (pos & (chunk_size - 1));
+    }
+
+    void clear();
+
+    /// Bytes allocated for the chunks.
+    size_t allocated() const { return m_allocated; }
+
+private:
+    static const size_t chunk_shift = 24;
+    static const size_t chunk_size = size_t(1) << chunk_shift;
+
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    // bytes handed out from the last chunk
+    size_t m_used;
+    size_t m_allocated;
+};
+
+#endif // ARENA_HPP
@@ -0,0 +1,59 @@
+#include "box-index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+const size_t box_index_t::node_size;
+
+void box_index_t::build()
+{
+    m_ids.resize(m_boxes.size());
+    std::iota(m_ids.begin(), m_ids.end(), 0);
+    m_nodes.clear();
+    m_levels.clear();
+
+    if (m_boxes.empty()) {
+        return;
+    }
+
+    // cut the boxes into vertical slices by their centres, then sort
+    // each slice from bottom to top
+    auto centre_x = [&](uint32_t id) { return m_boxes[id].minx + m_boxes[id].maxx; };
+    auto centre_y = [&](uint32_t id) { return m_boxes[id].miny + m_boxes[id].maxy; };
+
+    std::sort(m_ids.begin(), m_ids.end(),
+              [&](uint32_t a, uint32_t b) { return centre_x(a) < centre_x(b); });
+
+    size_t const leaves = (m_ids.size() + node_size - 1) / node_size;
+    size_t const slices = (size_t) std::ceil(std::sqrt((double) leaves));
+    size_t const slice_size = slices * node_size;
+    for (size_t start = 0; start < m_ids.size(); start += slice_size) {
+        auto const end = m_ids.begin() + std::min(start + slice_size, m_ids.size());
+        std::sort(m_ids.begin() + start, end,
+                  [&](uint32_t a, uint32_t b) { return centre_y(a) < centre_y(b); });
+    }
+
+    m_levels.push_back(0);
+    for (auto id : m_ids) {
+        m_nodes.push_back(m_boxes[id]);
+    }
+
+    // each level above holds the boxes around node_size neighbours below
+    while (level_size(m_levels.size() - 1) > 1) {
+        size_t const begin = m_levels.back();
+        size_t const end = m_nodes.size();
+        m_levels.push_back(end);
+        for (size_t i = begin; i < end; i += node_size) {
+            box_t box = m_nodes[i];
+            for (size_t j = i + 1; j < end && j < i + node_size; ++j) {
+                auto const &b = m_nodes[j];
+                box.minx = std::min(box.minx, b.minx);
+                box.miny = std::min(box.miny, b.miny);
+                box.maxx = std::max(box.maxx, b.maxx);
+                box.maxy = std::max(box.maxy, b.maxy);
+            }
+            m_nodes.push_back(box);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef BOX_INDEX_HPP
+#define BOX_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Static index of bounding boxes, packed into a tree with the sort tile
+ * recursive method. Boxes are added first, then the tree is built once
+ * and can be queried for the boxes covering or inside a given box.
+ */
+class box_index_t
+{
+public:
+    struct box_t
+    {
+        double minx, miny, maxx, maxy;
+
+        bool covers(const box_t &other) const
+        {
+            return minx <= other.minx && other.maxx <= maxx &&
+                   miny <= other.miny && other.maxy <= maxy;
+        }
+
+        bool intersects(const box_t &other) const
+        {
+            return minx <= other.maxx && other.minx <= maxx &&
+                   miny <= other.maxy && other.miny <= maxy;
+        }
+    };
+
+    /// Add a box, its id is the number of boxes added before.
+    void add(const box_t &box) { m_boxes.push_back(box); }
+
+    void build();
+
+    const box_t &box(size_t id) const { return m_boxes[id]; }
+
+    /// Call func with the id of every box that covers box.
+    template <typename FUNC>
+    void covering(const box_t &box, FUNC func) const
+    {
+        query([&](const box_t &b) { return b.covers(box); }, func);
+    }
+
+    /// Call func with the id of every box that box covers.
+    template <typename FUNC>
+    void covered_by(const box_t &box, FUNC func) const
+    {
+        query([&](const box_t &b) { return b.intersects(box); },
+              [&](size_t id) {
+                  if (box.covers(m_boxes[id])) {
+                      func(id);
+                  }
+              });
+    }
+
+private:
+    /// Boxes per node of the tree.
+    static const size_t node_size = 16;
+
+    /**
+     * Call func for all boxes matching pred, descending only into the
+     * nodes whose box matches pred.
+     */
+    template <typename PRED, typename FUNC>
+    void query(PRED pred, FUNC func) const
+    {
+        if (m_levels.empty()) {
+            return;
+        }
+
+        std::vector<std::pair<size_t, size_t>> stack;
+        size_t const top = m_levels.size() - 1;
+        for (size_t i = m_levels[top]; i < m_nodes.size(); ++i) {
+            stack.emplace_back(top, i - m_levels[top]);
+        }
+
+        while (!stack.empty()) {
+            size_t const level = stack.back().first;
+            size_t const index = stack.back().second;
+            stack.pop_back();
+
+            if (!pred(m_nodes[m_levels[level] + index])) {
+                continue;
+            }
+
+            if (level == 0) {
+                func(m_ids[index]);
+                continue;
+            }
+
+            size_t const below = level_size(level - 1);
+            for (size_t i = index * node_size;
+                 i < below && i < (index + 1) * node_size; ++i) {
+                stack.emplace_back(level - 1, i);
+            }
+        }
+    }
+
+    size_t level_size(size_t level) const
+    {
+        return (level + 1 < m_levels.size() ? m_levels[level + 1] : m_nodes.size()) -
+               m_levels[level];
+    }
+
+    std::vector<box_t> m_boxes;
+    // ids of the boxes in the order of the leaves
+    std::vector<uint32_t> m_ids;
+    // boxes of all levels, starting with the leaves
+    std::vector<box_t> m_nodes;
+    // where each level starts in m_nodes
+    std::vector<size_t> m_levels;
+};
+
+#endif // BOX_INDEX_HPP
@@ -197,13 +197,10 @@ int expire_tiles::normalise_tile_x_coord(int x) {
 }
 
 /*
- * Expire tiles that a line crosses
+ * Expire tiles that a line crosses, given in tile coordinates
  */
-void expire_tiles::from_line(double lon_a, double lat_a, double lon_b, double lat_b) {
-	double	tile_x_a;
-	double	tile_y_a;
-	double	tile_x_b;
-	double	tile_y_b;
+void expire_tiles::from_line(double tile_x_a, double tile_y_a,
+                             double tile_x_b, double tile_y_b) {
 	double	temp;
 	double	x1;
 	double	y1;
@@ -220,9 +217,6 @@ void expire_tiles::from_line(double lon_a, double lat_a, double lon_b, double la
 	int	y;
 	int	norm_x;
 
-    projection->coords_to_tile(&tile_x_a, &tile_y_a, lon_a, lat_a, map_width);
-    projection->coords_to_tile(&tile_x_b, &tile_y_b, lon_b, lat_b, map_width);
-
 	if (tile_x_a > tile_x_b) {
 		/* We always want the line to go from left to right - swap the ends if it doesn't */
 		temp = tile_x_b;
@@ -341,8 +335,12 @@ void expire_tiles::from_nodes_line(const nodelist_t &nodes)
     if (nodes.size() == 1) {
         from_bbox(nodes[0].lon, nodes[0].lat, nodes[0].lon, nodes[0].lat);
     } else {
-        for (size_t i = 1; i < nodes.size(); ++i)
-            from_line(nodes[i-1].lon, nodes[i-1].lat, nodes[i].lon, nodes[i].lat);
+        tile_coords.assign(nodes.begin(), nodes.end());
+        projection->coords_to_tile_batch(tile_coords.data(), tile_coords.size(),
+                                         map_width);
+        for (size_t i = 1; i < tile_coords.size(); ++i)
+            from_line(tile_coords[i-1].lon, tile_coords[i-1].lat,
+                      tile_coords[i].lon, tile_coords[i].lat);
     }
 }
 
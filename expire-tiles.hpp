@@ -46,7 +46,8 @@ struct expire_tiles
 private:
     void expire_tile(int x, int y);
     int normalise_tile_x_coord(int x);
-    void from_line(double lon_a, double lat_a, double lon_b, double lat_b);
+    void from_line(double tile_x_a, double tile_y_a,
+                   double tile_x_b, double tile_y_b);
     void from_xnodes_poly(const multinodelist_t &xnodes, osmid_t osm_id);
     void from_xnodes_line(const multinodelist_t &xnodes);
 
@@ -56,6 +57,8 @@ private:
     int maxzoom;
     std::shared_ptr<reprojection> projection;
     std::unique_ptr<tile> dirty;
+    // buffer for the tile coordinates of the nodes of a line
+    nodelist_t tile_coords;
 };
 
 
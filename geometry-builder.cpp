@@ -38,6 +38,7 @@
 #include <geos/geom/prep/PreparedGeometryFactory.h>
 #include <geos/geom/GeometryFactory.h>
 #include <geos/geom/Coordinate.h>
+#include <geos/geom/Envelope.h>
 #include <geos/geom/CoordinateSequence.h>
 #include <geos/geom/CoordinateSequenceFactory.h>
 #include <geos/geom/Geometry.h>
@@ -55,8 +56,12 @@ using namespace geos::geom;
 using namespace geos::util;
 using namespace geos::operation::linemerge;
 
+#include "box-index.hpp"
 #include "geometry-builder.hpp"
 #include "reprojection.hpp"
+#include "ring-assembler.hpp"
+#include "ring-kernels.hpp"
+#include "wkb-writer.hpp"
 
 typedef std::unique_ptr<Geometry> geom_ptr;
 typedef std::unique_ptr<CoordinateSequence> coord_ptr;
@@ -101,28 +106,30 @@ geom_ptr create_multi_line(GeometryFactory &gf, const multinodelist_t &xnodes)
     return geom_ptr(gf.createMultiLineString(lines.release()));
 }
 
-bool is_polygon_line(CoordinateSequence * coords)
+bool is_polygon_line(const nodelist_t &nodes)
 {
-    return (coords->getSize() >= 4)
-           && (coords->getAt(coords->getSize() - 1).equals2D(coords->getAt(0)));
+    return (nodes.size() >= 4)
+           && nodes.back().lon == nodes.front().lon
+           && nodes.back().lat == nodes.front().lat;
 }
 
 /**
- * Reprojects given Linear Ring from target projection to spherical mercator.
- * Caller takes ownership of return value.
+ * Computes area of a ring, copying its coordinates to the buffer.
+ * \return the area in projected units, or in EPSG 3857 if proj is given
  */
-LinearRing* reproject_linearring(const LineString *ls, const reprojection *proj)
+double ring_area(const LineString *ring, const reprojection *proj, nodelist_t &buffer)
 {
-    auto *gf = ls->getFactory();
-    coord_ptr coords(gf->getCoordinateSequenceFactory()->create(size_t(0), size_t(2)));
-    for (auto i : *(ls->getCoordinatesRO()->toVector())) {
-        Coordinate c(i.x, i.y);
-        proj->target_to_tile(&c.y, &c.x);
-        coords->add(c);
+    auto const *coords = ring->getCoordinatesRO();
+    size_t const count = coords->getSize();
+    buffer.clear();
+    buffer.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto const &c = coords->getAt(i);
+        buffer.emplace_back(c.x, c.y);
     }
-    return gf->createLinearRing(coords.release());
-}
 
+    return proj ? ring_tile_area(buffer, proj) : std::fabs(ring_signed_area2(buffer)) / 2;
+}
 
 /**
  * Computes area of given polygonal geometry.
@@ -130,11 +137,6 @@ LinearRing* reproject_linearring(const LineString *ls, const reprojection *proj)
  */
 double get_area(const geos::geom::Geometry *geom, reprojection *proj)
 {
-    // reprojection is not necessary, or has not been asked for.
-    if (!proj) {
-        return geom->getArea();
-    }
-
     // MultiPolygon - return sum of individual areas
     if (const auto *multi = dynamic_cast<const MultiPolygon *>(geom)) {
         return std::accumulate(multi->begin(), multi->end(), 0.0,
@@ -145,23 +147,18 @@ double get_area(const geos::geom::Geometry *geom, reprojection *proj)
 
     const auto *poly = dynamic_cast<const geos::geom::Polygon *>(geom);
     if (!poly) {
-        return 0.0;
+        return proj ? 0.0 : geom->getArea();
     }
 
-    // standard polygon - reproject rings individually, then assemble polygon and
-    // compute area.
-
-    const auto *ext = poly->getExteriorRing();
-    std::unique_ptr<LinearRing> projectedExt(reproject_linearring(ext, proj));
+    // standard polygon - the area of the shell less those of the holes
+    nodelist_t buffer;
+    double area = ring_area(poly->getExteriorRing(), proj, buffer);
     auto nholes = poly->getNumInteriorRing();
-    std::unique_ptr<std::vector<Geometry *> > projectedHoles(new std::vector<Geometry *>);
     for (std::size_t i=0; i < nholes; i++) {
-        auto* hole = poly->getInteriorRingN(i);
-        projectedHoles->push_back(reproject_linearring(hole, proj));
+        area -= ring_area(poly->getInteriorRingN(i), proj, buffer);
     }
-    const geom_ptr projectedPoly(poly->getFactory()->createPolygon(projectedExt.release(), projectedHoles.release()));
 
-    return projectedPoly->getArea();
+    return area;
 }
 
 
@@ -185,9 +182,105 @@ struct polygondata_comparearea {
     }
 };
 
+/**
+ * Mark which of the polygons, sorted by area, lie in the holes of which
+ * others. Only the polygons with the envelope inside that of a larger
+ * one are tested for containment. Returns the number of top level ones.
+ */
+unsigned nest_polygons(std::vector<polygondata> &polys)
+{
+    box_index_t index;
+    for (auto const &p : polys) {
+        auto const *env = p.polygon->getEnvelopeInternal();
+        index.add(box_index_t::box_t{env->getMinX(), env->getMinY(),
+                                     env->getMaxX(), env->getMaxY()});
+    }
+    index.build();
+
+    unsigned toplevelpolygons = 0;
+    std::vector<unsigned> inside;
+    geos::geom::prep::PreparedGeometryFactory pgf;
+    for (unsigned i=0 ;i < polys.size(); ++i)
+    {
+        if (polys[i].iscontained) continue;
+        toplevelpolygons++;
+
+        // the smaller polygons within the envelope of this one
+        inside.clear();
+        index.covered_by(index.box(i), [&](size_t j) {
+            if (j > i) {
+                inside.push_back(j);
+            }
+        });
+        if (inside.empty()) continue;
+        std::sort(inside.begin(), inside.end());
+
+        const geos::geom::prep::PreparedGeometry* preparedtoplevelpolygon = pgf.create(polys[i].polygon.get());
+
+        for (auto jt = inside.begin(); jt != inside.end(); ++jt)
+        {
+            unsigned const j = *jt;
+            // Does preparedtoplevelpolygon contain the smaller polygon[j]?
+            if (polys[j].containedbyid == 0 && preparedtoplevelpolygon->contains(polys[j].polygon.get()))
+            {
+                // are we in a [i] contains [k] contains [j] situation
+                // which would actually make j top level
+                bool istoplevelafterall = false;
+                for (auto kt = inside.begin(); kt != jt; ++kt)
+                {
+                    unsigned const k = *kt;
+                    if (polys[k].iscontained && polys[k].containedbyid == i &&
+                        index.box(k).covers(index.box(j)) &&
+                        polys[k].polygon->contains(polys[j].polygon.get()))
+                    {
+                        istoplevelafterall = true;
+                        break;
+                    }
+                }
+                if (!istoplevelafterall)
+                {
+                    polys[j].iscontained = true;
+                    polys[j].containedbyid = i;
+                }
+            }
+        }
+        pgf.destroy(preparedtoplevelpolygon);
+    }
+
+    return toplevelpolygons;
+}
+
+std::string line_wkb(const nodelist_t &nodes)
+{
+    std::string wkb;
+    wkb.reserve(10 + wkb_writer_t::points_size(nodes.size()));
+    wkb_writer_t writer(wkb);
+    writer.header(wkb_writer_t::wkb_line);
+    writer.points(nodes);
+    return wkb;
+}
+
 } // anonymous namespace
 
 
+void geometry_builder::add_polygons(const ring_assembler_t &assembler, bool enable_multi,
+                                    pg_geoms_t &wkbs) const
+{
+    auto const &polys = assembler.polygons();
+
+    if (polys.size() > 1 && enable_multi) {
+        double area = 0;
+        for (auto const &poly : polys) {
+            area += poly.area;
+        }
+        wkbs.emplace_back(assembler.multipolygon_wkb(), true, area);
+    } else {
+        for (size_t i = 0; i < polys.size(); ++i) {
+            wkbs.emplace_back(assembler.polygon_wkb(i), true, polys[i].area);
+        }
+    }
+}
+
 void geometry_builder::pg_geom_t::set(const geos::geom::Geometry *g, bool poly,
                                       reprojection *p)
 {
@@ -227,16 +320,12 @@ geometry_builder::pg_geom_t geometry_builder::get_wkb_simple(const nodelist_t &n
 
     try
     {
-        GeometryFactory gf;
-        auto coords = nodes2coords(gf, nodes);
-        if (polygon && is_polygon_line(coords.get())) {
-            auto geom = create_simple_poly(gf, std::move(coords));
-            wkb.set(geom.get(), true, projection);
+        if (polygon && is_polygon_line(nodes)) {
+            wkb = get_wkb_polygon(nodes);
         } else {
-            if (coords->getSize() < 2)
+            if (nodes.size() < 2)
                 throw std::runtime_error("Excluding degenerate line.");
-            geom_ptr geom(gf.createLineString(coords.release()));
-            wkb.set(geom.get(), false);
+            wkb = pg_geom_t(line_wkb(nodes), false);
         }
     }
     catch (const std::bad_alloc&)
@@ -256,6 +345,19 @@ geometry_builder::pg_geom_t geometry_builder::get_wkb_simple(const nodelist_t &n
     return wkb;
 }
 
+geometry_builder::pg_geom_t geometry_builder::get_wkb_polygon(const nodelist_t &nodes) const
+{
+    ring_assembler_t assembler;
+    if (assembler.assemble_ring(nodes, projection)) {
+        return pg_geom_t(assembler.polygon_wkb(0), true, assembler.polygons()[0].area);
+    }
+
+    // the ring needs repair
+    GeometryFactory gf;
+    auto geom = create_simple_poly(gf, nodes2coords(gf, nodes));
+    return pg_geom_t(geom.get(), true, projection);
+}
+
 geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &nodes, int polygon, double split_at) const
 {
     //TODO: use count to get some kind of hint of how much we should reserve?
@@ -263,23 +365,19 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
 
     try
     {
-        GeometryFactory gf;
-        auto coords = nodes2coords(gf, nodes);
-
-        if (polygon && is_polygon_line(coords.get())) {
-            auto geom = create_simple_poly(gf, std::move(coords));
-            wkbs.emplace_back(geom.get(), true, projection);
+        if (polygon && is_polygon_line(nodes)) {
+            wkbs.push_back(get_wkb_polygon(nodes));
         } else {
-            if (coords->getSize() < 2)
+            if (nodes.size() < 2)
                 throw std::runtime_error("Excluding degenerate line.");
 
             double distance = 0;
-            std::unique_ptr<CoordinateSequence> segment(gf.getCoordinateSequenceFactory()->create((size_t)0, (size_t)2));
-            segment->add(coords->getAt(0));
-            for(size_t i=1; i<coords->getSize(); i++) {
-                const Coordinate this_pt = coords->getAt(i);
-                const Coordinate prev_pt = coords->getAt(i-1);
-                const double delta = this_pt.distance(prev_pt);
+            nodelist_t segment(1, nodes[0]);
+            for(size_t i=1; i<nodes.size(); i++) {
+                const osmNode &this_pt = nodes[i];
+                const osmNode &prev_pt = nodes[i-1];
+                const double delta = std::hypot(this_pt.lon - prev_pt.lon,
+                                                this_pt.lat - prev_pt.lat);
                 assert(!std::isnan(delta));
                 // figure out if the addition of this point would take the total
                 // length of the line in `segment` over the `split_at` distance.
@@ -291,19 +389,18 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
                     // the `split_at` distance.
                     for (size_t j = 0; j < splits; ++j) {
                         double frac = (double(j + 1) * split_at - distance) / delta;
-                        const Coordinate interpolated(frac * (this_pt.x - prev_pt.x) + prev_pt.x,
-                                                      frac * (this_pt.y - prev_pt.y) + prev_pt.y);
-                        segment->add(interpolated);
-                        geom_ptr geom(gf.createLineString(segment.release()));
+                        const osmNode interpolated(frac * (this_pt.lon - prev_pt.lon) + prev_pt.lon,
+                                                   frac * (this_pt.lat - prev_pt.lat) + prev_pt.lat);
+                        segment.push_back(interpolated);
 
-                        wkbs.emplace_back(geom.get(), false);
+                        wkbs.emplace_back(line_wkb(segment), false);
 
-                        segment.reset(gf.getCoordinateSequenceFactory()->create((size_t)0, (size_t)2));
-                        segment->add(interpolated);
+                        segment.assign(1, interpolated);
                   }
                   // reset the distance based on the final splitting point for
                   // the next iteration.
-                  distance = segment->getAt(0).distance(this_pt);
+                  distance = std::hypot(segment[0].lon - this_pt.lon,
+                                        segment[0].lat - this_pt.lat);
 
                 } else {
                   // if not split then just push this point onto the sequence
@@ -312,13 +409,11 @@ geometry_builder::pg_geoms_t geometry_builder::get_wkb_split(const nodelist_t &n
                 }
 
                 // always add this point
-                segment->add(this_pt);
+                segment.push_back(this_pt);
 
                 // on the last iteration, close out the line.
-                if (i == coords->getSize()-1) {
-                    geom_ptr geom(gf.createLineString(segment.release()));
-
-                    wkbs.emplace_back(geom.get(), false);
+                if (i == nodes.size()-1) {
+                    wkbs.emplace_back(line_wkb(segment), false);
                 }
             }
         }
@@ -393,6 +488,28 @@ geometry_builder::pg_geoms_t geometry_builder::build_polygons(const multinodelis
 {
     pg_geoms_t wkbs;
 
+    try
+    {
+        ring_assembler_t assembler;
+        if (assembler.merge(xnodes) && assembler.assemble(projection)) {
+            add_polygons(assembler, enable_multi, wkbs);
+            return wkbs;
+        }
+    }//TODO: don't show in message id when osm_id == -1
+    catch (const std::exception& e)
+    {
+        std::cerr << std::endl << "Standard exception processing relation_id="<< osm_id << ": " << e.what()  << std::endl;
+        return wkbs;
+    }
+
+    return build_polygons_geos(xnodes, enable_multi, osm_id);
+}
+
+geometry_builder::pg_geoms_t geometry_builder::build_polygons_geos(const multinodelist_t &xnodes,
+                                                                   bool enable_multi, osmid_t osm_id) const
+{
+    pg_geoms_t wkbs;
+
     try
     {
         GeometryFactory gf;
@@ -426,42 +543,9 @@ geometry_builder::pg_geoms_t geometry_builder::build_polygons(const multinodelis
         {
             std::sort(polys.begin(), polys.end(), polygondata_comparearea());
 
-            unsigned toplevelpolygons = 0;
-            int istoplevelafterall;
+            unsigned toplevelpolygons = nest_polygons(polys);
             size_t totalpolys = polys.size();
 
-            geos::geom::prep::PreparedGeometryFactory pgf;
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-                toplevelpolygons++;
-                const geos::geom::prep::PreparedGeometry* preparedtoplevelpolygon = pgf.create(polys[i].polygon.get());
-
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                    // Does preparedtoplevelpolygon contain the smaller polygon[j]?
-                    if (polys[j].containedbyid == 0 && preparedtoplevelpolygon->contains(polys[j].polygon.get()))
-                    {
-                        // are we in a [i] contains [k] contains [j] situation
-                        // which would actually make j top level
-                        istoplevelafterall = 0;
-                        for (unsigned k=i+1; k < j; ++k)
-                        {
-                            if (polys[k].iscontained && polys[k].containedbyid == i && polys[k].polygon->contains(polys[j].polygon.get()))
-                            {
-                                istoplevelafterall = 1;
-                                break;
-                            }
-                        }
-                        if (istoplevelafterall == 0)
-                        {
-                            polys[j].iscontained = true;
-                            polys[j].containedbyid = i;
-                        }
-                    }
-                }
-                pgf.destroy(preparedtoplevelpolygon);
-            }
             // polys now is a list of polygons tagged with which ones are inside each other
 
             // List of polygons for multipolygon
@@ -555,6 +639,44 @@ geometry_builder::pg_geoms_t geometry_builder::build_both(const multinodelist_t
 {
     pg_geoms_t wkbs;
 
+    try
+    {
+        ring_assembler_t assembler;
+        if (assembler.merge(xnodes) && (!make_polygon || assembler.assemble(projection))) {
+            for (auto const &line : assembler.lines()) {
+                // split into parts of about split_at length
+                double distance = 0;
+                nodelist_t segment(1, line[0]);
+                for (size_t j = 1; j < line.size(); ++j) {
+                    segment.push_back(line[j]);
+                    distance += std::hypot(line[j].lon - line[j - 1].lon,
+                                           line[j].lat - line[j - 1].lat);
+                    if ((distance >= split_at) || (j == line.size() - 1)) {
+                        wkbs.emplace_back(line_wkb(segment), false);
+                        segment.assign(1, line[j]);
+                        distance = 0;
+                    }
+                }
+            }
+            add_polygons(assembler, enable_multi, wkbs);
+            return wkbs;
+        }
+    }//TODO: don't show in message id when osm_id == -1
+    catch (const std::exception& e)
+    {
+        std::cerr << std::endl << "Standard exception processing relation id="<< osm_id << ": " << e.what()  << std::endl;
+        return wkbs;
+    }
+
+    return build_both_geos(xnodes, make_polygon, enable_multi, split_at, osm_id);
+}
+
+geometry_builder::pg_geoms_t geometry_builder::build_both_geos(const multinodelist_t &xnodes,
+                                                                 int make_polygon, int enable_multi,
+                                                                 double split_at, osmid_t osm_id) const
+{
+    pg_geoms_t wkbs;
+
     try
     {
         GeometryFactory gf;
@@ -605,59 +727,9 @@ geometry_builder::pg_geoms_t geometry_builder::build_both(const multinodelist_t
         {
             std::sort(polys.begin(), polys.end(), polygondata_comparearea());
 
-            unsigned toplevelpolygons = 0;
-            int istoplevelafterall;
+            unsigned toplevelpolygons = nest_polygons(polys);
             size_t totalpolys = polys.size();
 
-            geos::geom::prep::PreparedGeometryFactory pgf;
-            for (unsigned i=0 ;i < totalpolys; ++i)
-            {
-                if (polys[i].iscontained) continue;
-                toplevelpolygons++;
-                const geos::geom::prep::PreparedGeometry* preparedtoplevelpolygon = pgf.create(polys[i].polygon.get());
-
-                for (unsigned j=i+1; j < totalpolys; ++j)
-                {
-                    // Does preparedtoplevelpolygon contain the smaller polygon[j]?
-                    if (polys[j].containedbyid == 0 && preparedtoplevelpolygon->contains(polys[j].polygon.get()))
-                    {
-                        // are we in a [i] contains [k] contains [j] situation
-                        // which would actually make j top level
-                        istoplevelafterall = 0;
-                        for (unsigned k=i+1; k < j; ++k)
-                        {
-                            if (polys[k].iscontained && polys[k].containedbyid == i && polys[k].polygon->contains(polys[j].polygon.get()))
-                            {
-                                istoplevelafterall = 1;
-                                break;
-                            }
-#if 0
-                            else if (polys[k].polygon->intersects(polys[j].polygon) || polys[k].polygon->touches(polys[j].polygon))
-                            {
-                                // FIXME: This code does not work as intended
-                                // It should be setting the polys[k].ring in order to update this object
-                                // but the value of polys[k].polygon calculated is normally NULL
-
-                                // Add polygon this polygon (j) to k since they intersect
-                                // Mark ourselfs to be dropped (2), delete the original k
-                                Geometry* polyunion = polys[k].polygon->Union(polys[j].polygon);
-                                delete(polys[k].polygon);
-                                polys[k].polygon = dynamic_cast<Polygon*>(polyunion);
-                                polys[j].iscontained = 2; // Drop
-                                istoplevelafterall = 2;
-                                break;
-                            }
-#endif
-                        }
-                        if (istoplevelafterall == 0)
-                        {
-                            polys[j].iscontained = true;
-                            polys[j].containedbyid = i;
-                        }
-                    }
-                }
-              pgf.destroy(preparedtoplevelpolygon);
-            }
             // polys now is a list of polygons tagged with which ones are inside each other
 
             // List of polygons for multipolygon
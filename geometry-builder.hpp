@@ -36,6 +36,7 @@ class CoordinateSequence;
 }}
 
 class reprojection;
+class ring_assembler_t;
 
 class geometry_builder
 {
@@ -107,6 +108,25 @@ private:
     create_simple_poly(geos::geom::GeometryFactory &gf,
                        std::unique_ptr<geos::geom::CoordinateSequence> coords) const;
 
+    /**
+     * Polygon of a closed way. Clean rings are written out directly,
+     * only broken ones go through GEOS to be repaired.
+     */
+    pg_geom_t get_wkb_polygon(const nodelist_t &nodes) const;
+
+    /**
+     * Versions of build_polygons() and build_both() that go through
+     * GEOS, for relations whose rings touch or cross and need repair.
+     */
+    pg_geoms_t build_polygons_geos(const multinodelist_t &xnodes, bool enable_multi,
+                                   osmid_t osm_id) const;
+    pg_geoms_t build_both_geos(const multinodelist_t &xnodes, int make_polygon,
+                               int enable_multi, double split_at, osmid_t osm_id) const;
+
+    /// Add the polygons of the assembler, as one multipolygon if enabled.
+    void add_polygons(const ring_assembler_t &assembler, bool enable_multi,
+                      pg_geoms_t &wkbs) const;
+
     bool excludepoly = false;
     reprojection *projection = nullptr;
 };
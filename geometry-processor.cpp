@@ -92,7 +92,7 @@ relation_helper::~relation_helper()
 {
 }
 
-size_t relation_helper::set(const memberlist_t *member_list, const middle_t* mid)
+size_t relation_helper::set(const memberlist_t *member_list, const middle_query_t *mid)
 {
     // cleanup
     input_way_ids.clear();
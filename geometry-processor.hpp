@@ -9,7 +9,6 @@
 #include "osmtypes.hpp"
 
 struct middle_query_t;
-struct middle_t;
 struct options_t;
 
 struct geometry_processor {
@@ -85,7 +84,7 @@ struct relation_helper
 {
     relation_helper();
     ~relation_helper();
-    size_t set(const memberlist_t *member_list, const middle_t *mid);
+    size_t set(const memberlist_t *member_list, const middle_query_t *mid);
 
     const memberlist_t *members;
     multitaglist_t tags;
@@ -0,0 +1,71 @@
+#include "id-list-codec.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+} // anonymous namespace
+
+void encode_id_list(const idlist_t &ids, std::string &out)
+{
+    out.reserve(out.size() + ids.size() * 2);
+
+    osmid_t prev = 0;
+    for (auto const id : ids) {
+        uint64_t value = zigzag_encode(id - prev);
+        prev = id;
+        while (value >= 0x80) {
+            out.push_back(char((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+}
+
+void decode_id_list(const char *data, size_t len, idlist_t &out)
+{
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+    const unsigned char *end = in + len;
+
+    // every id ends with a byte without the continuation bit
+    size_t count = 0;
+    for (const unsigned char *p = in; p != end; ++p) {
+        count += (*p & 0x80) == 0;
+    }
+    if (len && (end[-1] & 0x80)) {
+        throw std::runtime_error("Truncated id list");
+    }
+    out.reserve(out.size() + count);
+
+    osmid_t prev = 0;
+    while (in != end) {
+        uint64_t value = *in++;
+        // most differences fit into a single byte
+        if (value & 0x80) {
+            value &= 0x7f;
+            int shift = 7;
+            uint64_t byte;
+            do {
+                if (shift > 63) {
+                    throw std::runtime_error("Invalid id list");
+                }
+                byte = *in++;
+                value |= (byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+        }
+        prev += zigzag_decode(value);
+        out.push_back(prev);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef ID_LIST_CODEC_HPP
+#define ID_LIST_CODEC_HPP
+
+#include "osmtypes.hpp"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Compact encoding for lists of ids, like the node lists of ways.
+ *
+ * Every id is stored as the difference to the previous one (the first one
+ * to 0), zigzag encoded so that small negative differences stay small, in
+ * a varint of 7 bits per byte. Consecutive ids, which are common in ways,
+ * need a single byte each.
+ */
+
+/// Appends the encoded ids to out.
+void encode_id_list(const idlist_t &ids, std::string &out);
+
+/// Appends the ids encoded in data to out, throws on malformed input.
+void decode_id_list(const char *data, size_t len, idlist_t &out);
+
+#endif
@@ -152,6 +152,27 @@ void id_tracker::mark(osmid_t id) {
     impl->old_id = min();
 }
 
+void id_tracker::mark(const idlist_t &ids) {
+    if (ids.empty()) {
+        return;
+    }
+
+    //neighbouring ids mostly share a block, which then is only looked
+    //up once
+    block *b = nullptr;
+    osmid_t current = 0;
+    for (auto const id : ids) {
+        const osmid_t blk = id >> BLOCK_BITS;
+        if (!b || blk != current) {
+            b = &impl->pending[blk];
+            current = blk;
+        }
+        impl->count += size_t(b->set(id & BLOCK_MASK, true));
+    }
+    impl->next_start = boost::none;
+    impl->old_id = min();
+}
+
 bool id_tracker::is_marked(osmid_t id) {
     return impl->get(id);
 }
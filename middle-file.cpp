@@ -0,0 +1,530 @@
+/* Implements the mid-layer processing for osm2pgsql
+ * using files in a local directory
+ *
+ * Ways and relations are kept in object stores, node locations
+ * in the flat node file and the reverse lookups needed for
+ * updates in node to way style indexes.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#include "id-list-codec.hpp"
+#include "middle-file.hpp"
+#include "options.hpp"
+#include "osmtypes.hpp"
+
+namespace {
+
+void sort_unique(idlist_t &ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+void put_string(std::string &out, const std::string &str)
+{
+    put_varint(out, str.size());
+    out.append(str);
+}
+
+void put_ids(std::string &out, const idlist_t &ids)
+{
+    std::string encoded;
+    encode_id_list(ids, encoded);
+    put_string(out, encoded);
+}
+
+void put_tags(std::string &out, const taglist_t &tags)
+{
+    put_varint(out, tags.size());
+    for (auto const &tag : tags) {
+        put_string(out, tag.key);
+        put_string(out, tag.value);
+    }
+}
+
+/// Reads back what the put_* functions above wrote.
+class object_reader_t
+{
+public:
+    explicit object_reader_t(const std::string &data)
+    : m_pos(data.data()), m_end(data.data() + data.size()) {}
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_pos == m_end) {
+                break;
+            }
+            uint64_t const byte = static_cast<unsigned char>(*m_pos++);
+            value |= (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Malformed object in the middle files.\n");
+    }
+
+    std::string string()
+    {
+        size_t const len = varint();
+        check(len);
+        std::string str(m_pos, len);
+        m_pos += len;
+        return str;
+    }
+
+    void ids(idlist_t &out)
+    {
+        size_t const len = varint();
+        check(len);
+        decode_id_list(m_pos, len, out);
+        m_pos += len;
+    }
+
+    void tags(taglist_t &out)
+    {
+        size_t const count = varint();
+        out.reserve(out.size() + count);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key = string();
+            out.push_back(tag_t(key, string()));
+        }
+    }
+
+private:
+    void check(size_t len) const
+    {
+        if (len > size_t(m_end - m_pos)) {
+            throw std::runtime_error("Malformed object in the middle files.\n");
+        }
+    }
+
+    const char *m_pos;
+    const char *m_end;
+};
+
+// Ways are stored as their delta encoded node list followed by the tags.
+void decode_way(const std::string &data, idlist_t &nds, taglist_t &tags)
+{
+    object_reader_t reader(data);
+    reader.ids(nds);
+    reader.tags(tags);
+}
+
+// Relations are stored as the member types, the delta encoded member ids,
+// the roles and the tags.
+void decode_relation(const std::string &data, memberlist_t &members,
+                     taglist_t &tags)
+{
+    object_reader_t reader(data);
+    size_t const count = reader.varint();
+    std::string const types = reader.string();
+    idlist_t ids;
+    reader.ids(ids);
+    if (types.size() != count || ids.size() != count) {
+        throw std::runtime_error("Malformed relation in the middle files.\n");
+    }
+
+    members.reserve(members.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        members.push_back(member(static_cast<OsmType>(types[i]), ids[i],
+                                 reader.string()));
+    }
+    reader.tags(tags);
+}
+
+} // anonymous namespace
+
+middle_file_t::middle_file_t()
+    : append(false), mark_pending(true)
+{
+}
+
+middle_file_t::~middle_file_t() {}
+
+std::string middle_file_t::file_name(const char *name) const
+{
+    return *out_options->middle_dir + "/" + out_options->prefix + "_" + name;
+}
+
+void middle_file_t::start(const options_t *out_options_)
+{
+    out_options = out_options_;
+    append = out_options->append;
+    if (!out_options->middle_dir || !out_options->flat_node_cache_enabled) {
+        throw std::runtime_error("The file middle needs a directory and a flat node file.\n");
+    }
+
+    ways_pending_tracker.reset(new id_tracker());
+    rels_pending_tracker.reset(new id_tracker());
+
+    // see middle_pgsql_t::start()
+    mark_pending = out_options->output_backend != "gazetteer";
+
+    cache.reset(new node_ram_cache(out_options->alloc_chunkwise | ALLOC_LOSSY, out_options->cache, out_options->scale));
+    persistent_cache.reset(new node_persistent_cache(out_options, append, false, cache));
+
+    fprintf(stderr, "Mid: file in %s, scale=%d cache=%d\n",
+            out_options->middle_dir->c_str(), out_options->scale,
+            out_options->cache);
+
+    ways.reset(new object_store_t(file_name("ways"), append));
+    rels.reset(new object_store_t(file_name("rels"), append));
+
+    way_node_index.reset();
+    if (mark_pending) {
+        way_node_index.reset(new way_node_index_t(file_name("way_nodes.idx"), append));
+    }
+    rel_way_index.reset(new way_node_index_t(file_name("rel_ways.idx"), append));
+    rel_rel_index.reset(new way_node_index_t(file_name("rel_rels.idx"), append));
+}
+
+void middle_file_t::commit(void)
+{
+    propagate_changes();
+
+    ways->flush();
+    rels->flush();
+    if (way_node_index) {
+        way_node_index->flush();
+        way_node_index->commit();
+    }
+    rel_way_index->flush();
+    rel_way_index->commit();
+    rel_rel_index->flush();
+    rel_rel_index->commit();
+
+    // Make sure the flat nodes are committed to disk or there will be
+    // surprises later.
+    persistent_cache.reset();
+#ifdef HAVE_MMAP
+    // Nodes are only read from now on. A read-only mapping of the
+    // file can be shared by all instances from get_instance().
+    persistent_cache.reset(new node_persistent_cache(out_options, true, true, cache));
+#endif
+}
+
+void middle_file_t::stop(void)
+{
+    cache.reset();
+    persistent_cache.reset();
+
+    if (out_options->droptemp) {
+        ways->destroy();
+        rels->destroy();
+        way_node_index.reset();
+        rel_way_index.reset();
+        rel_rel_index.reset();
+        std::remove(file_name("way_nodes.idx").c_str());
+        std::remove(file_name("rel_ways.idx").c_str());
+        std::remove(file_name("rel_rels.idx").c_str());
+    }
+}
+
+void middle_file_t::analyze(void)
+{
+}
+
+void middle_file_t::end(void)
+{
+}
+
+void middle_file_t::nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags)
+{
+    cache->set(id, lat, lon, tags);
+    persistent_cache->set(id, lat, lon);
+}
+
+size_t middle_file_t::nodes_get_list(nodelist_t &out, const idlist_t nds) const
+{
+    return persistent_cache->get_list(out, nds);
+}
+
+void middle_file_t::nodes_delete(osmid_t id)
+{
+    persistent_cache->set(id, NAN, NAN);
+}
+
+void middle_file_t::node_changed(osmid_t id)
+{
+    if (!mark_pending) {
+        return;
+    }
+
+    changed_nodes.push_back(id);
+}
+
+void middle_file_t::ways_set(osmid_t id, const idlist_t &nds, const taglist_t &tags)
+{
+    std::string data;
+    put_ids(data, nds);
+    put_tags(data, tags);
+    ways->set(id, data);
+
+    if (way_node_index) {
+        way_node_index->set(id, nds);
+    }
+}
+
+bool middle_file_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
+{
+    ways->end_write();
+
+    std::string data;
+    if (!ways->get(id, data)) {
+        return false;
+    }
+
+    idlist_t nds;
+    decode_way(data, nds, tags);
+    nodes_get_list(nodes, nds);
+    return true;
+}
+
+size_t middle_file_t::ways_get_list(const idlist_t &ids, idlist_t &way_ids,
+                                    multitaglist_t &tags,
+                                    multinodelist_t &nodes) const
+{
+    ways->end_write();
+
+    // the node locations of all ways are looked up at once
+    idlist_t all_nds;
+    std::vector<size_t> node_offsets(1, 0);
+    std::string data;
+    for (auto const id : ids) {
+        if (!ways->get(id, data)) {
+            continue;
+        }
+        way_ids.push_back(id);
+        tags.push_back(taglist_t());
+        decode_way(data, all_nds, tags.back());
+        node_offsets.push_back(all_nds.size());
+    }
+
+    nodelist_t locations;
+    persistent_cache->get_batch(locations, all_nds);
+
+    for (size_t i = 1; i < node_offsets.size(); ++i) {
+        nodes.push_back(nodelist_t());
+        for (size_t j = node_offsets[i - 1]; j < node_offsets[i]; ++j) {
+            if (!std::isnan(locations[j].lat) || !std::isnan(locations[j].lon)) {
+                nodes.back().push_back(locations[j]);
+            }
+        }
+    }
+
+    return way_ids.size();
+}
+
+void middle_file_t::ways_delete(osmid_t id)
+{
+    ways->remove(id);
+
+    if (way_node_index) {
+        way_node_index->remove(id);
+    }
+}
+
+void middle_file_t::way_changed(osmid_t id)
+{
+    changed_ways.push_back(id);
+}
+
+void middle_file_t::relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags)
+{
+    std::string types;
+    idlist_t ids, way_parts, rel_parts;
+    for (auto const &m : members) {
+        types.push_back(char(m.type));
+        ids.push_back(m.id);
+        if (m.type == OSMTYPE_WAY) {
+            way_parts.push_back(m.id);
+        } else if (m.type == OSMTYPE_RELATION) {
+            rel_parts.push_back(m.id);
+        }
+    }
+
+    std::string data;
+    put_varint(data, members.size());
+    put_string(data, types);
+    put_ids(data, ids);
+    for (auto const &m : members) {
+        put_string(data, m.role);
+    }
+    put_tags(data, tags);
+    rels->set(id, data);
+
+    rel_way_index->set(id, way_parts);
+    rel_rel_index->set(id, rel_parts);
+}
+
+bool middle_file_t::relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
+{
+    rels->end_write();
+
+    std::string data;
+    if (!rels->get(id, data)) {
+        return false;
+    }
+
+    decode_relation(data, members, tags);
+    return true;
+}
+
+size_t middle_file_t::relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                                         multimemberlist_t &members,
+                                         multitaglist_t &tags) const
+{
+    size_t count = 0;
+    for (auto const id : ids) {
+        memberlist_t rel_members;
+        taglist_t rel_tags;
+        if (relations_get(id, rel_members, rel_tags)) {
+            rel_ids.push_back(id);
+            members.push_back(std::move(rel_members));
+            tags.push_back(std::move(rel_tags));
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+void middle_file_t::relations_delete(osmid_t id)
+{
+    //keep track of whatever ways this relation interesects
+    memberlist_t members;
+    taglist_t tags;
+    if (relations_get(id, members, tags)) {
+        for (auto const &m : members) {
+            if (m.type == OSMTYPE_WAY) {
+                ways_pending_tracker->mark(m.id);
+            }
+        }
+    }
+
+    rels->remove(id);
+    rel_way_index->remove(id);
+    rel_rel_index->remove(id);
+}
+
+void middle_file_t::relation_changed(osmid_t id)
+{
+    changed_rels.push_back(id);
+}
+
+std::vector<osmid_t> middle_file_t::relations_using_way(osmid_t way_id) const
+{
+    return rel_way_index->ways_using(idlist_t(1, way_id));
+}
+
+void middle_file_t::propagate_changes()
+{
+    if (changed_nodes.empty() && changed_ways.empty() && changed_rels.empty()) {
+        return;
+    }
+
+    sort_unique(changed_nodes);
+    sort_unique(changed_ways);
+    sort_unique(changed_rels);
+
+    //keep track of whatever ways these nodes intersect, the ways are
+    //marked as pending relations as well
+    if (way_node_index) {
+        idlist_t const node_ways = way_node_index->ways_using(changed_nodes);
+        ways_pending_tracker->mark(node_ways);
+        rels_pending_tracker->mark(node_ways);
+    }
+
+    //and whatever rels the ways and rels are members of
+    rels_pending_tracker->mark(rel_way_index->ways_using(changed_ways));
+    rels_pending_tracker->mark(rel_rel_index->ways_using(changed_rels));
+
+    changed_nodes.clear();
+    changed_ways.clear();
+    changed_rels.clear();
+}
+
+void middle_file_t::iterate_ways(middle_t::pending_processor& pf)
+{
+    propagate_changes();
+
+    // enqueue the jobs
+    osmid_t id;
+    while(id_tracker::is_valid(id = ways_pending_tracker->pop_mark()))
+    {
+        pf.enqueue_ways(id);
+    }
+    // in case we had higher ones than the middle
+    pf.enqueue_ways(id_tracker::max());
+
+    //let the threads work on them
+    pf.process_ways();
+}
+
+void middle_file_t::iterate_relations(pending_processor& pf)
+{
+    propagate_changes();
+
+    // enqueue the jobs
+    osmid_t id;
+    while(id_tracker::is_valid(id = rels_pending_tracker->pop_mark()))
+    {
+        pf.enqueue_relations(id);
+    }
+    // in case we had higher ones than the middle
+    pf.enqueue_relations(id_tracker::max());
+
+    //let the threads work on them
+    pf.process_relations();
+}
+
+size_t middle_file_t::pending_count() const
+{
+    return ways_pending_tracker->size() + rels_pending_tracker->size();
+}
+
+std::shared_ptr<const middle_query_t> middle_file_t::get_instance() const
+{
+    middle_file_t *mid = new middle_file_t();
+    mid->out_options = out_options;
+    mid->append = append;
+    mid->mark_pending = mark_pending;
+
+    //NOTE: the stores and indexes are only read from during pending
+    //processing, so all instances can share them
+    mid->ways = ways;
+    mid->rels = rels;
+    mid->way_node_index = way_node_index;
+    mid->rel_way_index = rel_way_index;
+    mid->rel_rel_index = rel_rel_index;
+    mid->ways_pending_tracker = ways_pending_tracker;
+    mid->rels_pending_tracker = rels_pending_tracker;
+
+    mid->cache = cache;
+    // The persistent cache on the other hand is only thread-safe for reading
+    // when the file is mapped, otherwise we create one per instance.
+    if (persistent_cache && persistent_cache->is_mapped())
+        mid->persistent_cache = persistent_cache;
+    else
+        mid->persistent_cache.reset(new node_persistent_cache(out_options, 1, true, cache));
+
+    return std::shared_ptr<const middle_query_t>(mid);
+}
@@ -0,0 +1,85 @@
+/* Implements the mid-layer processing for osm2pgsql
+ * using files in a local directory
+ *
+ * This layer stores the same data as the slim tables of
+ * middle-pgsql, including what is needed for updates, but
+ * keeps it away from the database server
+*/
+
+#ifndef MIDDLE_FILE_H
+#define MIDDLE_FILE_H
+
+#include "middle.hpp"
+#include "node-ram-cache.hpp"
+#include "node-persistent-cache.hpp"
+#include "id-tracker.hpp"
+#include "object-store.hpp"
+#include "way-node-index.hpp"
+#include <memory>
+#include <string>
+
+struct middle_file_t : public slim_middle_t {
+    middle_file_t();
+    virtual ~middle_file_t();
+
+    void start(const options_t *out_options_);
+    void stop(void);
+    void analyze(void);
+    void end(void);
+    void commit(void);
+
+    void nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags);
+    size_t nodes_get_list(nodelist_t &out, const idlist_t nds) const;
+    void nodes_delete(osmid_t id);
+    void node_changed(osmid_t id);
+
+    void ways_set(osmid_t id, const idlist_t &nds, const taglist_t &tags);
+    bool ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const;
+    size_t ways_get_list(const idlist_t &ids, idlist_t &way_ids,
+                      multitaglist_t &tags, multinodelist_t &nodes) const;
+
+    void ways_delete(osmid_t id);
+    void way_changed(osmid_t id);
+
+    bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const;
+    size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                              multimemberlist_t &members,
+                              multitaglist_t &tags) const;
+    void relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags);
+    void relations_delete(osmid_t id);
+    void relation_changed(osmid_t id);
+
+    void iterate_ways(middle_t::pending_processor& pf);
+    void iterate_relations(pending_processor& pf);
+
+    size_t pending_count() const;
+
+    std::vector<osmid_t> relations_using_way(osmid_t way_id) const;
+
+    virtual std::shared_ptr<const middle_query_t> get_instance() const;
+private:
+    /**
+     * Marks the objects affected by the nodes, ways and relations changed
+     * since the last call as pending.
+     */
+    void propagate_changes();
+    std::string file_name(const char *name) const;
+
+    bool append;
+    bool mark_pending;
+
+    std::shared_ptr<node_ram_cache> cache;
+    std::shared_ptr<node_persistent_cache> persistent_cache;
+
+    std::shared_ptr<object_store_t> ways, rels;
+    // nodes to the ways using them, and ways and relations to the
+    // relations they are members of
+    std::shared_ptr<way_node_index_t> way_node_index, rel_way_index,
+        rel_rel_index;
+
+    std::shared_ptr<id_tracker> ways_pending_tracker, rels_pending_tracker;
+    // changed objects, whose dependents have not been marked yet
+    idlist_t changed_nodes, changed_ways, changed_rels;
+};
+
+#endif
@@ -12,10 +12,7 @@
 using namespace std;
 #endif
 
-#ifdef _MSC_VER
-#define alloca _alloca
-#endif
-
+#include <algorithm>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -24,12 +21,12 @@ using namespace std;
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <future>
 
 #include <boost/format.hpp>
 
 #include <libpq-fe.h>
 
+#include "id-list-codec.hpp"
 #include "middle-pgsql.hpp"
 #include "node-persistent-cache.hpp"
 #include "node-ram-cache.hpp"
@@ -38,6 +35,7 @@ using namespace std;
 #include "output-pgsql.hpp"
 #include "pgsql.hpp"
 #include "util.hpp"
+#include "way-node-index.hpp"
 
 enum table_id {
     t_node, t_way, t_rel
@@ -69,201 +67,362 @@ middle_pgsql_t::table_desc::table_desc(const char *name_,
 {}
 
 namespace {
-char *pgsql_store_nodes(const idlist_t &nds) {
-  static char *buffer;
-  static size_t buflen;
-
-  if( buflen <= nds.size() * 10 )
-  {
-    buflen = ((nds.size() * 10) | 4095) + 1;  // Round up to next page */
-    buffer = static_cast<char *>(realloc( buffer, buflen ));
-  }
-_restart:
-
-  char *ptr = buffer;
-  bool first = true;
-  *ptr++ = '{';
-  for (idlist_t::const_iterator it = nds.begin(); it != nds.end(); ++it)
-  {
-    if (!first)
-      *ptr++ = ',';
-    ptr += sprintf(ptr, "%" PRIdOSMID, *it);
-
-    if( (size_t) (ptr-buffer) > (buflen-20) ) // Almost overflowed? */
-    {
-      buflen <<= 1;
-      buffer = static_cast<char *>(realloc( buffer, buflen ));
+// Append the valid locations in [begin, end) to out, skipping the nodes
+// that couldn't be found.
+size_t copy_valid_nodes(nodelist_t &out, nodelist_t::const_iterator begin,
+                        nodelist_t::const_iterator end)
+{
+    size_t count = 0;
+    for (auto it = begin; it != end; ++it) {
+        if (!std::isnan(it->lat) || !std::isnan(it->lon)) {
+            out.push_back(*it);
+            ++count;
+        }
+    }
+    return count;
+}
+
+using pgsql_binary::put_int16;
+using pgsql_binary::put_int32;
+using pgsql_binary::put_int64;
+using pgsql_binary::put_float8;
+using pgsql_binary::get_int32;
+using pgsql_binary::get_int64;
+using pgsql_binary::get_float8;
+using pgsql_binary::reserve_int32;
+using pgsql_binary::end_field;
+using pgsql_binary::put_null;
+
+// Element types of the arrays in the slim tables. Oids of built-in types
+// are fixed, so there is no need to look them up.
+const int32_t int8_oid = 20;
+const int32_t text_oid = 25;
+
+// Binary array header for a one-dimensional array without NULLs
+void put_array_header(std::string &dst, int32_t elem_oid, size_t count)
+{
+    put_int32(dst, count ? 1 : 0);
+    put_int32(dst, 0);
+    put_int32(dst, elem_oid);
+    if (count) {
+        put_int32(dst, count);
+        put_int32(dst, 1);
+    }
+}
 
-      goto _restart;
+void put_id_array(std::string &dst, const idlist_t &ids)
+{
+    put_array_header(dst, int8_oid, ids.size());
+    for (auto const id : ids) {
+        put_int32(dst, 8);
+        put_int64(dst, id);
     }
-    first = false;
-  }
+}
 
-  *ptr++ = '}';
-  *ptr++ = 0;
+// Tags are stored as a flat array of alternating keys and values
+void put_tag_array(std::string &dst, const taglist_t &tags)
+{
+    put_array_header(dst, text_oid, tags.size() * 2);
+    for (auto const &tag : tags) {
+        put_int32(dst, tag.key.size());
+        dst.append(tag.key);
+        put_int32(dst, tag.value.size());
+        dst.append(tag.value);
+    }
+}
 
-  return buffer;
+// Fields of a binary COPY row, each preceded by its length
+void put_id_field(std::string &dst, osmid_t id)
+{
+    put_int32(dst, 8);
+    put_int64(dst, id);
 }
 
-// Special escape routine for escaping strings in array constants: double quote, backslash,newline, tab*/
-inline char *escape_tag( char *ptr, const std::string &in, bool escape )
+void put_id_array_field(std::string &dst, const idlist_t &ids)
 {
-  for (const char c: in)
-  {
-    switch(c)
-    {
-      case '"':
-        if( escape ) *ptr++ = '\\';
-        *ptr++ = '\\';
-        *ptr++ = '"';
-        break;
-      case '\\':
-        if( escape ) *ptr++ = '\\';
-        if( escape ) *ptr++ = '\\';
-        *ptr++ = '\\';
-        *ptr++ = '\\';
-        break;
-      case '\n':
-        if( escape ) *ptr++ = '\\';
-        *ptr++ = '\\';
-        *ptr++ = 'n';
-        break;
-      case '\r':
-        if( escape ) *ptr++ = '\\';
-        *ptr++ = '\\';
-        *ptr++ = 'r';
-        break;
-      case '\t':
-        if( escape ) *ptr++ = '\\';
-        *ptr++ = '\\';
-        *ptr++ = 't';
-        break;
-      default:
-        *ptr++ = c;
-        break;
-    }
-  }
-  return ptr;
+    size_t pos = reserve_int32(dst);
+    put_id_array(dst, ids);
+    end_field(dst, pos);
 }
 
-// escape means we return '\N' for copy mode, otherwise we return just nullptr */
-const char *pgsql_store_tags(const taglist_t &tags, bool escape)
+// An empty tag list is stored as NULL
+void put_tag_array_field(std::string &dst, const taglist_t &tags)
 {
-  static char *buffer;
-  static int buflen;
-
-  int countlist = tags.size();
-  if( countlist == 0 )
-  {
-    if( escape )
-      return "\\N";
-    else
-      return nullptr;
-  }
-
-  if( buflen <= countlist * 24 ) // LE so 0 always matches */
-  {
-    buflen = ((countlist * 24) | 4095) + 1;  // Round up to next page */
-    buffer = static_cast<char *>(realloc( buffer, buflen ));
-  }
-_restart:
-
-  char *ptr = buffer;
-  bool first = true;
-  *ptr++ = '{';
-
-  for (taglist_t::const_iterator it = tags.begin(); it != tags.end(); ++it)
-  {
-    int maxlen = (it->key.length() + it->value.length()) * 4;
-    if( (ptr+maxlen-buffer) > (buflen-20) ) // Almost overflowed? */
+    if (tags.empty()) {
+        put_null(dst);
+        return;
+    }
+    size_t pos = reserve_int32(dst);
+    put_tag_array(dst, tags);
+    end_field(dst, pos);
+}
+
+// Parameters of a prepared statement, sent in binary format
+class binary_params_t
+{
+public:
+    std::string &add()
     {
-      buflen <<= 1;
-      buffer = static_cast<char *>(realloc( buffer, buflen ));
+        values.push_back(std::string());
+        nulls.push_back(false);
+        return values.back();
+    }
+
+    void add_null()
+    {
+        values.push_back(std::string());
+        nulls.push_back(true);
+    }
 
-      goto _restart;
+    void add_id(osmid_t id) { put_int64(add(), id); }
+    void add_id_array(const idlist_t &ids) { put_id_array(add(), ids); }
+
+    void add_tags(const taglist_t &tags)
+    {
+        if (tags.empty())
+            add_null();
+        else
+            put_tag_array(add(), tags);
     }
-    if( !first ) *ptr++ = ',';
-    *ptr++ = '"';
-    ptr = escape_tag(ptr, it->key, escape);
-    *ptr++ = '"';
-    *ptr++ = ',';
-    *ptr++ = '"';
-    ptr = escape_tag(ptr, it->value, escape);
-    *ptr++ = '"';
 
-    first = false;
-  }
+    PGresult *exec(PGconn *sql_conn, const char *stmt, ExecStatusType expect) const
+    {
+        std::vector<const char *> ptrs;
+        std::vector<int> lengths;
+        get_pointers(ptrs, lengths);
+        return pgsql_execPreparedBinary(sql_conn, stmt, values.size(),
+                                        ptrs.data(), lengths.data(), expect);
+    }
 
-  *ptr++ = '}';
-  *ptr++ = 0;
+    void send(pgsql_pipeline_t &pipeline, const char *stmt, ExecStatusType expect) const
+    {
+        std::vector<const char *> ptrs;
+        std::vector<int> lengths;
+        get_pointers(ptrs, lengths);
+        pipeline.send_prepared(stmt, values.size(), ptrs.data(),
+                               lengths.data(), expect);
+    }
 
-  return buffer;
+private:
+    void get_pointers(std::vector<const char *> &ptrs, std::vector<int> &lengths) const
+    {
+        for (size_t i = 0; i < values.size(); ++i) {
+            ptrs.push_back(nulls[i] ? nullptr : values[i].data());
+            lengths.push_back(values[i].size());
+        }
+    }
+
+    std::vector<std::string> values;
+    std::vector<bool> nulls;
+};
+
+// Runs a prepared statement with a single id parameter
+PGresult *exec_with_id(PGconn *sql_conn, const char *stmt, osmid_t id,
+                       ExecStatusType expect)
+{
+    binary_params_t params;
+    params.add_id(id);
+    return params.exec(sql_conn, stmt, expect);
 }
 
-// Decodes a portion of an array literal from postgres */
-// Argument should point to beginning of literal, on return points to delimiter */
-inline const char *decode_upto( const char *src, char *dst )
+osmid_t get_id(PGresult *res, int row, int col)
 {
-  int quoted = (*src == '"');
-  if( quoted ) src++;
+    return get_int64(PQgetvalue(res, row, col));
+}
 
-  while( quoted ? (*src != '"') : (*src != ',' && *src != '}') )
-  {
-    if( *src == '\\' )
-    {
-      switch( src[1] )
-      {
-        case 'n': *dst++ = '\n'; break;
-        case 't': *dst++ = '\t'; break;
-        default: *dst++ = src[1]; break;
-      }
-      src+=2;
-    }
-    else
-      *dst++ = *src++;
-  }
-  if( quoted ) src++;
-  *dst = 0;
-  return src;
+// Returns the first element of a binary one-dimensional array result
+// and sets count to the number of elements
+const char *array_elements(PGresult *res, int row, int col, int32_t &count)
+{
+    count = 0;
+    if (PQgetisnull(res, row, col)) {
+        return nullptr;
+    }
+    const char *data = PQgetvalue(res, row, col);
+    // empty arrays have no dimensions
+    if (get_int32(data) == 0) {
+        return nullptr;
+    }
+    count = get_int32(data + 12);
+    return data + 20;
+}
+
+// The id arrays never contain NULLs, so all elements have a length of 8
+void parse_id_array(PGresult *res, int row, int col, idlist_t &ids)
+{
+    int32_t count;
+    const char *ptr = array_elements(res, row, col, count);
+    ids.reserve(ids.size() + count);
+    for (int32_t i = 0; i < count; ++i) {
+        ids.push_back(get_int64(ptr + 4));
+        ptr += 12;
+    }
 }
 
-void pgsql_parse_tags(const char *string, taglist_t &tags)
+std::string next_text_element(const char *&ptr)
 {
-  char key[1024];
-  char val[1024];
-
-  if( *string == '\0' )
-    return;
-
-  if( *string++ != '{' )
-    return;
-  while( *string != '}' )
-  {
-    string = decode_upto( string, key );
-    // String points to the comma */
-    string++;
-    string = decode_upto( string, val );
-    // String points to the comma or closing '}' */
-    tags.push_back(tag_t(key, val));
-    if( *string == ',' )
-      string++;
-  }
+    int32_t len = get_int32(ptr);
+    ptr += 4;
+    if (len < 0) {
+        return std::string();
+    }
+    std::string text(ptr, len);
+    ptr += len;
+    return text;
 }
 
-// Parses an array of integers */
-void pgsql_parse_nodes(const char *string, idlist_t &nds)
+void parse_tag_array(PGresult *res, int row, int col, taglist_t &tags)
 {
-  if( *string++ != '{' )
-    return;
-
-  while( *string != '}' )
-  {
-    char *ptr;
-    nds.push_back(strtoosmid( string, &ptr, 10 ));
-    string = ptr;
-    if( *string == ',' )
-      string++;
-  }
+    int32_t count;
+    const char *ptr = array_elements(res, row, col, count);
+    for (int32_t i = 0; i + 1 < count; i += 2) {
+        std::string key = next_text_element(ptr);
+        tags.push_back(tag_t(key, next_text_element(ptr)));
+    }
+}
+
+// Ways using a node are found through an index over blocks of node ids
+// when the node lists are stored delta encoded.
+#define NODE_BLOCK_SHIFT 6
+
+// Number of changed objects whose dependents are looked up in one query
+const size_t change_batch_size = 10000;
+
+// The parts of the way table setup that depend on how the node lists of
+// ways are stored, as arrays (the default) or compact.
+struct way_format_t {
+    const char *ways_create;
+    const char *ways_prepare;
+    const char *ways_prepare_intarray;
+    const char *ways_array_indexes;
+};
+
+const way_format_t array_way_format = {
+    "CREATE %m TABLE %p_ways (id " POSTGRES_OSMID_TYPE " PRIMARY KEY {USING INDEX TABLESPACE %i}, nodes " POSTGRES_OSMID_TYPE "[] not null, tags text[]) {TABLESPACE %t};\n",
+
+    "PREPARE insert_way (" POSTGRES_OSMID_TYPE ", " POSTGRES_OSMID_TYPE "[], text[]) AS INSERT INTO %p_ways VALUES ($1,$2,$3);\n"
+    "PREPARE get_way (" POSTGRES_OSMID_TYPE ") AS SELECT nodes, tags FROM %p_ways WHERE id = $1;\n"
+    "PREPARE get_way_list (" POSTGRES_OSMID_TYPE "[]) AS SELECT id, nodes, tags FROM %p_ways WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
+    "PREPARE delete_way(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1;\n",
+
+    "PREPARE mark_ways_by_nodes(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_ways WHERE nodes && $1;\n"
+    "PREPARE mark_ways_by_rel(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE id IN (SELECT unnest(parts[way_off+1:rel_off]) FROM %p_rels WHERE id = $1);\n",
+
+    "CREATE INDEX %p_ways_nodes ON %p_ways USING gin (nodes) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
+};
+
+// Node lists are delta encoded bytea, see id-list-codec.hpp. The query
+// looking for ways by nodes is given node blocks and returns the node
+// lists as well, because the block index gives false positives that are
+// filtered out afterwards.
+const way_format_t compact_way_format = {
+    "CREATE %m TABLE %p_ways (id " POSTGRES_OSMID_TYPE " PRIMARY KEY {USING INDEX TABLESPACE %i}, nodes bytea not null, tags text[], node_blocks " POSTGRES_OSMID_TYPE "[] not null) {TABLESPACE %t};\n",
+
+    "PREPARE insert_way (" POSTGRES_OSMID_TYPE ", bytea, text[], " POSTGRES_OSMID_TYPE "[]) AS INSERT INTO %p_ways VALUES ($1,$2,$3,$4);\n"
+    "PREPARE get_way (" POSTGRES_OSMID_TYPE ") AS SELECT nodes, tags FROM %p_ways WHERE id = $1;\n"
+    "PREPARE get_way_list (" POSTGRES_OSMID_TYPE "[]) AS SELECT id, nodes, tags FROM %p_ways WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
+    "PREPARE delete_way(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1;\n",
+
+    "PREPARE mark_ways_by_nodes(" POSTGRES_OSMID_TYPE "[]) AS select id, nodes from %p_ways WHERE node_blocks && $1;\n"
+    "PREPARE mark_ways_by_rel(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE id IN (SELECT unnest(parts[way_off+1:rel_off]) FROM %p_rels WHERE id = $1);\n",
+
+    "CREATE INDEX %p_ways_nodes ON %p_ways USING gin (node_blocks) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
+};
+
+// Members are stored as a text array of type and id followed by the role
+void parse_members(PGresult *res, int row, int col, memberlist_t &members)
+{
+    taglist_t member_temp;
+    parse_tag_array(res, row, col, member_temp);
+
+    for (taglist_t::const_iterator it = member_temp.begin(); it != member_temp.end(); ++it) {
+        char tag = it->key[0];
+        OsmType type = (tag == 'n')?OSMTYPE_NODE:(tag == 'w')?OSMTYPE_WAY:(tag == 'r')?OSMTYPE_RELATION:((OsmType)-1);
+        members.push_back(member(type,
+                                 strtoosmid(it->key.c_str()+1, nullptr, 10 ),
+                                 it->value));
+    }
+}
+
+// Sorts ids and removes duplicates
+void sort_unique(idlist_t &ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+// Distinct blocks of the node ids for the index of compact node lists
+idlist_t node_blocks(const idlist_t &nds)
+{
+    idlist_t blocks;
+    blocks.reserve(nds.size());
+    for (auto const id : nds) {
+        blocks.push_back(id >> NODE_BLOCK_SHIFT);
+    }
+    sort_unique(blocks);
+    return blocks;
+}
+
+void parse_way_nodes(PGresult *res, int row, int col, bool compact, idlist_t &nds)
+{
+    if (compact) {
+        decode_id_list(PQgetvalue(res, row, col), PQgetlength(res, row, col), nds);
+    } else {
+        parse_id_array(res, row, col, nds);
+    }
+}
+
+// Runs a query taking an array of ids for the sorted ids in batches and
+// returns the sorted ids in the first column of all results.
+idlist_t ids_by_batch(PGconn *sql_conn, const char *stmt, const idlist_t &ids)
+{
+    idlist_t found;
+    for (size_t i = 0; i < ids.size(); i += change_batch_size) {
+        idlist_t const batch(ids.begin() + i,
+                             ids.begin() + std::min(ids.size(), i + change_batch_size));
+        binary_params_t params;
+        params.add_id_array(batch);
+        PGresult *res = params.exec(sql_conn, stmt, PGRES_TUPLES_OK);
+        for (int j = 0; j < PQntuples(res); ++j) {
+            found.push_back(get_id(res, j, 0));
+        }
+        PQclear(res);
+    }
+    sort_unique(found);
+    return found;
+}
+
+// Like ids_by_batch for the ways using any of the sorted node ids. The
+// query for compact node lists is given the node blocks and also returns
+// the nodes of each way to rule out ways that only share a block.
+idlist_t ways_by_nodes(PGconn *sql_conn, const idlist_t &node_ids, bool compact)
+{
+    if (!compact) {
+        return ids_by_batch(sql_conn, "mark_ways_by_nodes", node_ids);
+    }
+
+    idlist_t found;
+    idlist_t nds;
+    for (size_t i = 0; i < node_ids.size(); i += change_batch_size) {
+        auto const begin = node_ids.begin() + i;
+        auto const end = node_ids.begin() + std::min(node_ids.size(), i + change_batch_size);
+        binary_params_t params;
+        params.add_id_array(node_blocks(idlist_t(begin, end)));
+        PGresult *res = params.exec(sql_conn, "mark_ways_by_nodes", PGRES_TUPLES_OK);
+        for (int j = 0; j < PQntuples(res); ++j) {
+            nds.clear();
+            decode_id_list(PQgetvalue(res, j, 1), PQgetlength(res, j, 1), nds);
+            for (auto const id : nds) {
+                if (std::binary_search(begin, end, id)) {
+                    found.push_back(get_id(res, j, 0));
+                    break;
+                }
+            }
+        }
+        PQclear(res);
+    }
+    sort_unique(found);
+    return found;
 }
 
 int pgsql_endCopy(middle_pgsql_t::table_desc *table)
@@ -271,6 +430,10 @@ int pgsql_endCopy(middle_pgsql_t::table_desc *table)
     // Terminate any pending COPY */
     if (table->copyMode) {
         PGconn *sql_conn = table->sql_conn;
+        std::string trailer;
+        pgsql_binary::put_copy_trailer(trailer);
+        pgsql_CopyData(__FUNCTION__, sql_conn, trailer);
+
         int stop = PQputCopyEnd(sql_conn, nullptr);
         if (stop != 1) {
             fprintf(stderr, "COPY_END for %s failed: %s\n", table->copy, PQerrorMessage(sql_conn));
@@ -295,133 +458,95 @@ void middle_pgsql_t::local_nodes_set(const osmid_t& id, const double& lat,
 {
     if( node_table->copyMode )
     {
-      const char *tag_buf = pgsql_store_tags(tags,1);
-      int length = strlen(tag_buf) + 64;
-      char *buffer = static_cast<char *>(alloca( length ));
+        std::string buffer;
+        put_int16(buffer, 4);
+        put_id_field(buffer, id);
 #ifdef FIXED_POINT
-      ramNode n(lon, lat);
-      if (snprintf(buffer, length, "%" PRIdOSMID "\t%d\t%d\t%s\n",
-                   id, n.int_lat(), n.int_lon(), tag_buf ) > (length-10)) {
-         throw std::runtime_error((boost::format("Buffer overflow node id %1%") % id).str());
-      }
+        ramNode n(lon, lat);
+        put_int32(buffer, 4);
+        put_int32(buffer, n.int_lat());
+        put_int32(buffer, 4);
+        put_int32(buffer, n.int_lon());
 #else
-      if (snprintf( buffer, length, "%" PRIdOSMID "\t%.10f\t%.10f\t%s\n", id, lat, lon, tag_buf ) > (length-10)) {
-        throw std::runtime_error((boost::format("Buffer overflow node id %1%") % id).str());
-      }
+        put_int32(buffer, 8);
+        put_float8(buffer, lat);
+        put_int32(buffer, 8);
+        put_float8(buffer, lon);
 #endif
-      pgsql_CopyData(__FUNCTION__, node_table->sql_conn, buffer);
+        put_tag_array_field(buffer, tags);
+        pgsql_CopyData(__FUNCTION__, node_table->sql_conn, buffer);
     } else {
         // Four params: id, lat, lon, tags */
-        const char *paramValues[4];
-        char buffer[64];
-        char *ptr = buffer;
-        paramValues[0] = ptr;
-        ptr += sprintf( ptr, "%" PRIdOSMID, id ) + 1;
-        paramValues[1] = ptr;
+        binary_params_t params;
+        params.add_id(id);
 #ifdef FIXED_POINT
         ramNode n(lon, lat);
-        ptr += sprintf(ptr, "%d", n.int_lat()) + 1;
-        paramValues[2] = ptr;
-        sprintf(ptr, "%d", n.int_lon());
+        put_int32(params.add(), n.int_lat());
+        put_int32(params.add(), n.int_lon());
 #else
-        ptr += sprintf( ptr, "%.10f", lat ) + 1;
-        paramValues[2] = ptr;
-        sprintf( ptr, "%.10f", lon );
+        put_float8(params.add(), lat);
+        put_float8(params.add(), lon);
 #endif
-        paramValues[3] = pgsql_store_tags(tags,0);
-        pgsql_execPrepared(node_table->sql_conn, "insert_node", 4, (const char * const *)paramValues, PGRES_COMMAND_OK);
+        params.add_tags(tags);
+        params.exec(node_table->sql_conn, "insert_node", PGRES_COMMAND_OK);
     }
 }
 
-// This should be made more efficient by using an IN(ARRAY[]) construct */
-size_t middle_pgsql_t::local_nodes_get_list(nodelist_t &out, const idlist_t nds) const
+void middle_pgsql_t::local_nodes_get_batch(nodelist_t &out, const idlist_t &nds) const
 {
-    assert(out.empty());
-
-    char tmp[16];
-
-    char *tmp2 = static_cast<char *>(malloc(sizeof(char) * nds.size() * 16));
-    if (tmp2 == nullptr) return 0; //failed to allocate memory, return */
-
+    out.assign(nds.size(), osmNode());
 
-    // create a list of ids in tmp2 to query the database  */
-    sprintf(tmp2, "{");
-    int countDB = 0;
-    for(idlist_t::const_iterator it = nds.begin(); it != nds.end(); ++it) {
-        // Check cache first */
-        osmNode loc;
-        if (cache->get(&loc, *it) == 0) {
-            out.push_back(loc);
-            continue;
+    // Check cache first, and ask the database only once for each of the
+    // remaining ids, even if several ways share them
+    std::unordered_map<osmid_t, osmNode> db_nodes;
+    for (size_t i = 0; i < nds.size(); ++i) {
+        if (cache->get(&out[i], nds[i]) != 0) {
+            db_nodes.emplace(nds[i], osmNode());
         }
+    }
 
-        countDB++;
-        // Mark nodes as needing to be fetched from the DB */
-        out.push_back(osmNode());
-
-        snprintf(tmp, sizeof(tmp), "%" PRIdOSMID ",", *it);
-        strncat(tmp2, tmp, sizeof(char)*(nds.size()*16 - 2));
+    if (db_nodes.empty()) {
+        return; // All ids where in cache, so nothing more to do */
     }
-    tmp2[strlen(tmp2) - 1] = '}'; // replace last , with } to complete list of ids*/
 
-    if (countDB == 0) {
-        free(tmp2);
-        return nds.size(); // All ids where in cache, so nothing more to do */
+    // create a list of ids to query the database
+    idlist_t ids;
+    ids.reserve(db_nodes.size());
+    for (auto const &n : db_nodes) {
+        ids.push_back(n.first);
     }
 
     pgsql_endCopy(node_table);
 
-    PGconn *sql_conn = node_table->sql_conn;
-
-    char const *paramValues[1];
-    paramValues[0] = tmp2;
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_node_list", 1, paramValues, PGRES_TUPLES_OK);
+    binary_params_t params;
+    params.add_id_array(ids);
+    PGresult *res = params.exec(node_table->sql_conn, "get_node_list", PGRES_TUPLES_OK);
     int countPG = PQntuples(res);
 
-    //store the pg results in a hashmap and telling it how many we expect
-    std::unordered_map<osmid_t, osmNode> pg_nodes(countPG);
-
     for (int i = 0; i < countPG; i++) {
-        osmid_t id = strtoosmid(PQgetvalue(res, i, 0), nullptr, 10);
-        osmNode node;
+        osmNode &node = db_nodes[get_id(res, i, 0)];
 #ifdef FIXED_POINT
-        ramNode n((int) strtol(PQgetvalue(res, i, 2), nullptr, 10),
-                  (int) strtol(PQgetvalue(res, i, 1), nullptr, 10));
+        ramNode n((int) get_int32(PQgetvalue(res, i, 2)),
+                  (int) get_int32(PQgetvalue(res, i, 1)));
 
         node.lat = n.lat();
         node.lon = n.lon();
 #else
-        node.lat = strtod(PQgetvalue(res, i, 1), nullptr);
-        node.lon = strtod(PQgetvalue(res, i, 2), nullptr);
+        node.lat = get_float8(PQgetvalue(res, i, 1));
+        node.lon = get_float8(PQgetvalue(res, i, 2));
 #endif
-        pg_nodes.emplace(id, node);
     }
 
     PQclear(res);
-    free(tmp2);
 
-    // If some of the nodes in the way don't exist, the returning list has holes.
-    // Merge the two lists removing any holes.
-    size_t wrtidx = 0;
+    // Nodes missing from the database stay invalid
     for (size_t i = 0; i < nds.size(); ++i) {
         if (std::isnan(out[i].lat)) {
-            std::unordered_map<osmid_t, osmNode>::iterator found = pg_nodes.find(nds[i]);
-            if(found != pg_nodes.end()) {
-                out[wrtidx] = found->second;
-                ++wrtidx;
-            }
-        } else {
-            if (wrtidx < i)
-                out[wrtidx] = out[i];
-            ++wrtidx;
+            out[i] = db_nodes[nds[i]];
         }
     }
-    out.resize(wrtidx);
-
-    return wrtidx;
 }
 
-
 void middle_pgsql_t::nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags) {
     cache->set( id, lat, lon, tags );
 
@@ -432,23 +557,30 @@ void middle_pgsql_t::nodes_set(osmid_t id, double lat, double lon, const taglist
     }
 }
 
+void middle_pgsql_t::nodes_get_batch(nodelist_t &out, const idlist_t &nds) const
+{
+    if (out_options->flat_node_cache_enabled) {
+        persistent_cache->get_batch(out, nds);
+    } else {
+        local_nodes_get_batch(out, nds);
+    }
+}
+
 size_t middle_pgsql_t::nodes_get_list(nodelist_t &out, const idlist_t nds) const
 {
-    return (out_options->flat_node_cache_enabled)
-             ? persistent_cache->get_list(out, nds)
-             : local_nodes_get_list(out, nds);
+    nodelist_t batch;
+    nodes_get_batch(batch, nds);
+
+    // If some of the nodes in the way don't exist, the returning list has holes.
+    return copy_valid_nodes(out, batch.begin(), batch.end());
 }
 
 void middle_pgsql_t::local_nodes_delete(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
     // Make sure we're out of copy mode */
     pgsql_endCopy( node_table );
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-    pgsql_execPrepared(node_table->sql_conn, "delete_node", 1, paramValues, PGRES_COMMAND_OK );
+    exec_with_id(node_table->sql_conn, "delete_node", osm_id, PGRES_COMMAND_OK);
 }
 
 void middle_pgsql_t::nodes_delete(osmid_t osm_id)
@@ -466,92 +598,66 @@ void middle_pgsql_t::node_changed(osmid_t osm_id)
         return;
     }
 
-    char const *paramValues[1];
-    char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( way_table );
-    pgsql_endCopy( rel_table );
-
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-
-    //keep track of whatever ways and rels these nodes intersect
-    //TODO: dont need to stop the copy above since we are only reading?
-    PGresult* res = pgsql_execPrepared(way_table->sql_conn, "mark_ways_by_node", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        ways_pending_tracker->mark(marked);
-    }
-    PQclear(res);
-
-    //do the rels too
-    res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_node", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
-    PQclear(res);
+    // the ways and relations affected are looked up for all changes at
+    // once, see propagate_changes()
+    changed_nodes.push_back(osm_id);
 }
 
 void middle_pgsql_t::ways_set(osmid_t way_id, const idlist_t &nds, const taglist_t &tags)
 {
-    // Three params: id, nodes, tags */
-    const char *paramValues[4];
-
     if (way_table->copyMode) {
-      const char *tag_buf = pgsql_store_tags(tags,1);
-      char *node_buf = pgsql_store_nodes(nds);
-      int length = strlen(tag_buf) + strlen(node_buf) + 64;
-      char *buffer = static_cast<char *>(alloca(length));
-      if (snprintf( buffer, length, "%" PRIdOSMID "\t%s\t%s\n",
-              way_id, node_buf, tag_buf ) > (length-10)) {
-          throw std::runtime_error((boost::format("Buffer overflow way id %1%") % way_id).str());
-      }
-      pgsql_CopyData(__FUNCTION__, way_table->sql_conn, buffer);
+        std::string buffer;
+        put_int16(buffer, compact_way_nodes ? 4 : 3);
+        put_id_field(buffer, way_id);
+        if (compact_way_nodes) {
+            size_t pos = reserve_int32(buffer);
+            encode_id_list(nds, buffer);
+            end_field(buffer, pos);
+        } else {
+            put_id_array_field(buffer, nds);
+        }
+        put_tag_array_field(buffer, tags);
+        if (compact_way_nodes) {
+            put_id_array_field(buffer, node_blocks(nds));
+        }
+        pgsql_CopyData(__FUNCTION__, way_table->sql_conn, buffer);
     } else {
-        char buffer[64];
-        char *ptr = buffer;
-        paramValues[0] = ptr;
-        sprintf(ptr, "%" PRIdOSMID, way_id);
-        paramValues[1] = pgsql_store_nodes(nds);
-        paramValues[2] = pgsql_store_tags(tags,0);
-        pgsql_execPrepared(way_table->sql_conn, "insert_way", 3, (const char * const *)paramValues, PGRES_COMMAND_OK);
+        // Three params: id, nodes, tags, and node_blocks for compact nodes */
+        binary_params_t params;
+        params.add_id(way_id);
+        if (compact_way_nodes) {
+            encode_id_list(nds, params.add());
+        } else {
+            params.add_id_array(nds);
+        }
+        params.add_tags(tags);
+        if (compact_way_nodes) {
+            params.add_id_array(node_blocks(nds));
+        }
+        params.exec(way_table->sql_conn, "insert_way", PGRES_COMMAND_OK);
+    }
+
+    if (way_node_index) {
+        way_node_index->set(way_id, nds);
     }
 }
 
 bool middle_pgsql_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
 {
-    char const *paramValues[1];
-    PGconn *sql_conn = way_table->sql_conn;
-
     // Make sure we're out of copy mode */
     pgsql_endCopy( way_table );
 
-    char tmp[16];
-    snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
-    paramValues[0] = tmp;
-
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_way", 1, paramValues, PGRES_TUPLES_OK);
+    PGresult *res = exec_with_id(way_table->sql_conn, "get_way", id, PGRES_TUPLES_OK);
 
     if (PQntuples(res) != 1) {
         PQclear(res);
         return false;
     }
 
-    pgsql_parse_tags( PQgetvalue(res, 0, 1), tags );
+    parse_tag_array(res, 0, 1, tags);
 
-    size_t num_nodes = strtoul(PQgetvalue(res, 0, 2), nullptr, 10);
     idlist_t list;
-    pgsql_parse_nodes( PQgetvalue(res, 0, 0), list);
-    if (num_nodes != list.size()) {
-        fprintf(stderr, "parse_nodes problem for way %s: expected nodes %zu got %zu\n",
-                tmp, num_nodes, list.size());
-        util::exit_nicely();
-    }
+    parse_way_nodes(res, 0, 0, compact_way_nodes, list);
     PQclear(res);
 
     nodes_get_list(nodes, list);
@@ -563,83 +669,76 @@ size_t middle_pgsql_t::ways_get_list(const idlist_t &ids, idlist_t &way_ids,
     if (ids.empty())
         return 0;
 
-    char tmp[16];
-    std::unique_ptr<char[]> tmp2(new (std::nothrow) char[ids.size() * 16]);
-    char const *paramValues[1];
-
-    if (tmp2 == nullptr) return 0; //failed to allocate memory, return */
-
-    // create a list of ids in tmp2 to query the database  */
-    sprintf(tmp2.get(), "{");
-    for(idlist_t::const_iterator it = ids.begin(); it != ids.end(); ++it) {
-        snprintf(tmp, sizeof(tmp), "%" PRIdOSMID ",", *it);
-        strncat(tmp2.get(), tmp, sizeof(char)*(ids.size()*16 - 2));
-    }
-    tmp2[strlen(tmp2.get()) - 1] = '}'; // replace last , with } to complete list of ids*/
-
     pgsql_endCopy(way_table);
 
-    PGconn *sql_conn = way_table->sql_conn;
-
-    paramValues[0] = tmp2.get();
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_way_list", 1, paramValues, PGRES_TUPLES_OK);
+    binary_params_t params;
+    params.add_id_array(ids);
+    PGresult *res = params.exec(way_table->sql_conn, "get_way_list", PGRES_TUPLES_OK);
     int countPG = PQntuples(res);
 
-    idlist_t wayidspg;
-
+    // remember the result row of each way, postgres returns them in
+    // arbitrary order
+    std::unordered_map<osmid_t, int> rows;
+    rows.reserve(countPG);
     for (int i = 0; i < countPG; i++) {
-        wayidspg.push_back(strtoosmid(PQgetvalue(res, i, 0), nullptr, 10));
+        rows.emplace(get_id(res, i, 0), i);
     }
 
-
     // Match the list of ways coming from postgres in a different order
     //   back to the list of ways given by the caller */
-    for(idlist_t::const_iterator it = ids.begin(); it != ids.end(); ++it) {
-        for (int j = 0; j < countPG; j++) {
-            if (*it == wayidspg[j]) {
-                way_ids.push_back(*it);
-                tags.push_back(taglist_t());
-                pgsql_parse_tags(PQgetvalue(res, j, 2), tags.back());
-
-                size_t num_nodes = strtoul(PQgetvalue(res, j, 3), nullptr, 10);
-                idlist_t list;
-                pgsql_parse_nodes( PQgetvalue(res, j, 1), list);
-                if (num_nodes != list.size()) {
-                    fprintf(stderr, "parse_nodes problem for way %s: expected nodes %zu got %zu\n",
-                            tmp, num_nodes, list.size());
-                    util::exit_nicely();
-                }
+    // The node ids of all ways are collected first, so that their
+    // locations can be looked up in one go.
+    idlist_t node_ids;
+    std::vector<size_t> node_offsets;
+    node_offsets.reserve(ids.size() + 1);
+    node_offsets.push_back(0);
+    for (auto const id : ids) {
+        auto const row = rows.find(id);
+        if (row == rows.end()) {
+            continue;
+        }
+        int const j = row->second;
 
-                nodes.push_back(nodelist_t());
-                nodes_get_list(nodes.back(), list);
+        way_ids.push_back(id);
+        tags.push_back(taglist_t());
+        parse_tag_array(res, j, 2, tags.back());
 
-                break;
-            }
-        }
+        parse_way_nodes(res, j, 1, compact_way_nodes, node_ids);
+        node_offsets.push_back(node_ids.size());
     }
 
     assert(way_ids.size() <= ids.size());
 
     PQclear(res);
 
+    nodelist_t locations;
+    nodes_get_batch(locations, node_ids);
+
+    for (size_t i = 1; i < node_offsets.size(); ++i) {
+        nodes.push_back(nodelist_t());
+        copy_valid_nodes(nodes.back(), locations.begin() + node_offsets[i - 1],
+                         locations.begin() + node_offsets[i]);
+    }
+
     return way_ids.size();
 }
 
 
 void middle_pgsql_t::ways_delete(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
     // Make sure we're out of copy mode */
     pgsql_endCopy( way_table );
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-    pgsql_execPrepared(way_table->sql_conn, "delete_way", 1, paramValues, PGRES_COMMAND_OK );
+    exec_with_id(way_table->sql_conn, "delete_way", osm_id, PGRES_COMMAND_OK);
+
+    if (way_node_index) {
+        way_node_index->remove(osm_id);
+    }
 }
 
 void middle_pgsql_t::iterate_ways(middle_t::pending_processor& pf)
 {
+    propagate_changes();
 
     // Make sure we're out of copy mode */
     pgsql_endCopy( way_table );
@@ -659,30 +758,11 @@ void middle_pgsql_t::iterate_ways(middle_t::pending_processor& pf)
 
 void middle_pgsql_t::way_changed(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( rel_table );
-
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-
-    //keep track of whatever rels this way intersects
-    //TODO: dont need to stop the copy above since we are only reading?
-    PGresult* res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_way", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
-    PQclear(res);
+    changed_ways.push_back(osm_id);
 }
 
 void middle_pgsql_t::relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags)
 {
-    // Params: id, way_off, rel_off, parts, members, tags */
-    const char *paramValues[6];
     taglist_t member_list;
     char buf[64];
 
@@ -711,109 +791,110 @@ void middle_pgsql_t::relations_set(osmid_t id, const memberlist_t &members, cons
     all_parts.insert(all_parts.end(), way_parts.begin(), way_parts.end());
     all_parts.insert(all_parts.end(), rel_parts.begin(), rel_parts.end());
 
+    int16_t const way_off = node_parts.size();
+    int16_t const rel_off = node_parts.size() + way_parts.size();
+
     if (rel_table->copyMode)
     {
-      char *tag_buf = strdup(pgsql_store_tags(tags,1));
-      const char *member_buf = pgsql_store_tags(member_list,1);
-      char *parts_buf = pgsql_store_nodes(all_parts);
-      int length = strlen(member_buf) + strlen(tag_buf) + strlen(parts_buf) + 64;
-      char *buffer = static_cast<char *>(alloca(length));
-      if (snprintf( buffer, length, "%" PRIdOSMID "\t%zu\t%zu\t%s\t%s\t%s\n",
-                    id, node_parts.size(), node_parts.size() + way_parts.size(),
-                    parts_buf, member_buf, tag_buf ) > (length-10)) {
-          throw std::runtime_error((boost::format("Buffer overflow relation id %1%") % id).str());
-      }
-      free(tag_buf);
-      pgsql_CopyData(__FUNCTION__, rel_table->sql_conn, buffer);
+        std::string buffer;
+        put_int16(buffer, 6);
+        put_id_field(buffer, id);
+        put_int32(buffer, 2);
+        put_int16(buffer, way_off);
+        put_int32(buffer, 2);
+        put_int16(buffer, rel_off);
+        put_id_array_field(buffer, all_parts);
+        put_tag_array_field(buffer, member_list);
+        put_tag_array_field(buffer, tags);
+        pgsql_CopyData(__FUNCTION__, rel_table->sql_conn, buffer);
     } else {
-        char buffer[64];
-        char *ptr = buffer;
-        paramValues[0] = ptr;
-        ptr += sprintf(ptr, "%" PRIdOSMID, id ) + 1;
-        paramValues[1] = ptr;
-        ptr += sprintf(ptr, "%zu", node_parts.size() ) + 1;
-        paramValues[2] = ptr;
-        sprintf( ptr, "%zu", node_parts.size() + way_parts.size() );
-        paramValues[3] = pgsql_store_nodes(all_parts);
-        paramValues[4] = pgsql_store_tags(member_list,0);
-        if (paramValues[4]) {
-            paramValues[4] = strdup(paramValues[4]);
-        }
-        paramValues[5] = pgsql_store_tags(tags,0);
-        pgsql_execPrepared(rel_table->sql_conn, "insert_rel", 6, (const char * const *)paramValues, PGRES_COMMAND_OK);
-        if (paramValues[4]) {
-            free((void *)paramValues[4]);
-        }
+        // Params: id, way_off, rel_off, parts, members, tags */
+        binary_params_t params;
+        params.add_id(id);
+        put_int16(params.add(), way_off);
+        put_int16(params.add(), rel_off);
+        params.add_id_array(all_parts);
+        params.add_tags(member_list);
+        params.add_tags(tags);
+        params.exec(rel_table->sql_conn, "insert_rel", PGRES_COMMAND_OK);
     }
 }
 
 bool middle_pgsql_t::relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
 {
-    char tmp[16];
-    char const *paramValues[1];
-    PGconn *sql_conn = rel_table->sql_conn;
-    taglist_t member_temp;
-
     // Make sure we're out of copy mode */
     pgsql_endCopy( rel_table );
 
-    snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
-    paramValues[0] = tmp;
-
-    PGresult *res = pgsql_execPrepared(sql_conn, "get_rel", 1, paramValues, PGRES_TUPLES_OK);
-    // Fields are: members, tags, member_count */
+    PGresult *res = exec_with_id(rel_table->sql_conn, "get_rel", id, PGRES_TUPLES_OK);
+    // Fields are: members, tags */
 
     if (PQntuples(res) != 1) {
         PQclear(res);
         return false;
     }
 
-    pgsql_parse_tags(PQgetvalue(res, 0, 1), tags);
-    pgsql_parse_tags(PQgetvalue(res, 0, 0), member_temp);
-
-    if (member_temp.size() != strtoul(PQgetvalue(res, 0, 2), nullptr, 10)) {
-        fprintf(stderr, "Unexpected member_count reading relation %" PRIdOSMID "\n", id);
-        util::exit_nicely();
-    }
+    parse_tag_array(res, 0, 1, tags);
+    parse_members(res, 0, 0, members);
 
     PQclear(res);
 
-    for (taglist_t::const_iterator it = member_temp.begin(); it != member_temp.end(); ++it) {
-        char tag = it->key[0];
-        OsmType type = (tag == 'n')?OSMTYPE_NODE:(tag == 'w')?OSMTYPE_WAY:(tag == 'r')?OSMTYPE_RELATION:((OsmType)-1);
-        members.push_back(member(type,
-                                 strtoosmid(it->key.c_str()+1, nullptr, 10 ),
-                                 it->value));
-    }
     return true;
 }
 
+size_t middle_pgsql_t::relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                                          multimemberlist_t &members,
+                                          multitaglist_t &tags) const
+{
+    pgsql_endCopy(rel_table);
+
+    // All lookups are sent before the first result is read, so that the
+    // whole list costs a single round trip to the database.
+    pgsql_pipeline_t pipeline(rel_table->sql_conn);
+    for (auto const id : ids) {
+        binary_params_t params;
+        params.add_id(id);
+        params.send(pipeline, "get_rel", PGRES_TUPLES_OK);
+    }
+
+    size_t count = 0;
+    for (auto const id : ids) {
+        PGresult *res = pipeline.next_result();
+        if (PQntuples(res) == 1) {
+            rel_ids.push_back(id);
+            members.push_back(memberlist_t());
+            parse_members(res, 0, 0, members.back());
+            tags.push_back(taglist_t());
+            parse_tag_array(res, 0, 1, tags.back());
+            ++count;
+        }
+        PQclear(res);
+    }
+
+    return count;
+}
+
 void middle_pgsql_t::relations_delete(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
     // Make sure we're out of copy mode */
     pgsql_endCopy( way_table );
     pgsql_endCopy( rel_table );
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-    pgsql_execPrepared(rel_table->sql_conn, "delete_rel", 1, paramValues, PGRES_COMMAND_OK );
+    exec_with_id(rel_table->sql_conn, "delete_rel", osm_id, PGRES_COMMAND_OK );
 
     //keep track of whatever ways this relation interesects
     //TODO: dont need to stop the copy above since we are only reading?
-    PGresult* res = pgsql_execPrepared(way_table->sql_conn, "mark_ways_by_rel", 1, paramValues, PGRES_TUPLES_OK );
+    PGresult* res = exec_with_id(way_table->sql_conn, "mark_ways_by_rel", osm_id, PGRES_TUPLES_OK );
     for(int i = 0; i < PQntuples(res); ++i)
     {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        ways_pending_tracker->mark(marked);
+        ways_pending_tracker->mark(get_id(res, i, 0));
     }
     PQclear(res);
 }
 
 void middle_pgsql_t::iterate_relations(pending_processor& pf)
 {
+    propagate_changes();
+
     // Make sure we're out of copy mode */
     pgsql_endCopy( rel_table );
 
@@ -832,43 +913,51 @@ void middle_pgsql_t::iterate_relations(pending_processor& pf)
 
 void middle_pgsql_t::relation_changed(osmid_t osm_id)
 {
-    char const *paramValues[1];
-    char buffer[64];
+    changed_rels.push_back(osm_id);
+}
+
+void middle_pgsql_t::propagate_changes()
+{
+    if (changed_nodes.empty() && changed_ways.empty() && changed_rels.empty()) {
+        return;
+    }
+
     // Make sure we're out of copy mode */
+    pgsql_endCopy( way_table );
     pgsql_endCopy( rel_table );
 
-    sprintf( buffer, "%" PRIdOSMID, osm_id );
-    paramValues[0] = buffer;
-
-    //keep track of whatever ways and rels these nodes intersect
-    //TODO: dont need to stop the copy above since we are only reading?
-    //TODO: can we just mark the id without querying? the where clause seems intersect reltable.parts with the id
-    PGresult* res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels", 1, paramValues, PGRES_TUPLES_OK );
-    for(int i = 0; i < PQntuples(res); ++i)
-    {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res, i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
-    PQclear(res);
+    sort_unique(changed_nodes);
+    sort_unique(changed_ways);
+    sort_unique(changed_rels);
+
+    //keep track of whatever ways these nodes intersect, the ways are
+    //marked as pending relations as well
+    idlist_t const ways = way_node_index
+        ? way_node_index->ways_using(changed_nodes)
+        : ways_by_nodes(way_table->sql_conn, changed_nodes, compact_way_nodes);
+    ways_pending_tracker->mark(ways);
+    rels_pending_tracker->mark(ways);
+
+    //and whatever rels the ways and rels are members of
+    rels_pending_tracker->mark(ids_by_batch(rel_table->sql_conn, "mark_rels_by_ways", changed_ways));
+    rels_pending_tracker->mark(ids_by_batch(rel_table->sql_conn, "mark_rels_by_rels", changed_rels));
+
+    changed_nodes.clear();
+    changed_ways.clear();
+    changed_rels.clear();
 }
 
 idlist_t middle_pgsql_t::relations_using_way(osmid_t way_id) const
 {
-    char const *paramValues[1];
-    char buffer[64];
     // Make sure we're out of copy mode */
     pgsql_endCopy( rel_table );
 
-    sprintf(buffer, "%" PRIdOSMID, way_id);
-    paramValues[0] = buffer;
-
-    PGresult *result = pgsql_execPrepared(rel_table->sql_conn, "rels_using_way",
-                                          1, paramValues, PGRES_TUPLES_OK );
+    PGresult *result = exec_with_id(rel_table->sql_conn, "rels_using_way",
+                                    way_id, PGRES_TUPLES_OK );
     const int ntuples = PQntuples(result);
     idlist_t rel_ids(ntuples);
     for (int i = 0; i < ntuples; ++i) {
-        rel_ids[i] = strtoosmid(PQgetvalue(result, i, 0), nullptr, 10);
+        rel_ids[i] = get_id(result, i, 0);
     }
     PQclear(result);
 
@@ -1012,6 +1101,46 @@ void middle_pgsql_t::connect(table_desc& table) {
     table.sql_conn = sql_conn;
 }
 
+bool middle_pgsql_t::ways_table_is_compact() const
+{
+    PGconn *sql_conn = PQconnectdb(out_options->database_options.conninfo().c_str());
+    if (PQstatus(sql_conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(sql_conn));
+        util::exit_nicely();
+    }
+
+    std::string sql = "SELECT format_type(a.atttypid, NULL) FROM pg_attribute a"
+                      " JOIN pg_class c ON a.attrelid = c.oid"
+                      " WHERE c.relname = '" + out_options->prefix + "_ways'"
+                      " AND a.attname = 'nodes' AND pg_table_is_visible(c.oid)";
+    auto res = pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, sql);
+    bool compact = PQntuples(res.get()) == 1 &&
+                   strcmp(PQgetvalue(res.get(), 0, 0), "bytea") == 0;
+    res.reset();
+    PQfinish(sql_conn);
+
+    return compact;
+}
+
+bool middle_pgsql_t::ways_nodes_index_exists() const
+{
+    PGconn *sql_conn = PQconnectdb(out_options->database_options.conninfo().c_str());
+    if (PQstatus(sql_conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(sql_conn));
+        util::exit_nicely();
+    }
+
+    std::string sql = "SELECT 1 FROM pg_class c"
+                      " WHERE c.relname = '" + out_options->prefix + "_ways_nodes'"
+                      " AND c.relkind = 'i' AND pg_table_is_visible(c.oid)";
+    auto res = pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, sql);
+    bool exists = PQntuples(res.get()) == 1;
+    res.reset();
+    PQfinish(sql_conn);
+
+    return exists;
+}
+
 void middle_pgsql_t::start(const options_t *out_options_)
 {
     out_options = out_options_;
@@ -1020,6 +1149,16 @@ void middle_pgsql_t::start(const options_t *out_options_)
     ways_pending_tracker.reset(new id_tracker());
     rels_pending_tracker.reset(new id_tracker());
 
+    // The way node format is chosen on import, updates have to go with
+    // whatever format the existing ways table has.
+    compact_way_nodes = out_options->append ? ways_table_is_compact()
+                                            : out_options->compact_way_nodes;
+    auto const &format = compact_way_nodes ? compact_way_format : array_way_format;
+    way_table->create = format.ways_create;
+    way_table->prepare = format.ways_prepare;
+    way_table->prepare_intarray = format.ways_prepare_intarray;
+    way_table->array_indexes = format.ways_array_indexes;
+
     // Gazetter doesn't use mark-pending processing and consequently
     // needs no way-node index.
     // TODO Currently, set here to keep the impact on the code small.
@@ -1031,6 +1170,28 @@ void middle_pgsql_t::start(const options_t *out_options_)
         mark_pending = false;
     }
 
+    // The ways using a node can be looked up in a file instead of in a
+    // GIN index, which then is not needed.
+    way_node_index.reset();
+    if (mark_pending && out_options->way_node_index_file) {
+        way_node_index.reset(new way_node_index_t(*out_options->way_node_index_file,
+                                                  out_options->append));
+        way_table->array_indexes = nullptr;
+    }
+
+    // An import with --way-node-index has no index on the node lists.
+    // Updating without the file would look the ways of every changed
+    // node up with a scan of the whole ways table and leave the file
+    // out of date.
+    if (out_options->append && mark_pending && way_table->array_indexes &&
+        !ways_nodes_index_exists()) {
+        fprintf(stderr, "The %s_ways table has no index on its node lists. "
+                        "If the database was imported with --way-node-index, "
+                        "the option has to be given for updates too.\n",
+                out_options->prefix.c_str());
+        util::exit_nicely();
+    }
+
     append = out_options->append;
     // reset this on every start to avoid options from last run
     // staying set for the second.
@@ -1091,11 +1252,20 @@ void middle_pgsql_t::start(const options_t *out_options_)
         if (table.copy) {
             pgsql_exec(sql_conn, PGRES_COPY_IN, "%s", table.copy);
             table.copyMode = 1;
+
+            std::string header;
+            pgsql_binary::put_copy_header(header);
+            pgsql_CopyData(__FUNCTION__, sql_conn, header);
         }
     }
 }
 
 void middle_pgsql_t::commit(void) {
+    propagate_changes();
+    if (way_node_index) {
+        way_node_index->flush();
+    }
+
     for (auto& table: tables) {
         PGconn *sql_conn = table.sql_conn;
         pgsql_endCopy(&table);
@@ -1104,9 +1274,21 @@ void middle_pgsql_t::commit(void) {
             table.transactionMode = 0;
         }
     }
+    // The new way node index only replaces the old one once the ways it
+    // describes are in the database.
+    if (way_node_index) {
+        way_node_index->commit();
+    }
     // Make sure the flat nodes are committed to disk or there will be
     // surprises later.
-    if (out_options->flat_node_cache_enabled) persistent_cache.reset();
+    if (out_options->flat_node_cache_enabled) {
+        persistent_cache.reset();
+#ifdef HAVE_MMAP
+        // Nodes are only read from now on. A read-only mapping of the
+        // file can be shared by all instances from get_instance().
+        persistent_cache.reset(new node_persistent_cache(out_options, true, true, cache));
+#endif
+    }
 }
 
 void middle_pgsql_t::pgsql_stop_one(table_desc *table)
@@ -1135,26 +1317,59 @@ void middle_pgsql_t::pgsql_stop_one(table_desc *table)
 }
 
 
-void middle_pgsql_t::stop(void)
+void middle_pgsql_t::build_array_indexes(const table_desc *table) const
 {
-    cache.reset();
-    if (out_options->flat_node_cache_enabled) persistent_cache.reset();
+    PGconn *sql_conn = PQconnectdb(out_options->database_options.conninfo().c_str());
+    if (PQstatus(sql_conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(sql_conn));
+        util::exit_nicely();
+    }
 
-    std::vector<std::future<void>> futures;
-    futures.reserve(num_tables);
+    fprintf(stderr, "Building index on table: %s\n", table->name);
+    pgsql_exec(sql_conn, PGRES_COMMAND_OK, "%s", table->array_indexes);
+    PQfinish(sql_conn);
+}
 
-    for (int i = 0; i < num_tables; ++i) {
-        futures.push_back(std::async(&middle_pgsql_t::pgsql_stop_one, this, &tables[i]));
+void middle_pgsql_t::add_index_tasks(stop_tasks_t &tasks)
+{
+    if (!build_indexes) {
+        return;
     }
 
-    for (auto &f : futures) {
-        f.get();
+    // Nothing reads the ways and relations through these indexes on
+    // import, so they can be built during pending processing.
+    for (auto &table : tables) {
+        if (table.array_indexes) {
+            const table_desc *t = &table;
+            tasks.emplace_back(std::string(t->name) + " index",
+                               [this, t]() { build_array_indexes(t); });
+        }
     }
+    build_indexes = false;
+}
+
+void middle_pgsql_t::add_stop_tasks(stop_tasks_t &tasks)
+{
+    cache.reset();
+    if (out_options->flat_node_cache_enabled) persistent_cache.reset();
+
+    for (auto &table : tables) {
+        table_desc *t = &table;
+        tasks.emplace_back(t->name, [this, t]() { pgsql_stop_one(t); });
+    }
+}
+
+void middle_pgsql_t::stop(void)
+{
+    stop_tasks_t tasks;
+    add_stop_tasks(tasks);
+    run_stop_tasks(tasks, 0);
 }
 
 middle_pgsql_t::middle_pgsql_t()
     : tables(), num_tables(0), node_table(nullptr), way_table(nullptr), rel_table(nullptr),
-      append(false), mark_pending(true), cache(), persistent_cache(), build_indexes(true)
+      append(false), mark_pending(true), cache(), persistent_cache(), build_indexes(true),
+      compact_way_nodes(false)
 {
     /*table = t_node,*/
     tables.push_back(table_desc(
@@ -1173,7 +1388,7 @@ middle_pgsql_t::middle_pgsql_t()
                "PREPARE get_node_list(" POSTGRES_OSMID_TYPE "[]) AS SELECT id, lat, lon FROM %p_nodes WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
                "PREPARE delete_node (" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_nodes WHERE id = $1;\n",
 /*prepare_intarray*/ nullptr,
-            /*copy*/ "COPY %p_nodes FROM STDIN;\n",
+            /*copy*/ "COPY %p_nodes FROM STDIN WITH (FORMAT binary);\n",
          /*analyze*/ "ANALYZE %p_nodes;\n",
             /*stop*/ "COMMIT;\n"
                          ));
@@ -1181,20 +1396,14 @@ middle_pgsql_t::middle_pgsql_t()
         /*table t_way,*/
             /*name*/ "%p_ways",
            /*start*/ "BEGIN;\n",
-          /*create*/ "CREATE %m TABLE %p_ways (id " POSTGRES_OSMID_TYPE " PRIMARY KEY {USING INDEX TABLESPACE %i}, nodes " POSTGRES_OSMID_TYPE "[] not null, tags text[]) {TABLESPACE %t};\n",
+          /*create*/ array_way_format.ways_create,
     /*create_index*/ nullptr,
-         /*prepare*/ "PREPARE insert_way (" POSTGRES_OSMID_TYPE ", " POSTGRES_OSMID_TYPE "[], text[]) AS INSERT INTO %p_ways VALUES ($1,$2,$3);\n"
-               "PREPARE get_way (" POSTGRES_OSMID_TYPE ") AS SELECT nodes, tags, array_upper(nodes,1) FROM %p_ways WHERE id = $1;\n"
-               "PREPARE get_way_list (" POSTGRES_OSMID_TYPE "[]) AS SELECT id, nodes, tags, array_upper(nodes,1) FROM %p_ways WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
-               "PREPARE delete_way(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_ways WHERE id = $1;\n",
-/*prepare_intarray*/
-               "PREPARE mark_ways_by_node(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE nodes && ARRAY[$1];\n"
-               "PREPARE mark_ways_by_rel(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE id IN (SELECT unnest(parts[way_off+1:rel_off]) FROM %p_rels WHERE id = $1);\n",
-
-            /*copy*/ "COPY %p_ways FROM STDIN;\n",
+         /*prepare*/ array_way_format.ways_prepare,
+/*prepare_intarray*/ array_way_format.ways_prepare_intarray,
+            /*copy*/ "COPY %p_ways FROM STDIN WITH (FORMAT binary);\n",
          /*analyze*/ "ANALYZE %p_ways;\n",
             /*stop*/  "COMMIT;\n",
-   /*array_indexes*/ "CREATE INDEX %p_ways_nodes ON %p_ways USING gin (nodes) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
+   /*array_indexes*/ array_way_format.ways_array_indexes
                          ));
     tables.push_back(table_desc(
         /*table = t_rel,*/
@@ -1203,15 +1412,13 @@ middle_pgsql_t::middle_pgsql_t()
           /*create*/ "CREATE %m TABLE %p_rels(id " POSTGRES_OSMID_TYPE " PRIMARY KEY {USING INDEX TABLESPACE %i}, way_off int2, rel_off int2, parts " POSTGRES_OSMID_TYPE "[], members text[], tags text[]) {TABLESPACE %t};\n",
     /*create_index*/ nullptr,
          /*prepare*/ "PREPARE insert_rel (" POSTGRES_OSMID_TYPE ", int2, int2, " POSTGRES_OSMID_TYPE "[], text[], text[]) AS INSERT INTO %p_rels VALUES ($1,$2,$3,$4,$5,$6);\n"
-               "PREPARE get_rel (" POSTGRES_OSMID_TYPE ") AS SELECT members, tags, array_upper(members,1)/2 FROM %p_rels WHERE id = $1;\n"
+               "PREPARE get_rel (" POSTGRES_OSMID_TYPE ") AS SELECT members, tags FROM %p_rels WHERE id = $1;\n"
                "PREPARE delete_rel(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_rels WHERE id = $1;\n",
 /*prepare_intarray*/
                 "PREPARE rels_using_way(" POSTGRES_OSMID_TYPE ") AS SELECT id FROM %p_rels WHERE parts && ARRAY[$1] AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
-                "PREPARE mark_rels_by_node(" POSTGRES_OSMID_TYPE ") AS select id from %p_ways WHERE nodes && ARRAY[$1];\n"
-                "PREPARE mark_rels_by_way(" POSTGRES_OSMID_TYPE ") AS select id from %p_rels WHERE parts && ARRAY[$1] AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
-                "PREPARE mark_rels(" POSTGRES_OSMID_TYPE ") AS select id from %p_rels WHERE parts && ARRAY[$1] AND parts[rel_off+1:array_length(parts,1)] && ARRAY[$1];\n",
-
-            /*copy*/ "COPY %p_rels FROM STDIN;\n",
+                "PREPARE mark_rels_by_ways(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_rels WHERE parts && $1 AND parts[way_off+1:rel_off] && $1;\n"
+                "PREPARE mark_rels_by_rels(" POSTGRES_OSMID_TYPE "[]) AS select id from %p_rels WHERE parts && $1 AND parts[rel_off+1:array_length(parts,1)] && $1;\n",
+            /*copy*/ "COPY %p_rels FROM STDIN WITH (FORMAT binary);\n",
          /*analyze*/ "ANALYZE %p_rels;\n",
             /*stop*/  "COMMIT;\n",
    /*array_indexes*/ "CREATE INDEX %p_rels_parts ON %p_rels USING gin (parts) WITH (FASTUPDATE=OFF) {TABLESPACE %i};\n"
@@ -1240,14 +1447,19 @@ std::shared_ptr<const middle_query_t> middle_pgsql_t::get_instance() const {
     mid->out_options = out_options;
     mid->append = out_options->append;
     mid->mark_pending = mark_pending;
+    mid->compact_way_nodes = compact_way_nodes;
 
     //NOTE: this is thread safe for use in pending async processing only because
     //during that process they are only read from
     mid->cache = cache;
-    // The persistent cache on the other hand is not thread-safe for reading,
-    // so we create one per instance.
-    if (out_options->flat_node_cache_enabled)
-        mid->persistent_cache.reset(new node_persistent_cache(out_options, 1, true, cache));
+    // The persistent cache on the other hand is only thread-safe for reading
+    // when the file is mapped, otherwise we create one per instance.
+    if (out_options->flat_node_cache_enabled) {
+        if (persistent_cache && persistent_cache->is_mapped())
+            mid->persistent_cache = persistent_cache;
+        else
+            mid->persistent_cache.reset(new node_persistent_cache(out_options, 1, true, cache));
+    }
 
     // We use a connection per table to enable the use of COPY */
     for(int i=0; i<num_tables; i++) {
@@ -13,6 +13,7 @@
 #include "node-ram-cache.hpp"
 #include "node-persistent-cache.hpp"
 #include "id-tracker.hpp"
+#include "way-node-index.hpp"
 #include <memory>
 #include <vector>
 
@@ -40,6 +41,9 @@ struct middle_pgsql_t : public slim_middle_t {
     void way_changed(osmid_t id);
 
     bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const;
+    size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                              multimemberlist_t &members,
+                              multitaglist_t &tags) const;
     void relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags);
     void relations_delete(osmid_t id);
     void relation_changed(osmid_t id);
@@ -49,6 +53,9 @@ struct middle_pgsql_t : public slim_middle_t {
 
     size_t pending_count() const;
 
+    void add_index_tasks(stop_tasks_t &tasks);
+    void add_stop_tasks(stop_tasks_t &tasks);
+
     std::vector<osmid_t> relations_using_way(osmid_t way_id) const;
 
     struct table_desc {
@@ -82,13 +89,38 @@ struct middle_pgsql_t : public slim_middle_t {
     virtual std::shared_ptr<const middle_query_t> get_instance() const;
 private:
     void pgsql_stop_one(table_desc *table);
+    /**
+     * Builds the array indexes of a table on a connection of its own,
+     * while the one of the table may still be in use.
+     */
+    void build_array_indexes(const table_desc *table) const;
 
     /**
      * Sets up sql_conn for the table
      */
     void connect(table_desc& table);
+    /**
+     * Checks if the ways table of an existing import stores the node
+     * lists delta encoded.
+     */
+    bool ways_table_is_compact() const;
+    /**
+     * Checks if the ways table of an existing import has the index used
+     * to find the ways of a node.
+     */
+    bool ways_nodes_index_exists() const;
+    /**
+     * Marks the objects affected by the nodes, ways and relations changed
+     * since the last call as pending.
+     */
+    void propagate_changes();
+    /**
+     * Looks up the locations of all nodes in nds, leaving missing nodes
+     * invalid so that out lines up with nds.
+     */
+    void nodes_get_batch(nodelist_t &out, const idlist_t &nds) const;
     void local_nodes_set(const osmid_t& id, const double& lat, const double& lon, const taglist_t &tags);
-    size_t local_nodes_get_list(nodelist_t &out, const idlist_t nds) const;
+    void local_nodes_get_batch(nodelist_t &out, const idlist_t &nds) const;
     void local_nodes_delete(osmid_t osm_id);
 
     std::vector<table_desc> tables;
@@ -102,8 +134,12 @@ private:
     std::shared_ptr<node_persistent_cache> persistent_cache;
 
     std::shared_ptr<id_tracker> ways_pending_tracker, rels_pending_tracker;
+    std::unique_ptr<way_node_index_t> way_node_index;
+    // changed objects, whose dependents have not been marked yet
+    idlist_t changed_nodes, changed_ways, changed_rels;
 
     bool build_indexes;
+    bool compact_way_nodes;
 };
 
 #endif
@@ -9,9 +9,12 @@
 
 #include <stdexcept>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 
+#include "id-list-codec.hpp"
 #include "id-tracker.hpp"
 #include "middle-ram.hpp"
 #include "node-ram-cache.hpp"
@@ -31,19 +34,93 @@
  *
  */
 
+namespace {
+
+template <typename T>
+void put(char *&p, T value)
+{
+    memcpy(p, &value, sizeof(T));
+    p += sizeof(T);
+}
+
+template <typename T>
+T get(const char *&p)
+{
+    T value;
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+}
+
+} // anonymous namespace
 
 void middle_ram_t::nodes_set(osmid_t id, double lat, double lon, const taglist_t &tags) {
     cache->set(id, lat, lon, tags);
 }
 
+// Ways: number of tags, size of the encoded node list, key and value of
+// every tag, the encoded node list.
 void middle_ram_t::ways_set(osmid_t id, const idlist_t &nds, const taglist_t &tags)
 {
-    ways.set(id, new ramWay(tags, nds));
+    std::string nodes;
+    encode_id_list(nds, nodes);
+
+    size_t const size = 2 * sizeof(uint32_t) * (1 + tags.size()) + nodes.size();
+    uint64_t const pos = way_arena.alloc(size);
+    char *p = way_arena.at(pos);
+    put<uint32_t>(p, tags.size());
+    put<uint32_t>(p, nodes.size());
+    for (auto const &tag : tags) {
+        put<uint32_t>(p, strings.add(tag.key));
+        put<uint32_t>(p, strings.add(tag.value));
+    }
+    memcpy(p, nodes.data(), nodes.size());
+
+    ways.set(id, pos + 1);
 }
 
+// Relations: number of members and tags, size of the encoded member ids,
+// type and role of every member, key and value of every tag, the encoded
+// member ids.
 void middle_ram_t::relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags)
 {
-    rels.set(id, new ramRel(tags, members));
+    idlist_t ids;
+    ids.reserve(members.size());
+    for (auto const &m : members) {
+        ids.push_back(m.id);
+    }
+    std::string encoded;
+    encode_id_list(ids, encoded);
+
+    size_t const size = 3 * sizeof(uint32_t) +
+                        members.size() * (1 + sizeof(uint32_t)) +
+                        tags.size() * 2 * sizeof(uint32_t) + encoded.size();
+    uint64_t const pos = rel_arena.alloc(size);
+    char *p = rel_arena.at(pos);
+    put<uint32_t>(p, members.size());
+    put<uint32_t>(p, tags.size());
+    put<uint32_t>(p, encoded.size());
+    for (auto const &m : members) {
+        put<uint8_t>(p, m.type);
+        put<uint32_t>(p, strings.add(m.role));
+    }
+    for (auto const &tag : tags) {
+        put<uint32_t>(p, strings.add(tag.key));
+        put<uint32_t>(p, strings.add(tag.value));
+    }
+    memcpy(p, encoded.data(), encoded.size());
+
+    rels.set(id, pos + 1);
+}
+
+void middle_ram_t::get_tags(const char *&p, uint32_t count, taglist_t &tags) const
+{
+    tags.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t const key = get<uint32_t>(p);
+        uint32_t const value = get<uint32_t>(p);
+        tags.push_back(tag_t(strings.get(key), strings.get(value)));
+    }
 }
 
 size_t middle_ram_t::nodes_get_list(nodelist_t &out, const idlist_t nds) const
@@ -87,11 +164,13 @@ void middle_ram_t::iterate_ways(middle_t::pending_processor& pf)
 void middle_ram_t::release_relations()
 {
     rels.clear();
+    rel_arena.clear();
 }
 
 void middle_ram_t::release_ways()
 {
     ways.clear();
+    way_arena.clear();
 }
 
 bool middle_ram_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
@@ -100,14 +179,21 @@ bool middle_ram_t::ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) cons
         return false;
     }
 
-    auto const *ele = ways.get(id);
+    uint64_t const pos = ways.get(id);
 
-    if (!ele) {
+    if (!pos) {
         return false;
     }
 
-    tags = ele->tags;
-    nodes_get_list(nodes, ele->ndids);
+    const char *p = way_arena.at(pos - 1);
+    uint32_t const num_tags = get<uint32_t>(p);
+    uint32_t const nodes_size = get<uint32_t>(p);
+    tags.clear();
+    get_tags(p, num_tags, tags);
+
+    idlist_t ndids;
+    decode_id_list(p, nodes_size, ndids);
+    nodes_get_list(nodes, ndids);
 
     return true;
 }
@@ -145,18 +231,58 @@ size_t middle_ram_t::ways_get_list(const idlist_t &ids, idlist_t &way_ids,
 
 bool middle_ram_t::relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
 {
-    auto const *ele = rels.get(id);
+    uint64_t const pos = rels.get(id);
 
-    if (!ele) {
+    if (!pos) {
         return false;
     }
 
-    tags = ele->tags;
-    members = ele->members;
+    const char *p = rel_arena.at(pos - 1);
+    uint32_t const num_members = get<uint32_t>(p);
+    uint32_t const num_tags = get<uint32_t>(p);
+    uint32_t const ids_size = get<uint32_t>(p);
+
+    std::vector<std::pair<OsmType, uint32_t>> types_and_roles;
+    types_and_roles.reserve(num_members);
+    for (uint32_t i = 0; i < num_members; ++i) {
+        OsmType const type = static_cast<OsmType>(get<uint8_t>(p));
+        types_and_roles.emplace_back(type, get<uint32_t>(p));
+    }
+    tags.clear();
+    get_tags(p, num_tags, tags);
+
+    idlist_t ids;
+    decode_id_list(p, ids_size, ids);
+
+    members.clear();
+    members.reserve(num_members);
+    for (uint32_t i = 0; i < num_members; ++i) {
+        members.push_back(member(types_and_roles[i].first, ids[i],
+                                 strings.get(types_and_roles[i].second)));
+    }
 
     return true;
 }
 
+size_t middle_ram_t::relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                                        multimemberlist_t &members,
+                                        multitaglist_t &tags) const
+{
+    size_t count = 0;
+    for (auto const id : ids) {
+        memberlist_t rel_members;
+        taglist_t rel_tags;
+        if (relations_get(id, rel_members, rel_tags)) {
+            rel_ids.push_back(id);
+            members.push_back(std::move(rel_members));
+            tags.push_back(std::move(rel_tags));
+            ++count;
+        }
+    }
+
+    return count;
+}
+
 void middle_ram_t::analyze(void)
 {
     /* No need */
@@ -182,15 +308,21 @@ void middle_ram_t::stop(void)
 {
     cache.reset(nullptr);
 
+    fprintf(stderr, "Mid: ways %zuMB, relations %zuMB, strings %zuMB\n",
+            way_arena.allocated() >> 20, rel_arena.allocated() >> 20,
+            strings.allocated() >> 20);
+
     release_ways();
     release_relations();
+    strings.clear();
 }
 
 void middle_ram_t::commit(void) {
 }
 
 middle_ram_t::middle_ram_t():
-    ways(), rels(), cache(), simulate_ways_deleted(false)
+    ways(), rels(), way_arena(), rel_arena(), strings(), cache(),
+    simulate_ways_deleted(false)
 {
 }
 
@@ -11,9 +11,12 @@
 
 #include <memory>
 
+#include "arena.hpp"
 #include "middle.hpp"
-#include <vector>
+#include "string-table.hpp"
 #include <array>
+#include <cstdint>
+#include <vector>
 
 struct node_ram_cache;
 struct options_t;
@@ -21,13 +24,19 @@ struct options_t;
 template <typename T, size_t N>
 class cache_block_t
 {
-    std::array<std::unique_ptr<T>, N> arr;
+    std::array<T, N> arr;
 public:
-    void set(size_t idx, T *ele) { arr[idx].reset(ele); }
+    cache_block_t() { arr.fill(T()); }
 
-    T const *get(size_t idx) const { return arr[idx].get(); }
+    void set(size_t idx, T ele) { arr[idx] = ele; }
+
+    T get(size_t idx) const { return arr[idx]; }
 };
 
+/**
+ * Values by id, kept in blocks that are allocated on first use. A
+ * default constructed value stands for an id without one.
+ */
 template <typename T, size_t BLOCK_SHIFT>
 class elem_cache_t
 {
@@ -50,7 +59,7 @@ class elem_cache_t
 public:
     elem_cache_t() : arr(num_blocks()) {}
 
-    void set(osmid_t id, T *ele)
+    void set(osmid_t id, T ele)
     {
         const size_t block = id2block(id);
 
@@ -61,12 +70,12 @@ public:
         arr[block]->set(id2offset(id), ele);
     }
 
-    T const *get(osmid_t id) const
+    T get(osmid_t id) const
     {
         const size_t block = id2block(id);
 
         if (!arr[block]) {
-            return 0;
+            return T();
         }
 
         return arr[block]->get(id2offset(id));
@@ -75,7 +84,7 @@ public:
     void clear()
     {
         for (auto &ele : arr) {
-            ele.release();
+            ele.reset();
         }
     }
 };
@@ -104,6 +113,9 @@ struct middle_ram_t : public middle_t {
     int way_changed(osmid_t id);
 
     bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const;
+    size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                              multimemberlist_t &members,
+                              multitaglist_t &tags) const;
     void relations_set(osmid_t id, const memberlist_t &members, const taglist_t &tags);
     int relations_delete(osmid_t id);
     int relation_changed(osmid_t id);
@@ -120,23 +132,19 @@ private:
 
     void release_ways();
     void release_relations();
-
-    struct ramWay {
-        taglist_t tags;
-        idlist_t ndids;
-
-        ramWay(const taglist_t &t, const idlist_t &n) : tags(t), ndids(n) {}
-    };
-
-    struct ramRel {
-        taglist_t tags;
-        memberlist_t members;
-
-        ramRel(const taglist_t &t, const memberlist_t &m) : tags(t), members(m) {}
-    };
-
-    elem_cache_t<ramWay, 10> ways;
-    elem_cache_t<ramRel, 10> rels;
+    void get_tags(const char *&p, uint32_t count, taglist_t &tags) const;
+
+    /*
+     * Ways and relations are stored in arenas, each one as a fixed header
+     * followed by the numbers of their interned strings and their delta
+     * encoded node or member ids. The caches hold the position of each
+     * object plus one, so that 0 means there is none.
+     */
+    elem_cache_t<uint64_t, 10> ways;
+    elem_cache_t<uint64_t, 10> rels;
+    arena_t way_arena;
+    arena_t rel_arena;
+    string_table_t strings;
 
     std::unique_ptr<node_ram_cache> cache;
 
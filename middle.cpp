@@ -1,14 +1,25 @@
 #include "middle.hpp"
+#include "middle-file.hpp"
 #include "middle-pgsql.hpp"
 #include "middle-ram.hpp"
+#include "options.hpp"
 
 #include <memory>
 
-std::shared_ptr<middle_t> middle_t::create_middle(const bool slim)
+std::shared_ptr<middle_t> middle_t::create_middle(const options_t &options)
 {
-     if(slim)
+     if(options.middle_dir)
+         return std::make_shared<middle_file_t>();
+     else if(options.slim)
          return std::make_shared<middle_pgsql_t>();
      else
          return std::make_shared<middle_ram_t>();
 }
 
+
+void middle_t::add_index_tasks(stop_tasks_t &) {}
+
+void middle_t::add_stop_tasks(stop_tasks_t &tasks)
+{
+    tasks.emplace_back("middle", [this]() { stop(); });
+}
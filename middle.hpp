@@ -8,6 +8,7 @@
 #define MIDDLE_H
 
 #include "osmtypes.hpp"
+#include "stop-tasks.hpp"
 
 #include <cstddef>
 #include <memory>
@@ -40,6 +41,15 @@ struct middle_query_t {
      */
     virtual bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const = 0;
 
+    /**
+     * Retrieves several relations at once. The relations found are
+     * appended to rel_ids, members and tags in the order of ids.
+     * \return number of relations retrieved
+     */
+    virtual size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                                      multimemberlist_t &members,
+                                      multitaglist_t &tags) const = 0;
+
     /*
      * Retrieve a list of relations with a particular way as a member
      * \param way_id ID of the way to check
@@ -53,7 +63,7 @@ struct middle_query_t {
  * A specialized middle backend which is persistent, and supports updates
  */
 struct middle_t : public middle_query_t {
-    static std::shared_ptr<middle_t> create_middle(bool slim);
+    static std::shared_ptr<middle_t> create_middle(const options_t &options);
 
     virtual ~middle_t() {}
 
@@ -80,6 +90,16 @@ struct middle_t : public middle_query_t {
 
     virtual size_t pending_count() const = 0;
 
+    /**
+     * Add the work that only needs the data committed, like building the
+     * indexes of the tables. It runs while the pending objects are still
+     * being processed. Anything added here isn't done again by stop().
+     */
+    virtual void add_index_tasks(stop_tasks_t &tasks);
+
+    /// Add the work done by stop(), to be run together with the outputs.
+    virtual void add_stop_tasks(stop_tasks_t &tasks);
+
     const options_t* out_options;
 };
 
@@ -16,6 +16,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "node-persistent-cache.hpp"
 #include "options.hpp"
@@ -185,6 +188,24 @@ void node_persistent_cache::expand_cache(osmid_t block_offset)
 
 void node_persistent_cache::nodes_prefetch_async(osmid_t id)
 {
+#ifdef HAVE_MMAP
+    if (map_base) {
+        if (id < 0 || id > mapped_max_id)
+            return;
+
+        // Ask for the read block around the node, starting at a page boundary
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const char *start = reinterpret_cast<const char *>(
+            mapped_nodes + ((id >> READ_NODE_BLOCK_SHIFT) << READ_NODE_BLOCK_SHIFT));
+        const char *end = std::min(start + READ_NODE_BLOCK_SIZE * sizeof(ramNode),
+                                   static_cast<const char *>(map_base) + map_size);
+        const char *page = static_cast<const char *>(map_base)
+            + ((start - static_cast<const char *>(map_base)) & ~(page_size - 1));
+
+        madvise(const_cast<char *>(page), end - page, MADV_WILLNEED);
+        return;
+    }
+#endif
 #ifdef HAVE_POSIX_FADVISE
     osmid_t block_offset = id >> READ_NODE_BLOCK_SHIFT;
 
@@ -395,6 +416,9 @@ void node_persistent_cache::set(osmid_t id, double lat, double lon)
 
 int node_persistent_cache::get(osmNode *out, osmid_t id)
 {
+    if (map_base)
+        return get_mapped(out, id);
+
     set_read_mode();
 
     osmid_t block_offset = id >> READ_NODE_BLOCK_SHIFT;
@@ -417,31 +441,53 @@ int node_persistent_cache::get(osmNode *out, osmid_t id)
     return 0;
 }
 
-size_t node_persistent_cache::get_list(nodelist_t &out, const idlist_t nds)
+void node_persistent_cache::get_batch(nodelist_t &out, const idlist_t &nds)
 {
     set_read_mode();
 
     out.assign(nds.size(), osmNode());
 
-    bool need_fetch = false;
+    /* Check cache first */
+    std::vector<size_t> missing;
     for (size_t i = 0; i < nds.size(); ++i) {
-        /* Check cache first */
-        if (ram_cache->get(&out[i], nds[i]) != 0) {
-            /* In order to have a higher OS level I/O queue depth
-               issue posix_fadvise(WILLNEED) requests for all I/O */
+        if (ram_cache->get(&out[i], nds[i]) != 0)
+            missing.push_back(i);
+    }
+    if (missing.empty())
+        return;
+
+    /* Resolve the rest in ID order, so that each block is only loaded once
+       even if the IDs come from many ways that share nodes. */
+    std::sort(missing.begin(), missing.end(),
+              [&nds](size_t a, size_t b) { return nds[a] < nds[b]; });
+
+    /* In order to have a higher OS level I/O queue depth
+       issue posix_fadvise(WILLNEED) requests for all I/O */
+    osmid_t prefetched_block = -1;
+    for (size_t i : missing) {
+        if ((nds[i] >> READ_NODE_BLOCK_SHIFT) != prefetched_block) {
+            prefetched_block = nds[i] >> READ_NODE_BLOCK_SHIFT;
             nodes_prefetch_async(nds[i]);
-            need_fetch = true;
         }
     }
-    if (!need_fetch)
-        return out.size();
 
-    size_t wrtidx = 0;
-    for (size_t i = 0; i < nds.size(); i++) {
-        if (std::isnan(out[i].lat) && std::isnan(out[i].lon)) {
-            if (get(&(out[wrtidx]), nds[i]) == 0)
-                wrtidx++;
+    for (size_t i = 0; i < missing.size(); ++i) {
+        const size_t idx = missing[i];
+        if (i > 0 && nds[idx] == nds[missing[i - 1]]) {
+            out[idx] = out[missing[i - 1]];
         } else {
+            get(&out[idx], nds[idx]);
+        }
+    }
+}
+
+size_t node_persistent_cache::get_list(nodelist_t &out, const idlist_t nds)
+{
+    get_batch(out, nds);
+
+    size_t wrtidx = 0;
+    for (size_t i = 0; i < out.size(); i++) {
+        if (!std::isnan(out[i].lat) || !std::isnan(out[i].lon)) {
             if (wrtidx < i)
                 out[wrtidx] = out[i];
             wrtidx++;
@@ -483,10 +529,78 @@ void node_persistent_cache::set_read_mode()
     read_mode = true;
 }
 
+/**
+ * Map the whole file read-only. Lookups then go straight to the page
+ * cache without a private block cache or a read() per block miss.
+ */
+void node_persistent_cache::map_file()
+{
+#ifdef HAVE_MMAP
+    struct stat st;
+    if (fstat(node_cache_fd, &st) != 0) {
+        fprintf(stderr, "Failed to get size of node cache file: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+
+    map_size = st.st_size;
+    map_base = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, node_cache_fd, 0);
+    if (map_base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map node cache file: %s\n",
+                strerror(errno));
+        util::exit_nicely();
+    }
+
+    // Node lookups jump all over the file, so read-ahead would only
+    // waste I/O. Huge pages are only a hint and not supported by all
+    // kernels and file systems, so failure is fine.
+    if (madvise(map_base, map_size, MADV_RANDOM) != 0) {
+        fprintf(stderr, "Info: madvise(MADV_RANDOM) on node cache failed. This might reduce performance\n");
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(map_base, map_size, MADV_HUGEPAGE);
+#endif
+
+    mapped_nodes = reinterpret_cast<const ramNode *>(
+        static_cast<const char *>(map_base) + sizeof(persistentCacheHeader));
+    mapped_max_id = std::min(cacheHeader.max_initialised_id,
+        (osmid_t) ((map_size - sizeof(persistentCacheHeader)) / sizeof(ramNode)) - 1);
+#endif
+}
+
+void node_persistent_cache::unmap_file()
+{
+#ifdef HAVE_MMAP
+    if (munmap(map_base, map_size) != 0) {
+        fprintf(stderr, "Failed to unmap node cache file: %s\n",
+                strerror(errno));
+    }
+    map_base = nullptr;
+    mapped_nodes = nullptr;
+#endif
+}
+
+int node_persistent_cache::get_mapped(osmNode *out, osmid_t id) const
+{
+    if (id < 0 || id > mapped_max_id)
+        return 1;
+
+    const ramNode &node = mapped_nodes[id];
+    if (!node.is_valid())
+        return 1;
+
+    out->lat = node.lat();
+    out->lon = node.lon();
+
+    return 0;
+}
+
 node_persistent_cache::node_persistent_cache(const options_t *options, bool append,
                                              bool ro, std::shared_ptr<node_ram_cache> ptr)
     : node_cache_fd(0), node_cache_fname(nullptr), append_mode(append), cacheHeader(),
-      writeNodeBlock(), readNodeBlockCache(nullptr), read_mode(ro), ram_cache(ptr)
+      writeNodeBlock(), readNodeBlockCache(nullptr), read_mode(ro),
+      map_base(nullptr), map_size(0), mapped_nodes(nullptr), mapped_max_id(-1),
+      ram_cache(ptr)
 {
     if (options->flat_node_file) {
         node_cache_fname = options->flat_node_file->c_str();
@@ -497,12 +611,17 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
     fprintf(stderr, "Mid: loading persistent node cache from %s\n",
             node_cache_fname);
 
-    readNodeBlockCacheIdx.reserve(READ_NODE_CACHE_SIZE);
+#ifdef HAVE_MMAP
+    /* A read-only cache maps the file and never writes to it */
+    const int open_mode = read_mode ? O_RDONLY : O_RDWR;
+#else
+    const int open_mode = O_RDWR;
+#endif
 
     /* Setup the file for the node position cache */
     if (append_mode)
     {
-        node_cache_fd = open(node_cache_fname, O_RDWR, S_IRUSR | S_IWUSR);
+        node_cache_fd = open(node_cache_fname, open_mode, S_IRUSR | S_IWUSR);
         if (node_cache_fd < 0)
         {
             fprintf(stderr, "Failed to open node cache file: %s\n",
@@ -514,7 +633,7 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
     {
         if (read_mode)
         {
-            node_cache_fd = open(node_cache_fname, O_RDWR, S_IRUSR | S_IWUSR);
+            node_cache_fd = open(node_cache_fname, open_mode, S_IRUSR | S_IWUSR);
         }
         else
         {
@@ -606,6 +725,15 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
 
     fprintf(stderr,"Maximum node in persistent node cache: %" PRIdOSMID "\n", cacheHeader.max_initialised_id);
 
+#ifdef HAVE_MMAP
+    if (read_mode) {
+        map_file();
+        return;
+    }
+#endif
+
+    readNodeBlockCacheIdx.reserve(READ_NODE_CACHE_SIZE);
+
     readNodeBlockCache = new ramNodeBlock[READ_NODE_CACHE_SIZE];
     if (!readNodeBlockCache) {
         fprintf(stderr, "Out of memory: Failed to allocate node read cache\n");
@@ -615,8 +743,18 @@ node_persistent_cache::node_persistent_cache(const options_t *options, bool appe
 
 node_persistent_cache::~node_persistent_cache()
 {
-    if (writeNodeBlock.dirty())
-        nodes_set_create_writeout_block();
+    if (map_base) {
+        unmap_file();
+        if (close(node_cache_fd) != 0) {
+            fprintf(stderr, "Failed to close node cache file: %s\n",
+                    strerror(errno));
+        }
+        return;
+    }
+
+    // Write out the last block and make it count as initialised, or
+    // a later read-only instance won't see its nodes.
+    set_read_mode();
 
     writeout_dirty_nodes();
 
@@ -59,6 +59,21 @@ struct node_persistent_cache : public boost::noncopyable
     int get(osmNode *out, osmid_t id);
     size_t get_list(nodelist_t &out, const idlist_t nds);
 
+    /**
+     * Look up the locations of all nodes in nds. Unlike get_list(), nodes
+     * that can't be found are left invalid (NaN), so out lines up with nds.
+     * IDs may repeat and come in any order; they are resolved in sorted
+     * order so every block is read only once.
+     */
+    void get_batch(nodelist_t &out, const idlist_t &nds);
+
+    /**
+     * True if the cache reads straight from a read-only memory mapping of
+     * the file. Lookups then don't change any state and the same instance
+     * can be used from several threads at once.
+     */
+    bool is_mapped() const { return map_base != nullptr; }
+
 private:
 
     void set_append(osmid_t id, double lat, double lon);
@@ -76,6 +91,10 @@ private:
     void add_to_cache_idx(cache_index_entry const &entry);
     void set_read_mode();
 
+    void map_file();
+    void unmap_file();
+    int get_mapped(osmNode *out, osmid_t id) const;
+
     int node_cache_fd;
     const char * node_cache_fname;
     bool append_mode;
@@ -89,6 +108,11 @@ private:
 
     bool read_mode;
 
+    void *map_base;
+    size_t map_size;
+    const ramNode *mapped_nodes;
+    osmid_t mapped_max_id;
+
     std::shared_ptr<node_ram_cache> ram_cache;
 };
 
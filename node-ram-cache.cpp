@@ -5,11 +5,14 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <new>
 #include <stdexcept>
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <boost/format.hpp>
 
@@ -19,39 +22,48 @@
 
 /* Here we use a similar storage structure as middle-ram, except we allow
  * the array to be lossy so we can cap the total memory usage. Hence it is a
- * combination of a sparse array with a priority queue
+ * combination of a sparse array with a CLOCK-style replacement ring.
  *
  * Like middle-ram we have a number of blocks all storing PER_BLOCK
  * ramNodes. However, here we also track the number of nodes in each block.
- * Seperately we have a priority queue like structure when maintains a list
- * of all the used block so we can easily find the block with the least
- * nodes. The cache has two phases:
+ * Seperately all used blocks are kept in a ring (queue), each with a weight
+ * that is set from its number of nodes once the block is complete. Nodes
+ * are only added to the newest block (currentSlot). The cache has two phases:
  *
  * Phase 1: Loading initially, usedBlocks < maxBlocks. In this case when a
  * new block is needed we simply allocate it and put it in
- * queue[usedBlocks-1] which is the bottom of the tree. Every node added
- * increases it's usage. When we move onto the next block we percolate this
- * block up the queue until it reaches its correct position. The invariant
- * is that the priority tree is complete except for this last node. We do
- * not permit adding nodes to any other block to preserve this invariant.
+ * queue[usedBlocks].
  *
- * Phase 2: Once we've reached the maximum number of blocks permitted, we
- * change so that the block currently be inserted into is at the top of the
- * tree. When a new block is needed we take the one at the end of the queue,
- * as it is the one with the least number of nodes in it. When we move onto
- * the next block we first push the just completed block down to it's
- * correct position in the queue and then reuse the block that now at the
- * head.
+ * Phase 2: Once we've reached the maximum number of blocks permitted, a
+ * block has to be replaced. The clock hand sweeps the ring, decrementing
+ * the weight of every block it passes, and the first block found with a
+ * weight of zero is reused. Sparsely filled blocks are therefore replaced
+ * first, densely filled ones survive several sweeps.
  *
- * The result being that at any moment we have in memory the top maxBlock
- * blocks in terms of number of nodes in memory. This should maximize the
- * number of hits in lookups.
+ * This approximates keeping the blocks with the most nodes in memory, which
+ * should maximize the number of hits in lookups.
+ *
+ * Lookups only read the blocks, so any number of threads can call get() at
+ * the same time. set() must not run concurrently with other calls.
  *
  * Complexity:
  *  Insert node: O(1)
  *  Lookup node: O(1)
- *  Add new block: O(log usedBlocks)
- *  Reuse old block: O(log maxBlocks)
+ *  Add new block: O(1)
+ *  Reuse old block: O(1) amortized
+ *
+ * Nodes that don't fill blocks densely enough go to the sparse cache. It
+ * needs nodes in id order and packs them into chunks of SPARSE_CHUNK_SIZE
+ * bytes. A chunk starts with the number of nodes in it, followed by the
+ * varint-encoded id differences to the previous node. The coordinates are
+ * stored backwards from the end of the chunk. The first id of every chunk
+ * is kept in a separate, small index.
+ *
+ * Chunk layout: | count | delta_1 | delta_2 | ... free ... | coord_1 | coord_0 |
+ *
+ * Complexity:
+ *  Insert node: O(1)
+ *  Lookup node: O(log chunks) + O(nodes per chunk)
  */
 
 
@@ -62,6 +74,16 @@
 
 #define SAFETY_MARGIN 1024*PER_BLOCK*sizeof(ramNode)
 
+#define SPARSE_CHUNK_SIZE 512
+
+/* bytes a node takes in the sparse cache: its coordinates, the varint id
+ * difference (one or two bytes within a block) and its share of the chunk
+ * header and chunk id */
+#define SPARSE_NODE_SIZE (sizeof(ramNode) + 2)
+
+/* weight of a completely filled block in the replacement ring */
+#define CLOCK_MAX_WEIGHT 8
+
 #ifdef FIXED_POINT
 int ramNode::scale;
 #endif
@@ -82,24 +104,73 @@ static osmid_t block2id(int32_t block, int offset)
     return (((osmid_t) block - NUM_BLOCKS/2) << BLOCK_SHIFT) + (osmid_t) offset;
 }
 
-#define Swap(a,b) { ramNodeBlock * __tmp = a; a = b; b = __tmp; }
+static uint16_t chunk_count(const char *chunk)
+{
+    uint16_t count;
+    memcpy(&count, chunk, sizeof(count));
+    return count;
+}
 
-void node_ram_cache::percolate_up( int pos )
+static void set_chunk_count(char *chunk, uint16_t count)
 {
-    int i = pos;
-    while( i > 0 )
-    {
-      int parent = (i-1)>>1;
-      if( queue[i]->used() < queue[parent]->used() )
-      {
-        Swap( queue[i], queue[parent] )
-        i = parent;
-      }
-      else
-        break;
+    memcpy(chunk, &count, sizeof(count));
+}
+
+static ramNode *chunk_coord(char *chunk, int pos)
+{
+    return reinterpret_cast<ramNode *>(chunk + SPARSE_CHUNK_SIZE) - (pos + 1);
+}
+
+static size_t encode_varint(unsigned char *out, uint64_t value)
+{
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+static uint64_t decode_varint(const unsigned char *&in)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= uint64_t(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= uint64_t(*in++) << shift;
+    return value;
+}
+
+void node_ram_cache::finish_block(int slot)
+{
+    clockWeight[slot] = queue[slot]->used() * CLOCK_MAX_WEIGHT / PER_BLOCK;
+}
+
+int node_ram_cache::replace_slot()
+{
+    for (;;) {
+        int const slot = clockHand;
+        clockHand = (clockHand + 1) % usedBlocks;
+        if (clockWeight[slot] == 0) {
+            return slot;
+        }
+        --clockWeight[slot];
     }
 }
 
+/* Lookup statistics are kept in several shards, so that threads looking up
+ * nodes at the same time mostly don't write to the same cache line. */
+node_ram_cache::lookup_stats &node_ram_cache::thread_stats()
+{
+    static std::atomic<unsigned> next_shard(0);
+    static thread_local unsigned shard = next_shard++ % LOOKUP_STATS_SHARDS;
+
+    return lookupStats[shard];
+}
+
 ramNode *node_ram_cache::next_chunk() {
     if ( (allocStrategy & ALLOC_DENSE_CHUNK) == 0 ) {
         // allocate starting from the upper end of the block cache
@@ -114,10 +185,29 @@ ramNode *node_ram_cache::next_chunk() {
 
 
 void node_ram_cache::set_sparse(osmid_t id, const ramNode &coord) {
+    char *chunk = sparseChunkIds.empty() ? nullptr
+        : sparseBlock + (sparseChunkIds.size() - 1) * SPARSE_CHUNK_SIZE;
+
+    // A node set again replaces the last location
+    if (sizeSparseTuples && id == maxSparseId) {
+        *chunk_coord(chunk, chunk_count(chunk) - 1) = coord;
+        return;
+    }
+
+    // Start a new chunk if the id difference and coordinate don't fit
+    unsigned char delta[10];
+    size_t delta_len = 0;
+    bool new_chunk = true;
+    if (chunk) {
+        delta_len = encode_varint(delta, id - maxSparseId);
+        new_chunk = sparseChunkPos + delta_len
+                    + (chunk_count(chunk) + 1) * sizeof(ramNode) > SPARSE_CHUNK_SIZE;
+    }
+
     // Sparse cache depends on ordered nodes, reject out-of-order ids.
     // Also check that there is still space.
-    if ((maxSparseId && id < maxSparseId)
-         || (sizeSparseTuples > maxSparseTuples)
+    if ((sizeSparseTuples && id < maxSparseId)
+         || (new_chunk && (int64_t) sparseChunkIds.size() >= maxSparseChunks)
          || ( cacheUsed > cacheSize)) {
         if (allocStrategy & ALLOC_LOSSY) {
             return;
@@ -126,12 +216,24 @@ void node_ram_cache::set_sparse(osmid_t id, const ramNode &coord) {
             util::exit_nicely();
         }
     }
-    maxSparseId = id;
-    sparseBlock[sizeSparseTuples].id = id;
-    sparseBlock[sizeSparseTuples].coord = coord;
 
+    if (new_chunk) {
+        chunk = sparseBlock + sparseChunkIds.size() * SPARSE_CHUNK_SIZE;
+        sparseChunkIds.push_back(id);
+        set_chunk_count(chunk, 0);
+        sparseChunkPos = sizeof(uint16_t);
+        cacheUsed += SPARSE_CHUNK_SIZE + sizeof(osmid_t);
+    } else {
+        memcpy(chunk + sparseChunkPos, delta, delta_len);
+        sparseChunkPos += delta_len;
+    }
+
+    uint16_t const count = chunk_count(chunk);
+    *chunk_coord(chunk, count) = coord;
+    set_chunk_count(chunk, count + 1);
+
+    maxSparseId = id;
     sizeSparseTuples++;
-    cacheUsed += sizeof(ramNodeID);
     storedNodes++;
 }
 
@@ -155,11 +257,9 @@ void node_ram_cache::set_dense(osmid_t id, const ramNode &coord) {
                  * to the sparse node cache and reuse memory of the previous block for the current block */
                 if ( ((allocStrategy & ALLOC_SPARSE) == 0) ||
                      ((queue[usedBlocks - 1]->used() / (double)(1<< BLOCK_SHIFT)) >
-                      (sizeof(ramNode) / (double)sizeof(ramNodeID)))) {
+                      (sizeof(ramNode) / (double)SPARSE_NODE_SIZE))) {
                     /* Block has reached the level to keep it in dense representation */
-                    /* We've just finished with the previous block, so we need to percolate it up the queue to its correct position */
-                    /* Upto log(usedBlocks) iterations */
-                    percolate_up( usedBlocks-1 );
+                    finish_block(currentSlot);
                     blocks[block].nodes = next_chunk();
                 } else {
                     /* previous block was not dense enough, so push it into the sparse node cache instead */
@@ -188,63 +288,36 @@ void node_ram_cache::set_dense(osmid_t id, const ramNode &coord) {
                 util::exit_nicely();
             }
             queue[usedBlocks] = &blocks[block];
+            currentSlot = usedBlocks;
             usedBlocks++;
             cacheUsed += PER_BLOCK * sizeof(ramNode);
-
-            /* If we've just used up the last possible block we enter the
-             * transition and we change the invariant. To do this we percolate
-             * the newly allocated block straight to the head */
-            if (( usedBlocks == maxBlocks ) || ( cacheUsed > cacheSize ))
-                percolate_up( usedBlocks-1 );
         } else {
             if ((allocStrategy & ALLOC_LOSSY) == 0) {
                 fprintf(stderr, "\nNode cache size is too small to fit all nodes. Please increase cache size\n");
                 util::exit_nicely();
             }
-            /* We've reached the maximum number of blocks, so now we push the
-             * current head of the tree down to the right level to restore the
-             * priority queue invariant. Upto log(maxBlocks) iterations */
-
-            int i = 0;
-            while( 2*i+1 < usedBlocks - 1 ) {
-                if( queue[2*i+1]->used() <= queue[2*i+2]->used() ) {
-                    if( queue[i]->used() > queue[2*i+1]->used() ) {
-                        Swap( queue[i], queue[2*i+1] );
-                        i = 2*i+1;
-                    }
-                    else
-                        break;
-                } else {
-                    if( queue[i]->used() > queue[2*i+2]->used() ) {
-                        Swap( queue[i], queue[2*i+2] );
-                        i = 2*i+2;
-                    } else
-                        break;
-                }
-            }
-            /* Now the head of the queue is the smallest, so it becomes our replacement candidate */
-            blocks[block].nodes = queue[0]->nodes;
+            /* We've reached the maximum number of blocks, so the block we
+             * just finished joins the ring and the clock picks a block to reuse */
+            finish_block(currentSlot);
+            int const slot = replace_slot();
+
+            blocks[block].nodes = queue[slot]->nodes;
             blocks[block].reset_used();
             new(blocks[block].nodes) ramNode[PER_BLOCK];
 
-            /* Clear old head block and point to new block */
-            storedNodes -= queue[0]->used();
-            queue[0]->nodes = nullptr;
-            queue[0]->reset_used();
-            queue[0] = &blocks[block];
+            /* Clear old block and point to new block */
+            storedNodes -= queue[slot]->used();
+            queue[slot]->nodes = nullptr;
+            queue[slot]->reset_used();
+            queue[slot] = &blocks[block];
+            currentSlot = slot;
         }
     } else {
         /* Insert into an existing block. We can't allow this in general or it
          * will break the invariant. However, it will work fine if all the
          * nodes come in numerical order, which is the common case */
 
-        int expectedpos;
-        if (( usedBlocks < maxBlocks ) && (cacheUsed < cacheSize))
-            expectedpos = usedBlocks-1;
-        else
-            expectedpos = 0;
-
-        if( queue[expectedpos] != &blocks[block] ) {
+        if( queue[currentSlot] != &blocks[block] ) {
             if (!warn_node_order) {
                 fprintf( stderr, "WARNING: Found Out of order node %" PRIdOSMID " (%d,%d) - this will impact the cache efficiency\n", id, block, offset );
                 warn_node_order++;
@@ -260,25 +333,30 @@ void node_ram_cache::set_dense(osmid_t id, const ramNode &coord) {
 
 
 int node_ram_cache::get_sparse(osmNode *out, osmid_t id) {
-    int64_t pivotPos = sizeSparseTuples >> 1;
-    int64_t minPos = 0;
-    int64_t maxPos = sizeSparseTuples;
-
-    while (minPos <= maxPos) {
-        if ( sparseBlock[pivotPos].id == id ) {
-            out->lat = sparseBlock[pivotPos].coord.lat();
-            out->lon = sparseBlock[pivotPos].coord.lon();
-            return 0;
-        }
-        if ( (pivotPos == minPos) || (pivotPos == maxPos)) return 1;
+    if (!sizeSparseTuples || id < sparseChunkIds.front() || id > maxSparseId)
+        return 1;
 
-        if ( sparseBlock[pivotPos].id > id ) {
-            maxPos = pivotPos;
-            pivotPos = minPos + ((maxPos - minPos) >> 1);
-        } else {
-            minPos = pivotPos;
-            pivotPos = minPos + ((maxPos - minPos) >> 1);
+    // Find the last chunk starting at or before id, then walk its deltas
+    size_t const chunk_idx = std::upper_bound(sparseChunkIds.begin(),
+                                              sparseChunkIds.end(), id)
+                             - sparseChunkIds.begin() - 1;
+    char *chunk = sparseBlock + chunk_idx * SPARSE_CHUNK_SIZE;
+    uint16_t const count = chunk_count(chunk);
+
+    const unsigned char *delta = reinterpret_cast<const unsigned char *>(chunk) + sizeof(uint16_t);
+    osmid_t pos_id = sparseChunkIds[chunk_idx];
+    for (int pos = 0; pos < count; ++pos) {
+        if (pos > 0)
+            pos_id += decode_varint(delta);
+
+        if (pos_id == id) {
+            const ramNode *coord = chunk_coord(chunk, pos);
+            out->lat = coord->lat();
+            out->lon = coord->lon();
+            return 0;
         }
+        if (pos_id > id)
+            break;
     }
 
     return 1;
@@ -303,10 +381,11 @@ int node_ram_cache::get_dense(osmNode *out, osmid_t id) {
 
 node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale )
     : allocStrategy(ALLOC_DENSE), blocks(nullptr), usedBlocks(0),
-      maxBlocks(0), blockCache(nullptr), queue(nullptr), sparseBlock(nullptr),
-      maxSparseTuples(0), sizeSparseTuples(0), maxSparseId(0), cacheUsed(0),
-      cacheSize(0), storedNodes(0), totalNodes(0), nodesCacheHits(0),
-      nodesCacheLookups(0), warn_node_order(0) {
+      maxBlocks(0), blockCache(nullptr), queue(nullptr), clockWeight(nullptr),
+      currentSlot(0), clockHand(0), sparseBlock(nullptr),
+      maxSparseChunks(0), sparseChunkPos(0), sizeSparseTuples(0), maxSparseId(0), cacheUsed(0),
+      cacheSize(0), storedNodes(0), totalNodes(0), lookupStatsBuffer(nullptr),
+      lookupStats(nullptr), warn_node_order(0) {
 #ifdef FIXED_POINT
     ramNode::scale = fixpointscale;
 #endif
@@ -314,9 +393,20 @@ node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale
     blockCachePos = 0;
     cacheUsed = 0;
     cacheSize = (int64_t)cacheSizeMB*(1024*1024);
-    /* How much we can fit, and make sure it's odd */
+    /* How much we can fit */
     maxBlocks = (cacheSize/(PER_BLOCK*sizeof(ramNode)));
-    maxSparseTuples = (cacheSize/sizeof(ramNodeID))+1;
+    maxSparseChunks = (cacheSize/SPARSE_CHUNK_SIZE)+1;
+
+    lookupStatsBuffer = (char *)malloc(LOOKUP_STATS_SHARDS * sizeof(lookup_stats) + alignof(lookup_stats));
+    if (!lookupStatsBuffer) {
+        fprintf(stderr, "Out of memory for node cache statistics\n");
+        util::exit_nicely();
+    }
+    uintptr_t const misalign = (uintptr_t)lookupStatsBuffer % alignof(lookup_stats);
+    lookupStats = (lookup_stats *)(lookupStatsBuffer + (misalign ? alignof(lookup_stats) - misalign : 0));
+    for (int i = 0; i < LOOKUP_STATS_SHARDS; ++i) {
+        new (&lookupStats[i]) lookup_stats();
+    }
 
     allocStrategy = strategy;
 
@@ -328,20 +418,21 @@ node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale
             util::exit_nicely();
         }
         queue = (ramNodeBlock **)calloc( maxBlocks,sizeof(ramNodeBlock *) );
+        clockWeight = (uint8_t *)calloc( maxBlocks, sizeof(uint8_t) );
         /* Use this method of allocation if virtual memory is limited,
          * or if OS allocs physical memory right away, rather than page by page
          * once it is needed.
          */
         if( (allocStrategy & ALLOC_DENSE_CHUNK) > 0 ) {
             fprintf(stderr, "Allocating dense node cache in block sized chunks\n");
-            if (!queue) {
+            if (!queue || !clockWeight) {
                 fprintf(stderr, "Out of memory, reduce --cache size\n");
                 util::exit_nicely();
             }
         } else {
             fprintf(stderr, "Allocating dense node cache in one big chunk\n");
             blockCache = (char *)malloc((maxBlocks + 1024) * PER_BLOCK * sizeof(ramNode));
-            if (!queue || !blockCache) {
+            if (!queue || !clockWeight || !blockCache) {
                 fprintf(stderr, "Out of memory for dense node cache, reduce --cache size\n");
                 util::exit_nicely();
             }
@@ -358,21 +449,28 @@ node_ram_cache::node_ram_cache( int strategy, int cacheSizeMB, int fixpointscale
     if ((allocStrategy & ALLOC_SPARSE) > 0 ) {
         fprintf(stderr, "Allocating memory for sparse node cache\n");
         if (!blockCache) {
-            sparseBlock = (ramNodeID *)malloc(maxSparseTuples * sizeof(ramNodeID));
+            sparseBlock = (char *)malloc(maxSparseChunks * SPARSE_CHUNK_SIZE);
         } else {
             fprintf(stderr, "Sharing dense sparse\n");
-            sparseBlock = (ramNodeID *)blockCache;
+            sparseBlock = blockCache;
         }
         if (!sparseBlock) {
             fprintf(stderr, "Out of memory for sparse node cache, reduce --cache size\n");
             util::exit_nicely();
         }
+        sparseChunkIds.reserve(maxSparseChunks);
     }
 
     fprintf( stderr, "Node-cache: cache=%" PRId64 "MB, maxblocks=%d*%" PRId64 ", allocation method=%i\n", (cacheSize >> 20), maxBlocks, (int64_t) PER_BLOCK*sizeof(ramNode), allocStrategy );
 }
 
 node_ram_cache::~node_ram_cache() {
+  long nodesCacheHits = 0, nodesCacheLookups = 0;
+  for (int i = 0; i < LOOKUP_STATS_SHARDS; ++i) {
+      nodesCacheHits += lookupStats[i].hits;
+      nodesCacheLookups += lookupStats[i].lookups;
+  }
+
   fprintf( stderr, "node cache: stored: %" PRIdOSMID "(%.2f%%), storage efficiency: %.2f%% (dense blocks: %i, sparse nodes: %" PRId64 "), hit rate: %.2f%%\n",
            storedNodes, 100.0f*storedNodes/totalNodes, 100.0f*storedNodes*sizeof(ramNode)/cacheUsed,
            usedBlocks, sizeSparseTuples,
@@ -390,10 +488,12 @@ node_ram_cache::~node_ram_cache() {
       }
       free(blocks);
       free(queue);
+      free(clockWeight);
   }
   if ( ((allocStrategy & ALLOC_SPARSE) > 0) && ((allocStrategy & ALLOC_DENSE) == 0)) {
       free(sparseBlock);
   }
+  free(lookupStatsBuffer);
 }
 
 void node_ram_cache::set(osmid_t id, double lat, double lon, const taglist_t &) {
@@ -418,17 +518,18 @@ void node_ram_cache::set(osmid_t id, double lat, double lon, const taglist_t &)
 }
 
 int node_ram_cache::get(osmNode *out, osmid_t id) {
-    nodesCacheLookups++;
+    lookup_stats &stats = thread_stats();
+    stats.lookups.fetch_add(1, std::memory_order_relaxed);
 
     if ((allocStrategy & ALLOC_DENSE) > 0) {
         if (get_dense(out, id) == 0) {
-            nodesCacheHits++;
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
             return 0;
         }
     }
     if ((allocStrategy & ALLOC_SPARSE) > 0) {
         if (get_sparse(out, id) == 0) {
-            nodesCacheHits++;
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
             return 0;
         }
     }
@@ -10,9 +10,11 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <climits>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -23,6 +25,8 @@
 #define ALLOC_DENSE_CHUNK 4
 #define ALLOC_LOSSY 8
 
+#define LOOKUP_STATS_SHARDS 16
+
 /**
  * A set of coordinates, for caching in RAM or on disk.
  *
@@ -80,11 +84,6 @@ private:
 #endif
 };
 
-struct ramNodeID {
-    osmid_t id;
-    ramNode coord;
-};
-
 class ramNodeBlock {
 public:
     ramNodeBlock() : nodes(nullptr), block_offset(-1), _used(0) {}
@@ -113,7 +112,18 @@ struct node_ram_cache : public boost::noncopyable
     int get(osmNode *out, osmid_t id);
 
 private:
-    void percolate_up( int pos );
+    /* each shard has a cache line of its own, so that threads counting
+     * in different shards do not contend */
+    struct alignas(64) lookup_stats {
+        lookup_stats() : hits(0), lookups(0) {}
+
+        std::atomic<long> hits;
+        std::atomic<long> lookups;
+    };
+
+    void finish_block(int slot);
+    int replace_slot();
+    lookup_stats &thread_stats();
     ramNode *next_chunk();
     void set_sparse(osmid_t id, const ramNode &coord);
     void set_dense(osmid_t id, const ramNode& coord);
@@ -124,21 +134,31 @@ private:
 
     ramNodeBlock *blocks;
     int usedBlocks;
-    /* Note: maxBlocks *must* be odd, to make sure the priority queue has no nodes with only one child */
     int maxBlocks;
     char *blockCache;
     size_t blockCachePos;
 
+    /* Ring of used blocks for replacement, with the weight of each slot */
     ramNodeBlock **queue;
-
-    ramNodeID *sparseBlock;
-    int64_t maxSparseTuples;
+    uint8_t *clockWeight;
+    int currentSlot;
+    int clockHand;
+
+    /* Sparse nodes are stored in fixed-size chunks of delta-encoded ids
+     * and coordinates, with the first id of each chunk in sparseChunkIds */
+    char *sparseBlock;
+    std::vector<osmid_t> sparseChunkIds;
+    int64_t maxSparseChunks;
+    size_t sparseChunkPos;
     int64_t sizeSparseTuples;
     osmid_t maxSparseId;
 
     int64_t cacheUsed, cacheSize;
     osmid_t storedNodes, totalNodes;
-    long nodesCacheHits, nodesCacheLookups;
+    /* operator new does not align the cache to the 64 bytes of the
+     * lookup stats, so they are placed in a buffer of their own */
+    char *lookupStatsBuffer;
+    lookup_stats *lookupStats;
 
     int warn_node_order;
 };
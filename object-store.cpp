@@ -0,0 +1,467 @@
+#include "config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "object-store.hpp"
+
+namespace {
+
+const char segment_magic[8] = { 'o', '2', 'p', 's', 't', 'o', 'r', 'e' };
+const uint32_t segment_format_version = 1;
+
+struct segment_header_t
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t entry_size;
+};
+
+/**
+ * Index entry of an object in a segment. The position is the offset of
+ * its data in the data file shifted left by one, with the lowest bit set
+ * for removed objects. The data of an object ends where the next one's
+ * starts.
+ */
+struct entry_t
+{
+    osmid_t id;
+    uint64_t pos;
+
+    uint64_t offset() const { return pos >> 1; }
+    bool removed() const { return pos & 1; }
+};
+
+std::runtime_error file_error(const char *what, std::string const &filename)
+{
+    return std::runtime_error((boost::format("%1% %2%: %3%\n")
+                               % what % filename % strerror(errno)).str());
+}
+
+#ifdef HAVE_MMAP
+const void *map_file(std::string const &filename, size_t size)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw file_error("Failed to open", filename);
+    }
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        throw file_error("Failed to map", filename);
+    }
+    return base;
+}
+#endif
+
+std::streamoff file_size(std::string const &filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw file_error("Failed to open", filename);
+    }
+    return in.tellg();
+}
+
+void remove_segment_files(std::string const &name)
+{
+    std::remove((name + ".idx").c_str());
+    std::remove((name + ".dat").c_str());
+}
+
+} // anonymous namespace
+
+/**
+ * A segment of the store, opened for reading. The files are memory mapped
+ * where possible, otherwise every access reads from them.
+ */
+class object_store_t::segment_t : public boost::noncopyable
+{
+public:
+    segment_t(const std::string &name, unsigned seq)
+    : m_seq(seq), m_name(name), m_index_filename(name + ".idx"),
+      m_data_filename(name + ".dat"), m_count(0), m_data_size(0),
+      m_index_base(nullptr), m_index_size(0), m_entries(nullptr),
+      m_data(nullptr)
+    {
+        std::ifstream in(m_index_filename, std::ios::binary);
+        segment_header_t header;
+        in.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (!in || memcmp(header.magic, segment_magic, sizeof(header.magic)) != 0 ||
+            header.format_version != segment_format_version ||
+            header.entry_size != sizeof(entry_t)) {
+            throw std::runtime_error((boost::format("File %1% is not a middle segment of this version of osm2pgsql.\n")
+                                      % m_index_filename).str());
+        }
+        in.close();
+
+        m_index_size = file_size(m_index_filename);
+        m_count = (m_index_size - sizeof(header)) / sizeof(entry_t);
+        m_data_size = file_size(m_data_filename);
+
+#ifdef HAVE_MMAP
+        if (m_count > 0) {
+            m_index_base = map_file(m_index_filename, m_index_size);
+            m_entries = reinterpret_cast<const entry_t *>(
+                static_cast<const char *>(m_index_base) + sizeof(header));
+        }
+        if (m_data_size > 0) {
+            m_data = static_cast<const char *>(map_file(m_data_filename, m_data_size));
+        }
+#endif
+    }
+
+    ~segment_t()
+    {
+#ifdef HAVE_MMAP
+        if (m_index_base) {
+            munmap(const_cast<void *>(m_index_base), m_index_size);
+        }
+        if (m_data) {
+            munmap(const_cast<char *>(m_data), m_data_size);
+        }
+#endif
+    }
+
+    unsigned seq() const { return m_seq; }
+    std::string const &name() const { return m_name; }
+    size_t size() const { return m_count; }
+
+    entry_t entry_at(size_t i) const
+    {
+        if (m_entries) {
+            return m_entries[i];
+        }
+
+        std::ifstream in(m_index_filename, std::ios::binary);
+        in.seekg(sizeof(segment_header_t) + i * sizeof(entry_t));
+        entry_t entry;
+        in.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+        if (!in) {
+            throw file_error("Failed to read from", m_index_filename);
+        }
+        return entry;
+    }
+
+    void data_at(size_t i, std::string &data) const
+    {
+        uint64_t const begin = entry_at(i).offset();
+        uint64_t const end = (i + 1 < m_count) ? entry_at(i + 1).offset()
+                                               : m_data_size;
+        if (m_data) {
+            data.assign(m_data + begin, end - begin);
+            return;
+        }
+
+        data.resize(end - begin);
+        if (data.empty()) {
+            return;
+        }
+        std::ifstream in(m_data_filename, std::ios::binary);
+        in.seekg(begin);
+        in.read(&data[0], data.size());
+        if (!in) {
+            throw file_error("Failed to read from", m_data_filename);
+        }
+    }
+
+    /// Position of the object with the given id, size() if there is none.
+    size_t find(osmid_t id) const
+    {
+        size_t first = 0;
+        size_t count = m_count;
+        while (count > 0) {
+            size_t const step = count / 2;
+            if (entry_at(first + step).id < id) {
+                first += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        return (first < m_count && entry_at(first).id == id) ? first : m_count;
+    }
+
+private:
+    unsigned m_seq;
+    std::string m_name;
+    std::string m_index_filename;
+    std::string m_data_filename;
+    size_t m_count;
+    size_t m_data_size;
+
+    const void *m_index_base;
+    size_t m_index_size;
+    const entry_t *m_entries;
+    const char *m_data;
+};
+
+/// Writes a new segment, the objects have to come sorted by id.
+struct object_store_t::writer_t
+{
+    writer_t(const std::string &name, unsigned seq_)
+    : seq(seq_), index_filename(name + ".idx"), data_filename(name + ".dat"),
+      index(index_filename, std::ios::binary | std::ios::trunc),
+      data(data_filename, std::ios::binary | std::ios::trunc), data_size(0)
+    {
+        segment_header_t header;
+        memcpy(header.magic, segment_magic, sizeof(header.magic));
+        header.format_version = segment_format_version;
+        header.entry_size = sizeof(entry_t);
+        index.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!index || !data) {
+            throw file_error("Failed to create", index_filename);
+        }
+    }
+
+    void add(osmid_t id, const std::string *object)
+    {
+        entry_t entry;
+        entry.id = id;
+        entry.pos = (data_size << 1) | (object ? 0 : 1);
+        index.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        if (object) {
+            data.write(object->data(), object->size());
+            data_size += object->size();
+        }
+    }
+
+    void close()
+    {
+        index.close();
+        data.close();
+        if (!index || !data) {
+            throw file_error("Failed to write", index_filename);
+        }
+    }
+
+    unsigned seq;
+    std::string index_filename;
+    std::string data_filename;
+    std::ofstream index;
+    std::ofstream data;
+    uint64_t data_size;
+};
+
+object_store_t::object_store_t(const std::string &basename, bool append)
+: m_basename(basename), m_append(append), m_next_seq(0),
+  m_last_id(std::numeric_limits<osmid_t>::min())
+{
+    std::ifstream list(m_basename + ".segments");
+    if (append && !list) {
+        throw file_error("Failed to open", m_basename + ".segments");
+    }
+
+    unsigned seq;
+    while (list >> seq) {
+        if (append) {
+            add_segment(seq);
+        } else {
+            remove_segment_files(segment_name(seq));
+        }
+        m_next_seq = std::max(m_next_seq, seq + 1);
+    }
+
+    if (!append) {
+        m_next_seq = 0;
+        write_segment_list();
+    }
+}
+
+object_store_t::~object_store_t() = default;
+
+std::string object_store_t::segment_name(unsigned seq) const
+{
+    return m_basename + "." + std::to_string(seq);
+}
+
+void object_store_t::add_segment(unsigned seq)
+{
+    m_segments.emplace_back(new segment_t(segment_name(seq), seq));
+}
+
+void object_store_t::write_segment_list()
+{
+    std::string const filename = m_basename + ".segments";
+    std::string const new_filename = filename + ".new";
+    std::ofstream out(new_filename, std::ios::trunc);
+    for (auto const &segment : m_segments) {
+        out << segment->seq() << '\n';
+    }
+    out.close();
+    if (!out) {
+        throw file_error("Failed to write", new_filename);
+    }
+    if (std::rename(new_filename.c_str(), filename.c_str()) != 0) {
+        throw file_error("Failed to replace", filename);
+    }
+}
+
+void object_store_t::set(osmid_t id, const std::string &data)
+{
+    // Planet files and extracts come sorted, so on import nearly all
+    // objects are simply appended.
+    if (!m_append && id > m_last_id) {
+        if (!m_writer) {
+            unsigned const seq = m_next_seq++;
+            m_writer.reset(new writer_t(segment_name(seq), seq));
+        }
+        m_writer->add(id, &data);
+        m_last_id = id;
+        return;
+    }
+
+    m_changes[id] = data;
+}
+
+void object_store_t::remove(osmid_t id)
+{
+    m_changes[id] = boost::none;
+}
+
+bool object_store_t::get(osmid_t id, std::string &data) const
+{
+    auto const change = m_changes.find(id);
+    if (change != m_changes.end()) {
+        if (!change->second) {
+            return false;
+        }
+        data = *change->second;
+        return true;
+    }
+
+    for (auto it = m_segments.rbegin(); it != m_segments.rend(); ++it) {
+        size_t const i = (*it)->find(id);
+        if (i < (*it)->size()) {
+            if ((*it)->entry_at(i).removed()) {
+                return false;
+            }
+            (*it)->data_at(i, data);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void object_store_t::end_write()
+{
+    if (!m_writer) {
+        return;
+    }
+
+    m_writer->close();
+    add_segment(m_writer->seq);
+    m_writer.reset();
+    write_segment_list();
+}
+
+void object_store_t::write_changes()
+{
+    if (m_changes.empty()) {
+        return;
+    }
+
+    unsigned const seq = m_next_seq++;
+    writer_t writer(segment_name(seq), seq);
+    for (auto const &change : m_changes) {
+        writer.add(change.first, change.second ? &*change.second : nullptr);
+    }
+    writer.close();
+    add_segment(seq);
+    write_segment_list();
+    m_changes.clear();
+}
+
+void object_store_t::flush()
+{
+    end_write();
+    write_changes();
+    if (m_segments.size() > max_segments) {
+        merge_segments();
+    }
+}
+
+void object_store_t::merge_segments()
+{
+    // heads of all segments by id, the newest segment first for the same id
+    typedef std::pair<osmid_t, size_t> head_t;
+    auto const later = [](head_t const &a, head_t const &b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+    std::priority_queue<head_t, std::vector<head_t>, decltype(later)> heads(later);
+    std::vector<size_t> pos(m_segments.size(), 0);
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        if (m_segments[i]->size() > 0) {
+            heads.push(head_t(m_segments[i]->entry_at(0).id, i));
+        }
+    }
+
+    unsigned const seq = m_next_seq++;
+    writer_t writer(segment_name(seq), seq);
+    std::string data;
+    bool first = true;
+    osmid_t last_id = 0;
+    while (!heads.empty()) {
+        head_t const head = heads.top();
+        heads.pop();
+        auto const &segment = m_segments[head.second];
+        size_t const i = pos[head.second]++;
+
+        // older versions of an object are dropped, and so are removed
+        // objects as nothing older is left that they would hide
+        if (first || head.first != last_id) {
+            if (!segment->entry_at(i).removed()) {
+                segment->data_at(i, data);
+                writer.add(head.first, &data);
+            }
+            first = false;
+            last_id = head.first;
+        }
+
+        if (i + 1 < segment->size()) {
+            heads.push(head_t(segment->entry_at(i + 1).id, head.second));
+        }
+    }
+    writer.close();
+
+    std::vector<std::unique_ptr<segment_t>> old_segments;
+    old_segments.swap(m_segments);
+    add_segment(seq);
+    write_segment_list();
+    for (auto const &segment : old_segments) {
+        remove_segment_files(segment->name());
+    }
+}
+
+void object_store_t::destroy()
+{
+    if (m_writer) {
+        m_writer->close();
+        remove_segment_files(segment_name(m_writer->seq));
+        m_writer.reset();
+    }
+    for (auto const &segment : m_segments) {
+        remove_segment_files(segment->name());
+    }
+    m_segments.clear();
+    m_changes.clear();
+    std::remove((m_basename + ".segments").c_str());
+}
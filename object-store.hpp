@@ -0,0 +1,89 @@
+#ifndef OBJECT_STORE_HPP
+#define OBJECT_STORE_HPP
+
+#include "osmtypes.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Store for the encoded data of OSM objects by id, kept in files.
+ *
+ * The objects live in segments, each made of a file of (id, offset) pairs
+ * sorted by id and a file with the data. On import, objects with
+ * ascending ids are appended to a segment as they come. Updates, and
+ * objects that come out of order, are collected in memory and written out
+ * as a new segment. Lookups go through the segments from the newest to the
+ * oldest, and once there are too many of them they are merged into one.
+ *
+ * The list of segments is kept in the file BASENAME.segments, which is
+ * replaced as a whole, so an interrupted run leaves the last state intact.
+ */
+class object_store_t : public boost::noncopyable
+{
+public:
+    /**
+     * Create a new store, removing any existing one with the same
+     * basename, or open the existing one for updates if append is set.
+     */
+    object_store_t(const std::string &basename, bool append);
+    ~object_store_t();
+
+    /// Set the data of an object, replacing what it had before.
+    void set(osmid_t id, const std::string &data);
+
+    /// Remove an object.
+    void remove(osmid_t id);
+
+    /**
+     * Get the data of an object, returns false if there is none. Objects
+     * appended on import are only found after end_write().
+     */
+    bool get(osmid_t id, std::string &data) const;
+
+    /// Finish the segment that is being appended to.
+    void end_write();
+
+    /// Write all changes to the files, merging segments if needed.
+    void flush();
+
+    /// Remove all files of the store.
+    void destroy();
+
+    /// Number of segments in the files.
+    size_t segment_count() const { return m_segments.size(); }
+
+    /// Segments there may be before they are merged.
+    static const size_t max_segments = 8;
+
+private:
+    class segment_t;
+    struct writer_t;
+
+    void write_changes();
+    void merge_segments();
+    void add_segment(unsigned seq);
+    void write_segment_list();
+    std::string segment_name(unsigned seq) const;
+
+    std::string m_basename;
+    bool m_append;
+
+    std::vector<std::unique_ptr<segment_t>> m_segments;
+    unsigned m_next_seq;
+
+    // the segment appended to on import and the last id added to it
+    std::unique_ptr<writer_t> m_writer;
+    osmid_t m_last_id;
+
+    // objects not in a segment yet, none for removed ones
+    std::map<osmid_t, boost::optional<std::string>> m_changes;
+};
+
+#endif // OBJECT_STORE_HPP
@@ -64,6 +64,13 @@ namespace
         {"exclude-invalid-polygon",0,0,210},
         {"tag-transform-script",1,0,212},
         {"reproject-area",0,0,213},
+        {"input-threads", 1, 0, 215},
+        {"pending-batch-size", 1, 0, 216},
+        {"index-processes", 1, 0, 217},
+        {"copy-binary", 0, 0, 218},
+        {"compact-way-nodes", 0, 0, 219},
+        {"way-node-index", 1, 0, 220},
+        {"middle-dir", 1, 0, 221},
         {0, 0, 0, 0}
     };
 
@@ -139,9 +146,18 @@ namespace
                         (no updates are possible).\n\
           --number-processes        Specifies the number of parallel processes \n\
                         used for certain operations (default is 1).\n\
+          --input-threads   Number of threads converting input data while\n\
+                        the main thread writes it to the database. The\n\
+                        default of 0 reads and writes on a single thread.\n\
+          --pending-batch-size  Maximum number of pending ways each process\n\
+                        fetches from the slim tables in one query (default 64).\n\
        -I|--disable-parallel-indexing   Disable indexing all tables concurrently.\n\
+          --index-processes Maximum number of tables that are clustered and\n\
+                        indexed at the same time (default: all tables).\n\
           --unlogged    Use unlogged tables (lost on crash but faster). \n\
                         Requires PostgreSQL 9.1.\n\
+          --copy-binary Send rows to the output tables using the binary COPY\n\
+                        format instead of text.\n\
           --cache-strategy  Specifies the method used to cache nodes in ram.\n\
                         Available options are:\n\
                         dense: caching strategy optimised for full planet import\n\
@@ -165,6 +181,16 @@ namespace
                         information in slim mode instead of in PostgreSQL.\n\
                         This file is a single > 16Gb large file. Only recommended\n\
                         for full planet imports. Default is disabled.\n\
+          --compact-way-nodes   Store the node lists of ways in the slim\n\
+                        tables delta encoded instead of as arrays. Updates\n\
+                        keep the format the tables were created with.\n\
+          --way-node-index  File to keep the index from nodes to the ways\n\
+                        using them in, instead of a GIN index in PostgreSQL.\n\
+                        Has to be given for updates as well.\n\
+          --middle-dir  Existing directory to keep the slim mode data in,\n\
+                        instead of in PostgreSQL. Nodes go to the flat node\n\
+                        file, DIR/PREFIX_nodes.cache unless --flat-nodes is\n\
+                        given. Has to be given for updates as well.\n\
     \n\
     Expiry options:\n\
        -e|--expire-tiles [min_zoom-]max_zoom    Create a tile expiry list.\n\
@@ -267,13 +293,13 @@ options_t::options_t():
     cache(800), tblsmain_index(boost::none), tblsslim_index(boost::none), tblsmain_data(boost::none), tblsslim_data(boost::none), style(OSM2PGSQL_DATADIR "/default.style"),
     expire_tiles_zoom(-1), expire_tiles_zoom_min(-1), expire_tiles_max_bbox(20000.0), expire_tiles_filename("dirty_tiles"),
     hstore_mode(HSTORE_NONE), enable_hstore_index(false),
-    enable_multi(false), hstore_columns(), keep_coastlines(false), parallel_indexing(true),
+    enable_multi(false), hstore_columns(), keep_coastlines(false), parallel_indexing(true), index_processes(0),
     #ifdef __amd64__
     alloc_chunkwise(ALLOC_SPARSE | ALLOC_DENSE),
     #else
     alloc_chunkwise(ALLOC_SPARSE),
     #endif
-    droptemp(false),  unlogged(false), hstore_match_only(false), flat_node_cache_enabled(false), excludepoly(false), reproject_area(false), flat_node_file(boost::none),
+    input_threads(0), pending_batch_size(64), droptemp(false),  unlogged(false), copy_binary(false), compact_way_nodes(false), hstore_match_only(false), flat_node_cache_enabled(false), excludepoly(false), reproject_area(false), flat_node_file(boost::none), way_node_index_file(boost::none), middle_dir(boost::none),
     tag_transform_script(boost::none), tag_transform_node_func(boost::none), tag_transform_way_func(boost::none),
     tag_transform_rel_func(boost::none), tag_transform_rel_mem_func(boost::none),
     create(false), long_usage_bool(false), pass_prompt(false),  output_backend("pgsql"), input_reader("auto"), bbox(boost::none),
@@ -458,6 +484,27 @@ options_t::options_t(int argc, char *argv[]): options_t()
         case 213:
             reproject_area = true;
             break;
+        case 215:
+            input_threads = atoi(optarg);
+            break;
+        case 216:
+            pending_batch_size = atoi(optarg);
+            break;
+        case 217:
+            index_processes = atoi(optarg);
+            break;
+        case 218:
+            copy_binary = true;
+            break;
+        case 219:
+            compact_way_nodes = true;
+            break;
+        case 220:
+            way_node_index_file = optarg;
+            break;
+        case 221:
+            middle_dir = optarg;
+            break;
         case 'V':
             exit (EXIT_SUCCESS);
             break;
@@ -516,6 +563,34 @@ void options_t::check_options()
         throw std::runtime_error("--drop only makes sense with --slim.\n");
     }
 
+    if (compact_way_nodes && !slim) {
+        fprintf(stderr, "Warning: --compact-way-nodes only makes sense with --slim; ignored.\n");
+        compact_way_nodes = false;
+    }
+
+    if (way_node_index_file && (!slim || droptemp)) {
+        fprintf(stderr, "Warning: --way-node-index only makes sense with --slim and without --drop; ignored.\n");
+        way_node_index_file = boost::none;
+    }
+
+    if (middle_dir && !slim) {
+        fprintf(stderr, "Warning: --middle-dir only makes sense with --slim; ignored.\n");
+        middle_dir = boost::none;
+    }
+
+    if (middle_dir) {
+        if (way_node_index_file || compact_way_nodes) {
+            fprintf(stderr, "Warning: --way-node-index and --compact-way-nodes are not used with --middle-dir.\n");
+            way_node_index_file = boost::none;
+            compact_way_nodes = false;
+        }
+        // the file middle keeps node locations in a flat node file only
+        if (!flat_node_cache_enabled) {
+            flat_node_cache_enabled = true;
+            flat_node_file = *middle_dir + "/" + prefix + "_nodes.cache";
+        }
+    }
+
     if (unlogged && !create) {
         fprintf(stderr, "Warning: --unlogged only makes sense with --create; ignored.\n");
         unlogged = false;
@@ -545,6 +620,21 @@ void options_t::check_options()
         fprintf(stderr, "WARNING: Must use at least 1 process.\n\n");
     }
 
+    if (input_threads < 0) {
+        input_threads = 0;
+        fprintf(stderr, "WARNING: Number of input threads cannot be negative. Using 0 instead.\n\n");
+    }
+
+    if (pending_batch_size < 1) {
+        pending_batch_size = 1;
+        fprintf(stderr, "WARNING: Pending batch size must be at least 1.\n\n");
+    }
+
+    if (index_processes < 0) {
+        index_processes = 0;
+        fprintf(stderr, "WARNING: Number of index processes cannot be negative. Not limiting it.\n\n");
+    }
+
     if (sizeof(int*) == 4 && !slim) {
         fprintf(stderr, "\n!! You are running this on 32bit system, so at most\n");
         fprintf(stderr, "!! 3GB of RAM can be used. If you encounter unexpected\n");
@@ -69,15 +69,22 @@ public:
     std::vector<std::string> hstore_columns; ///< list of columns that should be written into their own hstore column
     bool keep_coastlines;
     bool parallel_indexing;
+    int index_processes; ///< maximum number of tables indexed at the same time, 0 for no limit
     int alloc_chunkwise;
     int num_procs;
+    int input_threads; ///< number of threads converting input data, 0 to convert on the main thread
+    int pending_batch_size; ///< maximum number of pending ways fetched from the middle at once
     bool droptemp; ///< drop slim mode temp tables after act
     bool unlogged; ///< use unlogged tables where possible
+    bool copy_binary; ///< use binary COPY for the output tables
+    bool compact_way_nodes; ///< store way node lists delta encoded in the slim tables
     bool hstore_match_only; ///< only copy rows that match an explicitly listed key
     bool flat_node_cache_enabled;
     bool excludepoly;
     bool reproject_area;
     boost::optional<std::string> flat_node_file;
+    boost::optional<std::string> way_node_index_file; ///< file of the node to way index, instead of the GIN index
+    boost::optional<std::string> middle_dir; ///< directory to keep the slim mode data in, instead of the database
     /**
      * these options allow you to control the name of the
      * Lua functions which get called in the tag transform
@@ -54,7 +54,7 @@ int main(int argc, char *argv[])
             return 0;
 
         //setup the middle
-        std::shared_ptr<middle_t> middle = middle_t::create_middle(options.slim);
+        std::shared_ptr<middle_t> middle = middle_t::create_middle(options);
 
         //setup the backend (output)
         std::vector<std::shared_ptr<output_t> > outputs = output_t::create_outputs(middle.get(), options);
@@ -84,7 +84,8 @@ int main(int argc, char *argv[])
 
             parse_osmium_t parser(options.extra_attributes,
                                   options.bbox, options.projection.get(),
-                                  options.append, &osmdata);
+                                  options.append, &osmdata,
+                                  options.input_threads);
             parser.stream_file(filename, options.input_reader);
 
             stats.update(parser.stats());
@@ -1,16 +1,261 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <deque>
 #include <functional>
 #include <future>
 #include <mutex>
 #include <stdexcept>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "middle.hpp"
 #include "node-ram-cache.hpp"
+#include "options.hpp"
 #include "osmdata.hpp"
 #include "output.hpp"
 
+namespace {
+
+/**
+ * Middle wrapper that serialises all queries. The outputs share one
+ * middle and its connections, so only one of them may query it at a
+ * time while they are adding objects concurrently.
+ */
+class locked_middle_t : public middle_query_t {
+public:
+    explicit locked_middle_t(std::shared_ptr<const middle_query_t> mid)
+    : m_mid(mid) {}
+
+    size_t nodes_get_list(nodelist_t &out, const idlist_t nds) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->nodes_get_list(out, nds);
+    }
+
+    bool ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->ways_get(id, tags, nodes);
+    }
+
+    size_t ways_get_list(const idlist_t &ids, idlist_t &way_ids,
+                         multitaglist_t &tags, multinodelist_t &nodes) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->ways_get_list(ids, way_ids, tags, nodes);
+    }
+
+    bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->relations_get(id, members, tags);
+    }
+
+    size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                              multimemberlist_t &members,
+                              multitaglist_t &tags) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->relations_get_list(ids, rel_ids, members, tags);
+    }
+
+    idlist_t relations_using_way(osmid_t way_id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_mid->relations_using_way(way_id);
+    }
+
+    std::shared_ptr<const middle_query_t> get_instance() const
+    {
+        return m_mid->get_instance();
+    }
+
+private:
+    std::shared_ptr<const middle_query_t> m_mid;
+    mutable std::mutex m_mutex;
+};
+
+/// Number of objects handed to the outputs in one go.
+const size_t dispatch_batch_size = 10000;
+
+} // anonymous namespace
+
+/**
+ * Collects newly added objects and hands them to all outputs in batches,
+ * running each output on its own thread. Every output sees the objects
+ * in input order. While the outputs work on one batch the next one is
+ * collected; it is only written to the middle once all outputs are done
+ * with the previous one, so the middle is never written and read at the
+ * same time.
+ */
+class output_dispatcher_t {
+public:
+    output_dispatcher_t(middle_t *mid, const std::vector<std::shared_ptr<output_t> > &outs)
+    : m_mid(mid), m_outs(outs)
+    {
+        m_batch.reserve(dispatch_batch_size);
+        m_processing.reserve(dispatch_batch_size);
+    }
+
+    void node_add(osmid_t id, double lat, double lon, const taglist_t &tags)
+    {
+        object_t &obj = add_object(OSMTYPE_NODE, id);
+        obj.lat = lat;
+        obj.lon = lon;
+        obj.tags = tags;
+        check_batch();
+    }
+
+    void way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags)
+    {
+        object_t &obj = add_object(OSMTYPE_WAY, id);
+        obj.nodes = nodes;
+        obj.tags = tags;
+        check_batch();
+    }
+
+    void relation_add(osmid_t id, const memberlist_t &members, const taglist_t &tags)
+    {
+        object_t &obj = add_object(OSMTYPE_RELATION, id);
+        obj.members = members;
+        obj.tags = tags;
+        check_batch();
+    }
+
+    /// Write out the current batch and wait until all outputs are done.
+    void flush()
+    {
+        dispatch();
+        wait();
+    }
+
+private:
+    struct object_t {
+        object_t(OsmType t, osmid_t i) : type(t), id(i), lat(0), lon(0) {}
+
+        OsmType type;
+        osmid_t id;
+        double lat, lon;
+        taglist_t tags;
+        idlist_t nodes;
+        memberlist_t members;
+    };
+
+    /**
+     * Next free slot of the batch. Slots are reused from batch to batch,
+     * so that the lists in them keep their memory.
+     */
+    object_t &add_object(OsmType type, osmid_t id)
+    {
+        if (m_batch_size == m_batch.size()) {
+            m_batch.emplace_back(type, id);
+        }
+
+        object_t &obj = m_batch[m_batch_size++];
+        obj.type = type;
+        obj.id = id;
+        return obj;
+    }
+
+    void check_batch()
+    {
+        if (m_batch_size >= dispatch_batch_size) {
+            dispatch();
+        }
+    }
+
+    void dispatch()
+    {
+        wait();
+
+        if (m_batch_size == 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < m_batch_size; ++i) {
+            auto const &obj = m_batch[i];
+            switch (obj.type) {
+            case OSMTYPE_NODE:
+                m_mid->nodes_set(obj.id, obj.lat, obj.lon, obj.tags);
+                break;
+            case OSMTYPE_WAY:
+                m_mid->ways_set(obj.id, obj.nodes, obj.tags);
+                break;
+            case OSMTYPE_RELATION:
+                m_mid->relations_set(obj.id, obj.members, obj.tags);
+                break;
+            }
+        }
+
+        m_processing.swap(m_batch);
+        m_processing_size = m_batch_size;
+        m_batch_size = 0;
+
+        for (auto &out : m_outs) {
+            m_workers.push_back(std::async(std::launch::async, add_objects,
+                                           out.get(), std::cref(m_processing),
+                                           m_processing_size));
+        }
+    }
+
+    void wait()
+    {
+        std::exception_ptr error;
+        for (auto &w : m_workers) {
+            try {
+                w.get();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        m_workers.clear();
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    static void add_objects(output_t *out, std::vector<object_t> const &objects,
+                            size_t count)
+    {
+        bool const untagged_nodes = out->needs_untagged_nodes();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto const &obj = objects[i];
+            switch (obj.type) {
+            case OSMTYPE_NODE: {
+                if (obj.tags.empty() && !untagged_nodes) {
+                    break;
+                }
+                // guarantee that we use the same values as in the node cache
+                ramNode n(obj.lon, obj.lat);
+                out->node_add(obj.id, n.lat(), n.lon(), obj.tags);
+                break;
+            }
+            case OSMTYPE_WAY:
+                out->way_add(obj.id, obj.nodes, obj.tags);
+                break;
+            case OSMTYPE_RELATION:
+                out->relation_add(obj.id, obj.members, obj.tags);
+                break;
+            }
+        }
+    }
+
+    middle_t *m_mid;
+    std::vector<std::shared_ptr<output_t> > m_outs;
+
+    // objects in use at the start of each vector, the rest are spare
+    std::vector<object_t> m_batch;
+    size_t m_batch_size = 0;
+    std::vector<object_t> m_processing;
+    size_t m_processing_size = 0;
+    std::vector<std::future<void>> m_workers;
+};
+
 osmdata_t::osmdata_t(std::shared_ptr<middle_t> mid_, const std::shared_ptr<output_t>& out_): mid(mid_)
 {
     outs.push_back(out_);
@@ -23,13 +268,34 @@ osmdata_t::osmdata_t(std::shared_ptr<middle_t> mid_, const std::vector<std::shar
         throw std::runtime_error("Must have at least one output, but none have "
                                  "been configured.");
     }
+
+    // with several outputs, run them concurrently while adding objects
+    if (outs.size() > 1 && outs[0]->get_options()->num_procs > 1) {
+        locked_mid = std::make_shared<locked_middle_t>(mid);
+        for (auto& out: outs) {
+            out->set_middle(locked_mid.get());
+        }
+        dispatcher.reset(new output_dispatcher_t(mid.get(), outs));
+    }
 }
 
 osmdata_t::~osmdata_t()
 {
 }
 
+void osmdata_t::flush_batch()
+{
+    if (dispatcher) {
+        dispatcher->flush();
+    }
+}
+
 int osmdata_t::node_add(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    if (dispatcher) {
+        dispatcher->node_add(id, lat, lon, tags);
+        return 0;
+    }
+
     mid->nodes_set(id, lat, lon, tags);
 
     // guarantee that we use the same values as in the node cache
@@ -37,12 +303,20 @@ int osmdata_t::node_add(osmid_t id, double lat, double lon, const taglist_t &tag
 
     int status = 0;
     for (auto& out: outs) {
+        if (tags.empty() && !out->needs_untagged_nodes()) {
+            continue;
+        }
         status |= out->node_add(id, n.lat(), n.lon(), tags);
     }
     return status;
 }
 
 int osmdata_t::way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags) {
+    if (dispatcher) {
+        dispatcher->way_add(id, nodes, tags);
+        return 0;
+    }
+
     mid->ways_set(id, nodes, tags);
 
     int status = 0;
@@ -53,6 +327,11 @@ int osmdata_t::way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags)
 }
 
 int osmdata_t::relation_add(osmid_t id, const memberlist_t &members, const taglist_t &tags) {
+    if (dispatcher) {
+        dispatcher->relation_add(id, members, tags);
+        return 0;
+    }
+
     mid->relations_set(id, members, tags);
 
     int status = 0;
@@ -63,6 +342,8 @@ int osmdata_t::relation_add(osmid_t id, const memberlist_t &members, const tagli
 }
 
 int osmdata_t::node_modify(osmid_t id, double lat, double lon, const taglist_t &tags) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     slim->nodes_delete(id);
@@ -82,6 +363,8 @@ int osmdata_t::node_modify(osmid_t id, double lat, double lon, const taglist_t &
 }
 
 int osmdata_t::way_modify(osmid_t id, const idlist_t &nodes, const taglist_t &tags) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     slim->ways_delete(id);
@@ -98,6 +381,8 @@ int osmdata_t::way_modify(osmid_t id, const idlist_t &nodes, const taglist_t &ta
 }
 
 int osmdata_t::relation_modify(osmid_t id, const memberlist_t &members, const taglist_t &tags) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     slim->relations_delete(id);
@@ -114,6 +399,8 @@ int osmdata_t::relation_modify(osmid_t id, const memberlist_t &members, const ta
 }
 
 int osmdata_t::node_delete(osmid_t id) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     int status = 0;
@@ -127,6 +414,8 @@ int osmdata_t::node_delete(osmid_t id) {
 }
 
 int osmdata_t::way_delete(osmid_t id) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     int status = 0;
@@ -140,6 +429,8 @@ int osmdata_t::way_delete(osmid_t id) {
 }
 
 int osmdata_t::relation_delete(osmid_t id) {
+    flush_batch();
+
     slim_middle_t *slim = dynamic_cast<slim_middle_t *>(mid.get());
 
     int status = 0;
@@ -161,58 +452,326 @@ void osmdata_t::start() {
 
 namespace {
 
-//TODO: have the main thread using the main middle to query the middle for batches of ways (configurable number)
-//and stuffing those into the work queue, so we have a single producer multi consumer threaded queue
-//since the fetching from middle should be faster than the processing in each backend.
+/**
+ * Work queue for the pending ways and relations.
+ *
+ * The jobs collected from the outputs are cut into chunks of neighbouring
+ * IDs which are dealt out to one deque per thread. A thread works from the
+ * front of its own deque and, once that is empty, steals chunks from the
+ * back of the others. The per-deque locks are only taken once per chunk,
+ * and normally only by their owner, so the threads hardly ever contend.
+ */
+class pending_job_queue_t {
+public:
+    typedef std::vector<pending_job_t> chunk_t;
+
+    pending_job_queue_t(size_t thread_count, size_t max_chunk_size)
+    : m_max_chunk_size(max_chunk_size), m_deques(thread_count) {}
+
+    /// Take all jobs from the queue and distribute them over the threads.
+    void fill(pending_queue_t &queue)
+    {
+        size_t const threads = m_deques.size();
+        // at least a few chunks per thread, so stealing can even out the load
+        size_t const chunk_size =
+            std::max<size_t>(1, std::min(m_max_chunk_size,
+                                         queue.size() / (threads * 8)));
+
+        size_t thread = 0;
+        while (!queue.empty()) {
+            chunk_t chunk;
+            chunk.reserve(chunk_size);
+            while (!queue.empty() && chunk.size() < chunk_size) {
+                chunk.push_back(queue.top());
+                queue.pop();
+            }
+            m_deques[thread].chunks.push_back(std::move(chunk));
+            thread = (thread + 1) % threads;
+        }
+    }
+
+    /**
+     * Get the next chunk of work for the given thread.
+     * Returns false when no work is left anywhere.
+     */
+    bool next_chunk(size_t thread, chunk_t &chunk)
+    {
+        {
+            worker_deque_t &own = m_deques[thread];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.chunks.empty()) {
+                chunk = std::move(own.chunks.front());
+                own.chunks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < m_deques.size(); ++i) {
+            worker_deque_t &victim = m_deques[(thread + i) % m_deques.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.chunks.empty()) {
+                chunk = std::move(victim.chunks.back());
+                victim.chunks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// Drop all outstanding work, so that the threads finish soon.
+    void clear()
+    {
+        for (auto &d : m_deques) {
+            std::lock_guard<std::mutex> lock(d.mutex);
+            d.chunks.clear();
+        }
+    }
+
+private:
+    struct worker_deque_t {
+        std::mutex mutex;
+        std::deque<chunk_t> chunks;
+    };
+
+    size_t m_max_chunk_size;
+    std::vector<worker_deque_t> m_deques;
+};
+
+/**
+ * Middle wrapper used by the pending ways threads. Before a chunk of jobs
+ * is processed, all of its ways are fetched with a single ways_get_list()
+ * call, so that the ways_get() calls of the outputs are answered from
+ * memory instead of costing one round trip to the database each.
+ *
+ * For pending relations the relations of a chunk are fetched in one go
+ * as well, followed by all of their member ways.
+ */
+class prefetching_middle_t : public middle_query_t {
+public:
+    explicit prefetching_middle_t(std::shared_ptr<const middle_query_t> mid)
+    : m_mid(mid) {}
+
+    void prefetch_ways(pending_job_queue_t::chunk_t const &jobs)
+    {
+        clear();
+
+        idlist_t ids;
+        ids.reserve(jobs.size());
+        for (auto const &job : jobs) {
+            // ids of the different outputs for the same way are adjacent
+            if (ids.empty() || ids.back() != job.osm_id) {
+                ids.push_back(job.osm_id);
+            }
+        }
+
+        fetch_ways(ids);
+    }
+
+    void prefetch_relations(pending_job_queue_t::chunk_t const &jobs)
+    {
+        clear();
+
+        idlist_t ids;
+        ids.reserve(jobs.size());
+        for (auto const &job : jobs) {
+            if (ids.empty() || ids.back() != job.osm_id) {
+                ids.push_back(job.osm_id);
+            }
+        }
+
+        m_mid->relations_get_list(ids, m_rel_ids, m_rel_members, m_rel_tags);
+
+        for (auto const id : ids) {
+            m_rel_index.emplace(id, not_found);
+        }
+        idlist_t way_ids;
+        for (size_t i = 0; i < m_rel_ids.size(); ++i) {
+            m_rel_index[m_rel_ids[i]] = i;
+            for (auto const &m : m_rel_members[i]) {
+                if (m.type == OSMTYPE_WAY) {
+                    way_ids.push_back(m.id);
+                }
+            }
+        }
+
+        std::sort(way_ids.begin(), way_ids.end());
+        way_ids.erase(std::unique(way_ids.begin(), way_ids.end()), way_ids.end());
+        fetch_ways(way_ids);
+    }
+
+    void clear()
+    {
+        m_index.clear();
+        m_way_ids.clear();
+        m_tags.clear();
+        m_nodes.clear();
+        m_rel_index.clear();
+        m_rel_ids.clear();
+        m_rel_members.clear();
+        m_rel_tags.clear();
+    }
+
+    size_t nodes_get_list(nodelist_t &out, const idlist_t nds) const
+    {
+        return m_mid->nodes_get_list(out, nds);
+    }
+
+    bool ways_get(osmid_t id, taglist_t &tags, nodelist_t &nodes) const
+    {
+        auto const it = m_index.find(id);
+        if (it == m_index.end()) {
+            return m_mid->ways_get(id, tags, nodes);
+        }
+        if (it->second == not_found) {
+            return false;
+        }
+
+        tags = m_tags[it->second];
+        nodes = m_nodes[it->second];
+        return true;
+    }
+
+    size_t ways_get_list(const idlist_t &ids, idlist_t &way_ids,
+                         multitaglist_t &tags, multinodelist_t &nodes) const
+    {
+        for (auto const id : ids) {
+            if (m_index.find(id) == m_index.end()) {
+                return m_mid->ways_get_list(ids, way_ids, tags, nodes);
+            }
+        }
+
+        size_t count = 0;
+        for (auto const id : ids) {
+            auto const i = m_index.find(id)->second;
+            if (i != not_found) {
+                way_ids.push_back(id);
+                tags.push_back(m_tags[i]);
+                nodes.push_back(m_nodes[i]);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    bool relations_get(osmid_t id, memberlist_t &members, taglist_t &tags) const
+    {
+        auto const it = m_rel_index.find(id);
+        if (it == m_rel_index.end()) {
+            return m_mid->relations_get(id, members, tags);
+        }
+        if (it->second == not_found) {
+            return false;
+        }
+
+        members = m_rel_members[it->second];
+        tags = m_rel_tags[it->second];
+        return true;
+    }
+
+    size_t relations_get_list(const idlist_t &ids, idlist_t &rel_ids,
+                              multimemberlist_t &members,
+                              multitaglist_t &tags) const
+    {
+        return m_mid->relations_get_list(ids, rel_ids, members, tags);
+    }
+
+    idlist_t relations_using_way(osmid_t way_id) const
+    {
+        return m_mid->relations_using_way(way_id);
+    }
+
+    std::shared_ptr<const middle_query_t> get_instance() const
+    {
+        return m_mid->get_instance();
+    }
+
+private:
+    static constexpr size_t not_found = ~size_t(0);
+
+    void fetch_ways(idlist_t const &ids)
+    {
+        m_mid->ways_get_list(ids, m_way_ids, m_tags, m_nodes);
+
+        // ways that were asked for but not returned do not exist
+        for (auto const id : ids) {
+            m_index.emplace(id, not_found);
+        }
+        for (size_t i = 0; i < m_way_ids.size(); ++i) {
+            m_index[m_way_ids[i]] = i;
+        }
+    }
+
+    std::shared_ptr<const middle_query_t> m_mid;
+    std::unordered_map<osmid_t, size_t> m_index;
+    idlist_t m_way_ids;
+    multitaglist_t m_tags;
+    multinodelist_t m_nodes;
+
+    std::unordered_map<osmid_t, size_t> m_rel_index;
+    idlist_t m_rel_ids;
+    multimemberlist_t m_rel_members;
+    multitaglist_t m_rel_tags;
+};
+
+constexpr size_t prefetching_middle_t::not_found;
 
 struct pending_threaded_processor : public middle_t::pending_processor {
     typedef std::vector<std::shared_ptr<output_t>> output_vec_t;
     typedef std::pair<std::shared_ptr<const middle_query_t>, output_vec_t> clone_t;
 
-    static void do_jobs(output_vec_t const& outputs, pending_queue_t& queue, size_t& ids_done, std::mutex& mutex, int append, bool ways) {
+    static void do_jobs(output_vec_t const& outputs, prefetching_middle_t *prefetch, pending_job_queue_t& queue, size_t thread, std::atomic<size_t>& ids_done, int append, bool ways) {
 #ifdef _MSC_VER
 	// Avoid problems when GEOS WKT-related methods switch the locale
         _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
 #endif
-        while (true) {
-            //get the job off the queue synchronously
-            pending_job_t job;
-            mutex.lock();
-            if(queue.empty()) {
-                mutex.unlock();
-                break;
+        pending_job_queue_t::chunk_t chunk;
+        while (queue.next_chunk(thread, chunk)) {
+            if (prefetch) {
+                if (ways) {
+                    prefetch->prefetch_ways(chunk);
+                } else {
+                    prefetch->prefetch_relations(chunk);
+                }
             }
-            else {
-                job = queue.top();
-                queue.pop();
+
+            for (auto const &job : chunk) {
+                if(ways)
+                    outputs.at(job.output_id)->pending_way(job.osm_id, append);
+                else
+                    outputs.at(job.output_id)->pending_relation(job.osm_id, append);
             }
-            mutex.unlock();
 
-            //process it
-            if(ways)
-                outputs.at(job.output_id)->pending_way(job.osm_id, append);
-            else
-                outputs.at(job.output_id)->pending_relation(job.osm_id, append);
+            ids_done += chunk.size();
+        }
 
-            mutex.lock();
-            ++ids_done;
-            mutex.unlock();
+        if (prefetch) {
+            prefetch->clear();
         }
     }
 
     //starts up count threads and works on the queue
-    pending_threaded_processor(std::shared_ptr<middle_query_t> mid, const output_vec_t& outs, size_t thread_count, size_t job_count, int append)
+    pending_threaded_processor(std::shared_ptr<middle_query_t> mid, const output_vec_t& outs, size_t thread_count, int append, size_t batch_size, bool prefetch)
         //note that we cant hint to the stack how large it should be ahead of time
         //we could use a different datastructure like a deque or vector but then
         //the outputs the enqueue jobs would need the version check for the push(_back) method
-        : outs(outs), ids_queued(0), append(append), queue(), ids_done(0) {
+        : outs(outs), ids_queued(0), append(append), queue(), work(thread_count, batch_size), ids_done(0) {
 
         //clone all the things we need
         clones.reserve(thread_count);
+        prefetchers.reserve(thread_count);
         for (size_t i = 0; i < thread_count; ++i) {
             //clone the middle
             std::shared_ptr<const middle_query_t> mid_clone = mid->get_instance();
 
+            //fetch pending objects in batches, where a lookup is expensive
+            std::shared_ptr<prefetching_middle_t> prefetcher;
+            if (prefetch) {
+                prefetcher = std::make_shared<prefetching_middle_t>(mid_clone);
+                mid_clone = prefetcher;
+            }
+            prefetchers.push_back(prefetcher);
+
             //clone the outs
             output_vec_t out_clones;
             for (const auto& out: outs) {
@@ -234,39 +793,12 @@ struct pending_threaded_processor : public middle_t::pending_processor {
 
     //waits for the completion of all outstanding jobs
     void process_ways() {
-        //reset the number we've done
-        ids_done = 0;
-
         fprintf(stderr, "\nGoing over pending ways...\n");
         fprintf(stderr, "\t%zu ways are pending\n", ids_queued);
         fprintf(stderr, "\nUsing %zu helper-processes\n", clones.size());
         time_t start = time(nullptr);
 
-
-        //make the threads and start them
-        std::vector<std::future<void>> workers;
-        for (size_t i = 0; i < clones.size(); ++i) {
-            workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
-                                         std::ref(mutex), append, true));
-        }
-
-        //TODO: print out partial progress
-
-        for (auto& w: workers) {
-            try {
-                w.get();
-            } catch (...) {
-                // drain the queue, so that the other workers finish
-                mutex.lock();
-                while (!queue.empty()) {
-                    queue.pop();
-                }
-                mutex.unlock();
-                throw;
-            }
-        }
+        run_jobs(true);
 
         time_t finish = time(nullptr);
         fprintf(stderr, "\rFinished processing %zu ways in %i s\n\n", ids_queued, (int)(finish - start));
@@ -297,36 +829,12 @@ struct pending_threaded_processor : public middle_t::pending_processor {
     }
 
     void process_relations() {
-        //reset the number we've done
-        ids_done = 0;
-
         fprintf(stderr, "\nGoing over pending relations...\n");
         fprintf(stderr, "\t%zu relations are pending\n", ids_queued);
         fprintf(stderr, "\nUsing %zu helper-processes\n", clones.size());
         time_t start = time(nullptr);
 
-        //make the threads and start them
-        std::vector<std::future<void>> workers;
-        for (size_t i = 0; i < clones.size(); ++i) {
-            workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
-                                         std::ref(mutex), append, false));
-        }
-
-        for (auto& w: workers) {
-            try {
-                w.get();
-            } catch (...) {
-                // drain the queue, so the other worker finish immediately
-                mutex.lock();
-                while (!queue.empty()) {
-                    queue.pop();
-                }
-                mutex.unlock();
-                throw;
-            }
-        }
+        run_jobs(false);
 
         time_t finish = time(nullptr);
         fprintf(stderr, "\rFinished processing %zu relations in %i s\n\n", ids_queued, (int)(finish - start));
@@ -350,20 +858,53 @@ struct pending_threaded_processor : public middle_t::pending_processor {
     }
 
 private:
+    //hands the queued jobs to the threads and waits until all are done
+    void run_jobs(bool ways) {
+        //reset the number we've done
+        ids_done = 0;
+
+        work.fill(queue);
+
+        //make the threads and start them
+        std::vector<std::future<void>> workers;
+        for (size_t i = 0; i < clones.size(); ++i) {
+            workers.push_back(std::async(std::launch::async,
+                                         do_jobs, std::cref(clones[i].second),
+                                         prefetchers[i].get(),
+                                         std::ref(work), i, std::ref(ids_done),
+                                         append, ways));
+        }
+
+        for (auto& w: workers) {
+            while (w.wait_for(std::chrono::seconds(1)) == std::future_status::timeout) {
+                fprintf(stderr, "\rLeft to process: %zu...", ids_queued - ids_done);
+            }
+            try {
+                w.get();
+            } catch (...) {
+                // drop the remaining work, so that the other workers finish
+                work.clear();
+                throw;
+            }
+        }
+    }
+
     //middle and output copies
     std::vector<clone_t> clones;
+    //batch fetching of ways and relations for each thread, if used
+    std::vector<std::shared_ptr<prefetching_middle_t>> prefetchers;
     output_vec_t outs; //would like to move ownership of outs to osmdata_t and middle passed to output_t instead of owned by it
     //how many jobs do we have in the queue to start with
     size_t ids_queued;
     //appending to output that is already there (diff processing)
     bool append;
-    //job queue
+    //jobs as collected from the outputs
     pending_queue_t queue;
+    //jobs as dealt out to the threads
+    pending_job_queue_t work;
 
     //how many ids within the job have been processed
-    size_t ids_done;
-    //so the threads can manage some of the shared state
-    std::mutex mutex;
+    std::atomic<size_t> ids_done;
 };
 
 } // anonymous namespace
@@ -373,19 +914,46 @@ void osmdata_t::stop() {
      * access the data simultanious to process the rest in parallel
      * as well as see the newly created tables.
      */
-    size_t pending_count = mid->pending_count();
+    flush_batch();
+
+    // Objects are not added concurrently anymore, so the outputs go back
+    // to the plain middle.
+    if (dispatcher) {
+        dispatcher.reset();
+        for (auto& out: outs) {
+            out->set_middle(mid.get());
+        }
+        locked_mid.reset();
+    }
+
     mid->commit();
     for (auto& out: outs) {
         //TODO: each of the outs can be in parallel
         out->commit();
-        pending_count += out->pending_count();
     }
 
     // should be the same for all outputs
     const bool append = outs[0]->get_options()->append;
 
     //threaded pending processing
-    pending_threaded_processor ptp(mid, outs, outs[0]->get_options()->num_procs, pending_count, append);
+    const options_t *opts = outs[0]->get_options();
+    pending_threaded_processor ptp(mid, outs, opts->num_procs, append,
+                                   opts->pending_batch_size, opts->slim);
+
+    // Clustering, index creation, and cleanup.
+    // All the intensive parts of this are long-running PostgreSQL commands,
+    // each table is handled on its own connection. Each task is started as
+    // soon as everything it needs is done.
+    stop_task_runner_t runner(opts->parallel_indexing ? opts->index_processes : 1);
+
+    // The indexes of the middle tables can be built while the pending
+    // objects are processed, unless the indexing has to be done one
+    // table after another.
+    if (opts->parallel_indexing) {
+        stop_tasks_t index_tasks;
+        mid->add_index_tasks(index_tasks);
+        runner.add(index_tasks);
+    }
 
     if (!outs.empty()) {
         //This stage takes ways which were processed earlier, but might be
@@ -399,19 +967,12 @@ void osmdata_t::stop() {
         mid->iterate_relations( ptp );
     }
 
-    // Clustering, index creation, and cleanup.
-    // All the intensive parts of this are long-running PostgreSQL commands
-
-    std::vector<std::future<void>> futures;
-
-    // XXX we might get too many parallel processes here
-    //     use osmium worker pool instead
+    stop_tasks_t tasks;
     for (auto& out: outs) {
-        futures.push_back(std::async(&output_t::stop, out.get()));
+        out->add_stop_tasks(tasks);
     }
-    futures.push_back(std::async(&middle_t::stop, mid.get()));
+    mid->add_stop_tasks(tasks);
+    runner.add(tasks);
 
-    for (auto& f: futures) {
-      f.get();
-    }
+    runner.finish();
 }
@@ -11,7 +11,9 @@
 #include "osmtypes.hpp"
 
 class output_t;
+class output_dispatcher_t;
 struct middle_t;
+struct middle_query_t;
 
 class osmdata_t {
 public:
@@ -35,8 +37,15 @@ public:
     int relation_delete(osmid_t id);
 
 private:
+    /// Hand all batched objects to the middle and outputs and wait for them.
+    void flush_batch();
+
     std::shared_ptr<middle_t> mid;
     std::vector<std::shared_ptr<output_t> > outs;
+
+    /// Middle handed to the outputs while they add objects concurrently.
+    std::shared_ptr<middle_query_t> locked_mid;
+    std::unique_ptr<output_dispatcher_t> dispatcher;
 };
 
 #endif
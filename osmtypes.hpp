@@ -41,6 +41,7 @@ struct member {
 };
 
 typedef std::vector<member> memberlist_t;
+typedef std::vector<memberlist_t> multimemberlist_t;
 
 struct tag_t {
   std::string key;
@@ -170,6 +170,8 @@ public:
     void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) {}
     int pending_relation(osmid_t id, int exists) { return 0; }
 
+    bool needs_untagged_nodes() const { return false; }
+
     int node_add(osmid_t id, double lat, double lon, const taglist_t &tags)
     {
         return process_node(id, lat, lon, tags);
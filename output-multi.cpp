@@ -26,7 +26,8 @@ output_multi_t::output_multi_t(const std::string &name,
                           m_options.hstore_columns, m_processor->srid(),
                           m_options.append, m_options.slim, m_options.droptemp,
                           m_options.hstore_mode, m_options.enable_hstore_index,
-                          m_options.tblsmain_data, m_options.tblsmain_index)),
+                          m_options.tblsmain_data, m_options.tblsmain_index,
+                          m_options.copy_binary)),
       ways_done_tracker(new id_tracker()),
       m_expire(m_options.expire_tiles_zoom, m_options.expire_tiles_max_bbox,
                m_options.projection)
@@ -166,10 +167,21 @@ int output_multi_t::pending_relation(osmid_t id, int exists) {
 
 void output_multi_t::stop()
 {
-    m_table->stop();
+    stop_tasks_t tasks;
+    add_stop_tasks(tasks);
+    run_stop_tasks(tasks, 1);
+}
+
+void output_multi_t::add_stop_tasks(stop_tasks_t &tasks)
+{
+    table_t *table = m_table.get();
+    tasks.emplace_back(m_table->get_name(), [table]() { table->stop(); });
+
     if (m_options.expire_tiles_zoom_min >= 0) {
-        m_expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
-                                    m_options.expire_tiles_zoom_min);
+        tasks.emplace_back(m_table->get_name() + " tile expiry list", [this]() {
+            m_expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
+                                        m_options.expire_tiles_zoom_min);
+        });
     }
 }
 
@@ -177,6 +189,11 @@ void output_multi_t::commit() {
     m_table->commit();
 }
 
+bool output_multi_t::needs_untagged_nodes() const {
+    return m_processor->interests(geometry_processor::interest_node) &&
+           !m_tagtransform->filters_untagged();
+}
+
 int output_multi_t::node_add(osmid_t id, double lat, double lon, const taglist_t &tags) {
     if (m_processor->interests(geometry_processor::interest_node)) {
         return process_node(id, lat, lon, tags);
@@ -348,7 +365,7 @@ int output_multi_t::process_relation(osmid_t id, const memberlist_t &members,
     if (!filter) {
         //TODO: move this into geometry processor, figure a way to come back for tag transform
         //grab ways/nodes of the members in the relation, bail if none were used
-        if(m_relation_helper.set(&members, (middle_t*)m_mid) < 1)
+        if(m_relation_helper.set(&members, m_mid) < 1)
             return 0;
 
         //filter the tags on each member because we got them from the middle
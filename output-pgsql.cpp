@@ -6,7 +6,6 @@
  * emit the final geometry-enabled output formats
 */
 
-#include <future>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -331,33 +330,30 @@ void output_pgsql_t::commit()
 
 void output_pgsql_t::stop()
 {
-    if (m_options.parallel_indexing) {
-      std::vector<std::future<void>> outs;
-      outs.reserve(m_tables.size());
-
-      for (auto &t : m_tables) {
-          outs.push_back(std::async(std::launch::async, &table_t::stop, t));
-      }
-
-      // XXX If one of the stop functions throws an error, this collects all
-      //     the other threads first before exiting. That might take a very
-      //     long time if large indexes are created.
-      for (auto &f : outs) {
-        f.get();
-      }
+    stop_tasks_t tasks;
+    add_stop_tasks(tasks);
+    run_stop_tasks(tasks, m_options.parallel_indexing ? 0 : 1);
+}
 
-    } else {
-      for (const auto &t : m_tables) {
-        t->stop();
-      }
+void output_pgsql_t::add_stop_tasks(stop_tasks_t &tasks)
+{
+    for (auto &t : m_tables) {
+        tasks.emplace_back(t->get_name(), [t]() { t->stop(); });
     }
 
     if (m_options.expire_tiles_zoom_min >= 0) {
-        expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
-                                  m_options.expire_tiles_zoom_min);
+        tasks.emplace_back("tile expiry list", [this]() {
+            expire.output_and_destroy(m_options.expire_tiles_filename.c_str(),
+                                      m_options.expire_tiles_zoom_min);
+        });
     }
 }
 
+bool output_pgsql_t::needs_untagged_nodes() const
+{
+    return !m_tagtransform->filters_untagged();
+}
+
 int output_pgsql_t::node_add(osmid_t id, double lat, double lon, const taglist_t &tags)
 {
   pgsql_out_node(id, tags, lat, lon);
@@ -650,7 +646,8 @@ output_pgsql_t::output_pgsql_t(const middle_query_t* mid, const options_t &o)
                 m_options.database_options.conninfo(), name, type, columns, m_options.hstore_columns,
                 reproj->target_srs(),
                 m_options.append, m_options.slim, m_options.droptemp, m_options.hstore_mode,
-                m_options.enable_hstore_index, m_options.tblsmain_data, m_options.tblsmain_index
+                m_options.enable_hstore_index, m_options.tblsmain_data, m_options.tblsmain_index,
+                m_options.copy_binary
             )
         ));
     }
@@ -31,6 +31,7 @@ public:
 
     int start();
     void stop();
+    void add_stop_tasks(stop_tasks_t &tasks);
     void commit();
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
@@ -39,6 +40,8 @@ public:
     void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added);
     int pending_relation(osmid_t id, int exists);
 
+    bool needs_untagged_nodes() const;
+
     int node_add(osmid_t id, double lat, double lon, const taglist_t &tags);
     int way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags);
     int relation_add(osmid_t id, const memberlist_t &members, const taglist_t &tags);
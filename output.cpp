@@ -146,6 +146,16 @@ const options_t *output_t::get_options() const
     return &m_options;
 }
 
+void output_t::add_stop_tasks(stop_tasks_t &tasks)
+{
+    tasks.emplace_back(m_options.output_backend + " output", [this]() { stop(); });
+}
+
+void output_t::set_middle(const middle_query_t *mid)
+{
+    m_mid = mid;
+}
+
 void output_t::merge_pending_relations(output_t*) {}
 
 void output_t::merge_expire_trees(output_t*) {}
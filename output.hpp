@@ -15,6 +15,7 @@
 #include <boost/noncopyable.hpp>
 
 #include "options.hpp"
+#include "stop-tasks.hpp"
 
 struct expire_tiles;
 struct id_tracker;
@@ -43,12 +44,26 @@ public:
     virtual void stop() = 0;
     virtual void commit() = 0;
 
+    /**
+     * Add the work done by stop() to the task list, split into tasks
+     * that can run in parallel. Running all of them has the same effect
+     * as calling stop(). By default stop() is added as a single task.
+     */
+    virtual void add_stop_tasks(stop_tasks_t &tasks);
+
     virtual void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) = 0;
     virtual int pending_way(osmid_t id, int exists) = 0;
 
     virtual void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) = 0;
     virtual int pending_relation(osmid_t id, int exists) = 0;
 
+    /**
+     * Whether node_add() needs to be called for nodes without tags.
+     * Outputs that would drop them anyway return false, so that the bulk
+     * of the nodes of an import is not handed to them at all.
+     */
+    virtual bool needs_untagged_nodes() const { return true; }
+
     virtual int node_add(osmid_t id, double lat, double lon, const taglist_t &tags) = 0;
     virtual int way_add(osmid_t id, const idlist_t &nodes, const taglist_t &tags) = 0;
     virtual int relation_add(osmid_t id, const memberlist_t &members, const taglist_t &tags) = 0;
@@ -65,6 +80,12 @@ public:
 
     const options_t *get_options() const;
 
+    /**
+     * Replace the middle used for queries while adding objects. The new
+     * middle must outlive all further calls on this output.
+     */
+    void set_middle(const middle_query_t *mid);
+
     virtual void merge_pending_relations(output_t *other);
     virtual void merge_expire_trees(output_t *other);
 
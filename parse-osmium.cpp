@@ -27,10 +27,91 @@
 #include "osmdata.hpp"
 
 #include <osmium/io/any_input.hpp>
-#include <osmium/handler.hpp>
-#include <osmium/visitor.hpp>
 #include <osmium/osm.hpp>
 
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+namespace {
+
+/**
+ * Simple blocking queue with a maximum size. Pushing to a full queue
+ * blocks until a consumer has caught up, which keeps the reader from
+ * running arbitrarily far ahead of the slower pipeline stages.
+ */
+template <typename T>
+class bounded_queue_t
+{
+public:
+    explicit bounded_queue_t(size_t max_size)
+    : m_max_size(max_size), m_closed(false)
+    {}
+
+    /// Returns false if the queue has been closed in the meantime.
+    bool push(T &&item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this] {
+            return m_closed || m_queue.size() < m_max_size;
+        });
+        if (m_closed) {
+            return false;
+        }
+        m_queue.push(std::move(item));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /// Returns false when the queue is closed and all items have been taken.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] {
+            return m_closed || !m_queue.empty();
+        });
+        if (m_queue.empty()) {
+            return false;
+        }
+        item = std::move(m_queue.front());
+        m_queue.pop();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+private:
+    size_t m_max_size;
+    bool m_closed;
+    std::queue<T> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+};
+
+/**
+ * Keys of tags, shared by all parsers. There are only so many different
+ * keys, so they are kept for the whole run.
+ */
+string_table_t &tag_keys()
+{
+    static string_table_t keys;
+    return keys;
+}
+
+} // anonymous namespace
+
 void parse_stats_t::update(const parse_stats_t &other)
 {
     node += other.node;
@@ -79,8 +160,9 @@ void parse_stats_t::print_status() const
 parse_osmium_t::parse_osmium_t(bool extra_attrs,
                                const boost::optional<std::string> &bbox,
                                const reprojection *proj, bool do_append,
-                               osmdata_t *osmdata)
-: m_data(osmdata), m_append(do_append), m_attributes(extra_attrs), m_proj(proj)
+                               osmdata_t *osmdata, int input_threads)
+: m_data(osmdata), m_append(do_append), m_attributes(extra_attrs), m_proj(proj),
+  m_threads(input_threads)
 {
     if (bbox) {
         m_bbox = parse_bbox(bbox);
@@ -120,15 +202,162 @@ void parse_osmium_t::stream_file(const std::string &filename, const std::string
     fprintf(stderr, "Using %s parser.\n", osmium::io::as_string(infile.format()));
 
     osmium::io::Reader reader(infile);
-    osmium::apply(reader, *this);
+    if (m_threads > 0) {
+        stream_pipelined(reader);
+    } else {
+        parsed_batch_t batch;
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            convert_buffer(buffer, batch);
+            reproject_nodes(batch);
+            for (auto const &obj : batch) {
+                dispatch(obj);
+            }
+        }
+    }
     reader.close();
 }
 
-void parse_osmium_t::node(osmium::Node& node)
+/*
+ * The pipelined import runs in three stages:
+ *
+ *  1. A feeder thread pulls decoded buffers from the osmium reader (which
+ *     decompresses and decodes PBF blocks on its own thread pool).
+ *  2. m_threads worker threads convert the buffers into parsed_batch_t.
+ *  3. The calling thread dispatches the batches to osmdata.
+ *
+ * The futures for the converted batches are queued in file order, so the
+ * middle and the outputs see exactly the same sequence of objects as in
+ * the single-threaded case. Both queues are bounded to keep memory use
+ * in check when the database is slower than the parser.
+ */
+void parse_osmium_t::stream_pipelined(osmium::io::Reader &reader)
 {
-    if (node.deleted()) {
-        m_data->node_delete(node.id());
-    } else {
+    typedef std::packaged_task<parsed_batch_t()> convert_task_t;
+
+    size_t const queue_size = 2 * (size_t) m_threads + 2;
+    bounded_queue_t<convert_task_t> work(queue_size);
+    bounded_queue_t<std::future<parsed_batch_t>> results(queue_size);
+
+    std::thread feeder([&]() {
+        try {
+            while (osmium::memory::Buffer buffer = reader.read()) {
+                auto buf = std::make_shared<osmium::memory::Buffer>(std::move(buffer));
+                convert_task_t task([this, buf]() {
+                    parsed_batch_t batch;
+                    convert_buffer(*buf, batch);
+                    return batch;
+                });
+
+                if (!results.push(task.get_future()) ||
+                    !work.push(std::move(task))) {
+                    break;
+                }
+            }
+        } catch (...) {
+            // hand read errors to the dispatching thread in file order
+            std::promise<parsed_batch_t> failed;
+            failed.set_exception(std::current_exception());
+            results.push(failed.get_future());
+        }
+        work.close();
+        results.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < m_threads; ++i) {
+        workers.emplace_back([&work]() {
+            convert_task_t task;
+            while (work.pop(task)) {
+                task();
+            }
+        });
+    }
+
+    auto join_all = [&]() {
+        feeder.join();
+        for (auto &w : workers) {
+            w.join();
+        }
+    };
+
+    try {
+        std::future<parsed_batch_t> next;
+        while (results.pop(next)) {
+            parsed_batch_t batch = next.get();
+            reproject_nodes(batch);
+            for (auto const &obj : batch) {
+                dispatch(obj);
+            }
+        }
+    } catch (...) {
+        results.close();
+        work.close();
+        join_all();
+        throw;
+    }
+
+    join_all();
+}
+
+void parse_osmium_t::convert_buffer(const osmium::memory::Buffer &buffer,
+                                    parsed_batch_t &batch) const
+{
+    batch.reserve(buffer.committed() / 64);
+
+    size_t used = 0;
+    for (auto const &entity : buffer) {
+        switch (entity.type()) {
+        case osmium::item_type::node:
+        case osmium::item_type::way:
+        case osmium::item_type::relation:
+            if (used == batch.size()) {
+                batch.emplace_back();
+            }
+            if (convert(static_cast<const osmium::OSMObject &>(entity),
+                        batch[used])) {
+                ++used;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    batch.erase(batch.begin() + used, batch.end());
+}
+
+void parse_osmium_t::reproject_nodes(parsed_batch_t &batch)
+{
+    m_locations.clear();
+    for (auto const &obj : batch) {
+        if (obj.type == osmium::item_type::node && !obj.deleted) {
+            m_locations.push_back(obj.location);
+        }
+    }
+
+    m_coords.resize(m_locations.size());
+    m_proj->reproject_batch(m_locations.data(), m_coords.data(), m_locations.size());
+
+    size_t i = 0;
+    for (auto &obj : batch) {
+        if (obj.type == osmium::item_type::node && !obj.deleted) {
+            obj.coords = m_coords[i++];
+        }
+    }
+}
+
+bool parse_osmium_t::convert(const osmium::OSMObject &in, parsed_object_t &obj) const
+{
+    obj.type = in.type();
+    obj.id = in.id();
+    obj.deleted = in.deleted();
+
+    if (obj.deleted) {
+        return true;
+    }
+
+    switch (obj.type) {
+    case osmium::item_type::node: {
+        auto const &node = static_cast<const osmium::Node &>(in);
         // if the node is not valid, then node.location.lat/lon() can throw.
         // we probably ought to treat invalid locations as if they were
         // deleted and ignore them.
@@ -138,82 +367,143 @@ void parse_osmium_t::node(osmium::Node& node)
                   "recent planet files, so please check that your input is correct.\n",
                   node.id(), node.version());
 
-          return;
+          return false;
         }
 
-        if (!m_bbox || m_bbox->contains(node.location())) {
-            auto c = m_proj->reproject(node.location());
-
-            convert_tags(node);
-            if (m_append) {
-                m_data->node_modify(node.id(), c.y, c.x, tags);
-            } else {
-                m_data->node_add(node.id(), c.y, c.x, tags);
-            }
-            m_stats.add_node(node.id());
+        if (m_bbox && !m_bbox->contains(node.location())) {
+            return false;
         }
+
+        obj.location = node.location();
+        convert_tags(node, obj);
+        break;
+    }
+    case osmium::item_type::way:
+        convert_tags(in, obj);
+        convert_nodes(static_cast<const osmium::Way &>(in).nodes(), obj.nds);
+        break;
+    case osmium::item_type::relation:
+        convert_tags(in, obj);
+        convert_members(static_cast<const osmium::Relation &>(in).members(),
+                        obj.members);
+        break;
+    default:
+        return false;
     }
+
+    return true;
 }
 
-void parse_osmium_t::way(osmium::Way& way)
+void parse_osmium_t::dispatch(const parsed_object_t &obj)
 {
-    if (way.deleted()) {
-        m_data->way_delete(way.id());
-    } else {
-        convert_tags(way);
-        convert_nodes(way.nodes());
-        if (m_append) {
-            m_data->way_modify(way.id(), nds, tags);
-        } else {
-            m_data->way_add(way.id(), nds, tags);
-        }
+    if (!obj.deleted) {
+        unpack_tags(obj);
     }
-    m_stats.add_way(way.id());
-}
 
-void parse_osmium_t::relation(osmium::Relation& rel)
-{
-    if (rel.deleted()) {
-        m_data->relation_delete(rel.id());
-    } else {
-        convert_tags(rel);
-        convert_members(rel.members());
-        if (m_append) {
-            m_data->relation_modify(rel.id(), members, tags);
+    switch (obj.type) {
+    case osmium::item_type::node:
+        if (obj.deleted) {
+            m_data->node_delete(obj.id);
+        } else {
+            if (m_append) {
+                m_data->node_modify(obj.id, obj.coords.lat, obj.coords.lon, m_tags);
+            } else {
+                m_data->node_add(obj.id, obj.coords.lat, obj.coords.lon, m_tags);
+            }
+            m_stats.add_node(obj.id);
+        }
+        break;
+    case osmium::item_type::way:
+        if (obj.deleted) {
+            m_data->way_delete(obj.id);
+        } else if (m_append) {
+            m_data->way_modify(obj.id, obj.nds, m_tags);
         } else {
-            m_data->relation_add(rel.id(), members, tags);
+            m_data->way_add(obj.id, obj.nds, m_tags);
         }
+        m_stats.add_way(obj.id);
+        break;
+    case osmium::item_type::relation:
+        if (obj.deleted) {
+            m_data->relation_delete(obj.id);
+        } else if (m_append) {
+            m_data->relation_modify(obj.id, obj.members, m_tags);
+        } else {
+            m_data->relation_add(obj.id, obj.members, m_tags);
+        }
+        m_stats.add_rel(obj.id);
+        break;
+    default:
+        break;
     }
-    m_stats.add_rel(rel.id());
 }
 
-void parse_osmium_t::convert_tags(const osmium::OSMObject &obj)
+void parse_osmium_t::convert_tags(const osmium::OSMObject &obj,
+                                  parsed_object_t &out) const
 {
-    tags.clear();
+    string_table_t &keys = tag_keys();
+
+    out.tags.clear();
+    out.tag_values.clear();
+
+    auto add = [&](const char *key, const char *value, size_t len) {
+        out.tags.push_back(packed_tag_t{keys.add(key, strlen(key)),
+                                        uint32_t(out.tag_values.size()),
+                                        uint32_t(len)});
+        out.tag_values.append(value, len);
+    };
+
     for (auto const &t : obj.tags()) {
-        tags.emplace_back(t.key(), t.value());
+        add(t.key(), t.value(), strlen(t.value()));
     }
     if (m_attributes) {
-        tags.emplace_back("osm_user", obj.user());
-        tags.emplace_back("osm_uid", std::to_string(obj.uid()));
-        tags.emplace_back("osm_version", std::to_string(obj.version()));
-        tags.emplace_back("osm_timestamp", obj.timestamp().to_iso());
-        tags.emplace_back("osm_changeset", std::to_string(obj.changeset()));
+        add("osm_user", obj.user(), strlen(obj.user()));
+        std::string value = std::to_string(obj.uid());
+        add("osm_uid", value.data(), value.size());
+        value = std::to_string(obj.version());
+        add("osm_version", value.data(), value.size());
+        value = obj.timestamp().to_iso();
+        add("osm_timestamp", value.data(), value.size());
+        value = std::to_string(obj.changeset());
+        add("osm_changeset", value.data(), value.size());
+    }
+}
+
+void parse_osmium_t::unpack_tags(const parsed_object_t &obj)
+{
+    string_table_t const &keys = tag_keys();
+
+    if (m_tags.size() > obj.tags.size()) {
+        m_tags.erase(m_tags.begin() + obj.tags.size(), m_tags.end());
+    }
+
+    for (size_t i = 0; i < obj.tags.size(); ++i) {
+        auto const &t = obj.tags[i];
+        size_t len;
+        const char *key = keys.data(t.key, &len);
+        if (i < m_tags.size()) {
+            m_tags[i].key.assign(key, len);
+            m_tags[i].value.assign(obj.tag_values, t.value_offset, t.value_len);
+        } else {
+            m_tags.emplace_back(std::string(key, len),
+                                obj.tag_values.substr(t.value_offset, t.value_len));
+        }
     }
 }
 
-void parse_osmium_t::convert_nodes(const osmium::NodeRefList &in_nodes)
+void parse_osmium_t::convert_nodes(const osmium::NodeRefList &in_nodes, idlist_t &out) const
 {
-    nds.clear();
+    out.clear();
 
     for (auto const &n : in_nodes) {
-        nds.push_back(n.ref());
+        out.push_back(n.ref());
     }
 }
 
-void parse_osmium_t::convert_members(const osmium::RelationMemberList &in_rels)
+void parse_osmium_t::convert_members(const osmium::RelationMemberList &in_rels,
+                                     memberlist_t &out) const
 {
-    members.clear();
+    out.clear();
 
     for (auto const &m: in_rels) {
         OsmType type;
@@ -224,6 +514,6 @@ void parse_osmium_t::convert_members(const osmium::RelationMemberList &in_rels)
             default:
                 fprintf(stderr, "Unsupported type: %u""\n", unsigned(m.type()));
         }
-        members.emplace_back(type, m.ref(), m.role());
+        out.emplace_back(type, m.ref(), m.role());
     }
 }
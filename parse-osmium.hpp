@@ -27,12 +27,23 @@
 
 #include <boost/optional.hpp>
 #include <ctime>
+#include <vector>
 
 #include "osmtypes.hpp"
+#include "string-table.hpp"
 
 #include <osmium/osm/box.hpp>
+#include <osmium/osm/item_type.hpp>
 #include <osmium/fwd.hpp>
-#include <osmium/handler.hpp>
+
+namespace osmium {
+    namespace io {
+        class Reader;
+    }
+    namespace memory {
+        class Buffer;
+    }
+}
 
 
 class reprojection;
@@ -103,27 +114,75 @@ private:
 };
 
 
-class parse_osmium_t: public osmium::handler::Handler
+class parse_osmium_t
 {
 public:
+    /**
+     * When input_threads is larger than 0, stream_file() runs in pipelined
+     * mode: buffers from the osmium reader are converted by that many worker
+     * threads while the calling thread hands the converted objects to
+     * osmdata in file order.
+     */
     parse_osmium_t(bool extra_attrs, const boost::optional<std::string> &bbox,
-                   const reprojection *proj, bool do_append, osmdata_t *osmdata);
+                   const reprojection *proj, bool do_append, osmdata_t *osmdata,
+                   int input_threads = 0);
 
     void stream_file(const std::string &filename, const std::string &fmt);
 
-    void node(osmium::Node& node);
-    void way(osmium::Way& way);
-    void relation(osmium::Relation& rel);
-
     parse_stats_t const &stats() const
     {
         return m_stats;
     }
 
 private:
-    void convert_tags(const osmium::OSMObject &obj);
-    void convert_nodes(const osmium::NodeRefList &in_nodes);
-    void convert_members(const osmium::RelationMemberList &in_rels);
+    /**
+     * A tag of a parsed object. Keys repeat a lot and are interned, values
+     * are kept in the object's tag_values.
+     */
+    struct packed_tag_t
+    {
+        string_table_t::handle_t key;
+        uint32_t value_offset;
+        uint32_t value_len;
+    };
+
+    /// An OSM object converted into osm2pgsql types, ready for dispatch.
+    struct parsed_object_t
+    {
+        osmium::item_type type = osmium::item_type::undefined;
+        osmid_t id = 0;
+        bool deleted = false;
+        osmium::Location location;
+        // the location in the target projection, set by reproject_nodes()
+        osmNode coords;
+        std::vector<packed_tag_t> tags;
+        std::string tag_values;
+        idlist_t nds;
+        memberlist_t members;
+    };
+    typedef std::vector<parsed_object_t> parsed_batch_t;
+
+    void stream_pipelined(osmium::io::Reader &reader);
+
+    /**
+     * Fill obj from the osmium object. Returns false if the object
+     * is to be skipped. Only reads parser settings, so it may be
+     * called from several threads at once.
+     */
+    bool convert(const osmium::OSMObject &in, parsed_object_t &obj) const;
+    /// Convert buffer into batch, reusing the objects already in it.
+    void convert_buffer(const osmium::memory::Buffer &buffer,
+                        parsed_batch_t &batch) const;
+    /// Reproject the locations of all nodes in batch at once.
+    void reproject_nodes(parsed_batch_t &batch);
+    void dispatch(const parsed_object_t &obj);
+
+    void convert_tags(const osmium::OSMObject &obj, parsed_object_t &out) const;
+    /// Fill m_tags with the tags of obj, reusing the strings already there.
+    void unpack_tags(const parsed_object_t &obj);
+    void convert_nodes(const osmium::NodeRefList &in_nodes, idlist_t &out) const;
+    void convert_members(const osmium::RelationMemberList &in_rels,
+                         memberlist_t &out) const;
 
     osmium::Box parse_bbox(const boost::optional<std::string> &bbox);
 
@@ -132,14 +191,14 @@ private:
     boost::optional<osmium::Box> m_bbox;
     bool m_attributes;
     const reprojection *m_proj;
+    int m_threads;
     parse_stats_t m_stats;
 
-    /* Since {node,way} elements are not nested we can guarantee that
-       elements are parsed sequentially and can therefore be cached.
-    */
-    taglist_t tags;
-    idlist_t nds;
-    memberlist_t members;
+    // tags of the object being dispatched
+    taglist_t m_tags;
+    // node locations of a batch, before and after reprojection
+    std::vector<osmium::Location> m_locations;
+    nodelist_t m_coords;
 };
 
 #endif
@@ -5,8 +5,26 @@
 #include <cstdlib>
 #include <cstdarg>
 #include <memory>
+#include <stdexcept>
+#include <vector>
 #include <boost/format.hpp>
 
+namespace {
+const char binary_copy_signature[] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0' };
+}
+
+void pgsql_binary::put_copy_header(std::string &dst)
+{
+    dst.append(binary_copy_signature, sizeof(binary_copy_signature));
+    put_int32(dst, 0);
+    put_int32(dst, 0);
+}
+
+void pgsql_binary::put_copy_trailer(std::string &dst)
+{
+    put_int16(dst, -1);
+}
+
 void escape(const std::string &src, std::string &dst)
 {
     for (const char c: src) {
@@ -112,6 +130,136 @@ void pgsql_CopyData(const char *context, PGconn *sql_conn, const char *sql, int
     }
 }
 
+PGresult *pgsql_execPreparedBinary(PGconn *sql_conn, const char *stmtName, const int nParams, const char *const *paramValues, const int *paramLengths, const ExecStatusType expect)
+{
+#ifdef DEBUG_PGSQL
+    fprintf( stderr, "ExecPrepared (binary): %s\n", stmtName );
+#endif
+    std::vector<int> paramFormats(nParams, 1);
+    PGresult *res = PQexecPrepared(sql_conn, stmtName, nParams, paramValues, paramLengths, paramFormats.data(), 1);
+    if (PQresultStatus(res) != expect) {
+        std::string message = (boost::format("%1% failed: %2%(%3%)\n") % stmtName % PQerrorMessage(sql_conn) % PQresultStatus(res)).str();
+        PQclear(res);
+        throw std::runtime_error(message);
+    }
+
+    if (expect != PGRES_TUPLES_OK) {
+        PQclear(res);
+        res = nullptr;
+    }
+    return res;
+}
+
+pgsql_pipeline_t::pgsql_pipeline_t(PGconn *sql_conn)
+: m_conn(sql_conn), m_syncs(0), m_synced(true)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQenterPipelineMode(m_conn) != 1) {
+        throw std::runtime_error((boost::format("Entering pipeline mode failed: %1%\n")
+                                  % PQerrorMessage(m_conn)).str());
+    }
+#endif
+}
+
+pgsql_pipeline_t::~pgsql_pipeline_t()
+{
+    for (auto const &stmt : m_pending) {
+        PQclear(stmt.result);
+    }
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // drop the results not fetched, the connection has to leave pipeline
+    // mode before it can be used for anything else
+    sync();
+    while (m_syncs > 0) {
+        PGresult *res = PQgetResult(m_conn);
+        if (!res) {
+            if (PQstatus(m_conn) != CONNECTION_OK) {
+                break;
+            }
+            continue;
+        }
+        if (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+            --m_syncs;
+        }
+        PQclear(res);
+    }
+    PQexitPipelineMode(m_conn);
+#endif
+}
+
+void pgsql_pipeline_t::sync()
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (!m_synced) {
+        PQpipelineSync(m_conn);
+        ++m_syncs;
+        m_synced = true;
+    }
+#endif
+}
+
+void pgsql_pipeline_t::send_prepared(const char *stmtName, const int nParams,
+                                     const char *const *paramValues,
+                                     const int *paramLengths,
+                                     const ExecStatusType expect)
+{
+#ifdef DEBUG_PGSQL
+    fprintf( stderr, "ExecPrepared (pipelined): %s\n", stmtName );
+#endif
+    statement_t stmt = { stmtName, expect, nullptr };
+#ifdef LIBPQ_HAS_PIPELINING
+    std::vector<int> paramFormats(nParams, 1);
+    if (PQsendQueryPrepared(m_conn, stmtName, nParams, paramValues,
+                            paramLengths, paramFormats.data(), 1) != 1) {
+        throw std::runtime_error((boost::format("%1% failed: %2%\n")
+                                  % stmtName % PQerrorMessage(m_conn)).str());
+    }
+    m_synced = false;
+#else
+    stmt.result = pgsql_execPreparedBinary(m_conn, stmtName, nParams,
+                                           paramValues, paramLengths, expect);
+#endif
+    m_pending.push_back(stmt);
+}
+
+PGresult *pgsql_pipeline_t::next_result()
+{
+    if (m_pending.empty()) {
+        throw std::runtime_error("No statements pending in pipeline.\n");
+    }
+    statement_t const stmt = m_pending.front();
+    m_pending.pop_front();
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // the server only starts sending results once the statements sent so
+    // far are followed by a sync
+    sync();
+
+    PGresult *res = PQgetResult(m_conn);
+    while (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+        --m_syncs;
+        PQclear(res);
+        res = PQgetResult(m_conn);
+    }
+    if (PQresultStatus(res) != stmt.expect) {
+        std::string message = (boost::format("%1% failed: %2%(%3%)\n") % stmt.name % PQerrorMessage(m_conn) % PQresultStatus(res)).str();
+        PQclear(res);
+        throw std::runtime_error(message);
+    }
+    // the results of every statement are followed by a null result
+    PQgetResult(m_conn);
+
+    if (stmt.expect != PGRES_TUPLES_OK) {
+        PQclear(res);
+        res = nullptr;
+    }
+    return res;
+#else
+    return stmt.result;
+#endif
+}
+
 PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect)
 {
 #ifdef DEBUG_PGSQL
@@ -6,12 +6,16 @@
 #ifndef PGSQL_H
 #define PGSQL_H
 
+#include <deque>
 #include <string>
+#include <cstdint>
 #include <cstring>
 #include <libpq-fe.h>
 #include <memory>
 
 PGresult *pgsql_execPrepared( PGconn *sql_conn, const char *stmtName, const int nParams, const char *const * paramValues, const ExecStatusType expect);
+/* Like pgsql_execPrepared, but with all parameters and results in binary format */
+PGresult *pgsql_execPreparedBinary(PGconn *sql_conn, const char *stmtName, const int nParams, const char *const *paramValues, const int *paramLengths, const ExecStatusType expect);
 void pgsql_CopyData(const char *context, PGconn *sql_conn, const char *sql, int len);
 std::shared_ptr<PGresult> pgsql_exec_simple(PGconn *sql_conn, const ExecStatusType expect, const std::string& sql);
 std::shared_ptr<PGresult> pgsql_exec_simple(PGconn *sql_conn, const ExecStatusType expect, const char *sql);
@@ -23,6 +27,51 @@ int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, .
 
 void escape(const std::string &src, std::string& dst);
 
+/**
+ * Runs several prepared statements on one connection without waiting for
+ * the result of one before sending the next, so that a batch of lookups
+ * costs a single round trip. Uses the pipeline mode of libpq, with older
+ * versions of libpq the statements are run one after the other.
+ *
+ * All parameters and results are in binary format. The results have to be
+ * fetched in the order the statements were sent; the connection can only
+ * be used for other queries once the pipeline is destroyed.
+ */
+class pgsql_pipeline_t
+{
+public:
+    explicit pgsql_pipeline_t(PGconn *sql_conn);
+    ~pgsql_pipeline_t();
+
+    void send_prepared(const char *stmtName, const int nParams,
+                       const char *const *paramValues,
+                       const int *paramLengths, const ExecStatusType expect);
+
+    /**
+     * Result of the oldest statement not fetched yet, to be freed with
+     * PQclear. Like pgsql_execPrepared returns nullptr for statements not
+     * expected to return rows.
+     */
+    PGresult *next_result();
+
+    /// Number of statements sent whose results were not fetched yet.
+    size_t pending() const { return m_pending.size(); }
+
+private:
+    struct statement_t {
+        const char *name;
+        ExecStatusType expect;
+        PGresult *result; // only used without pipeline mode
+    };
+
+    void sync();
+
+    PGconn *m_conn;
+    std::deque<statement_t> m_pending;
+    size_t m_syncs; // syncs sent whose results were not read yet
+    bool m_synced; // no statements sent since the last sync
+};
+
 
 inline void pgsql_CopyData(const char *context, PGconn *sql_conn, const char *sql) {
     pgsql_CopyData(context, sql_conn, sql, (int) strlen(sql));
@@ -31,4 +80,100 @@ inline void pgsql_CopyData(const char *context, PGconn *sql_conn, const char *sq
 inline void pgsql_CopyData(const char *context, PGconn *sql_conn, const std::string &sql) {
     pgsql_CopyData(context, sql_conn, sql.c_str(), (int) sql.length());
 }
+
+/* Helpers for the binary COPY and result formats, which use network byte
+ * order for all numbers */
+namespace pgsql_binary {
+
+// binary COPY data starts with a signature, flags and header extension length
+void put_copy_header(std::string &dst);
+// and ends with a row with field count -1
+void put_copy_trailer(std::string &dst);
+
+inline void put_int16(std::string &dst, int16_t value)
+{
+    dst.push_back(char((uint16_t(value) >> 8) & 0xff));
+    dst.push_back(char(uint16_t(value) & 0xff));
+}
+
+inline void put_int32(std::string &dst, int32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        dst.push_back(char((uint32_t(value) >> shift) & 0xff));
+}
+
+inline void put_int64(std::string &dst, int64_t value)
+{
+    for (int shift = 56; shift >= 0; shift -= 8)
+        dst.push_back(char((uint64_t(value) >> shift) & 0xff));
+}
+
+inline void put_float4(std::string &dst, float value)
+{
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_int32(dst, bits);
+}
+
+inline void put_float8(std::string &dst, double value)
+{
+    int64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_int64(dst, bits);
+}
+
+inline int16_t get_int16(const char *src)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(src);
+    return int16_t((p[0] << 8) | p[1]);
+}
+
+inline int32_t get_int32(const char *src)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(src);
+    return int32_t((uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+                   (uint32_t(p[2]) << 8) | uint32_t(p[3]));
+}
+
+inline int64_t get_int64(const char *src)
+{
+    return int64_t((uint64_t(uint32_t(get_int32(src))) << 32) |
+                   uint64_t(uint32_t(get_int32(src + 4))));
+}
+
+inline double get_float8(const char *src)
+{
+    int64_t bits = get_int64(src);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//lengths and counts are often only known once the data following them is
+//written, so space is reserved for them and they are filled in afterwards
+inline size_t reserve_int32(std::string &dst)
+{
+    size_t pos = dst.size();
+    dst.append(4, '\0');
+    return pos;
+}
+
+inline void set_int32(std::string &dst, size_t pos, int32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        dst[pos + i] = char((uint32_t(value) >> (24 - 8 * i)) & 0xff);
+}
+
+//fill in the length of a field started with reserve_int32
+inline void end_field(std::string &dst, size_t pos)
+{
+    set_int32(dst, pos, dst.size() - pos - 4);
+}
+
+inline void put_null(std::string &dst)
+{
+    put_int32(dst, -1);
+}
+
+} // namespace pgsql_binary
 #endif
@@ -7,9 +7,11 @@
 
 #include "config.h"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 
 #include "reprojection.hpp"
 
@@ -30,6 +32,56 @@ void latlon2merc(double *lat, double *lon)
     *lat = log(tan(PI/4.0 + deg_to_rad(*lat) / 2.0)) * EARTH_CIRCUMFERENCE/(PI*2);
 }
 
+/**
+ * latlon2merc() over an array of points, giving the same results. The
+ * clamping and scaling is kept apart from the calls to log() and tan(),
+ * so the compiler can vectorize it.
+ */
+void latlon2merc_batch(osmNode *points, size_t count)
+{
+    using namespace osmium::geom;
+    for (size_t i = 0; i < count; ++i) {
+        double const lat = points[i].lat;
+        points[i].lat = deg_to_rad(lat > 85.07 ? 85.07 : (lat < -85.07 ? -85.07 : lat)) / 2.0;
+        points[i].lon = points[i].lon * EARTH_CIRCUMFERENCE / 360.0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        points[i].lat = log(tan(PI/4.0 + points[i].lat)) * EARTH_CIRCUMFERENCE/(PI*2);
+    }
+}
+
+void locations_to_points(const osmium::Location *locs, osmNode *out, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        out[i].lon = locs[i].lon_without_check();
+        out[i].lat = locs[i].lat_without_check();
+    }
+}
+
+/**
+ * Transform count points in place with one call to proj. The points that
+ * proj could not transform are done again one by one, so they fail the
+ * same way as with osmium::geom::transform().
+ */
+void transform_batch(const osmium::geom::CRS &src, const osmium::geom::CRS &dest,
+                     osmNode *points, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<osmNode> orig(points, points + count);
+    int const result = pj_transform(src.get(), dest.get(), (long) count, 2,
+                                    &points[0].lon, &points[0].lat, nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        if (result != 0 || points[i].lon == HUGE_VAL || points[i].lat == HUGE_VAL) {
+            auto c = transform(src, dest, osmium::geom::Coordinates(orig[i].lon, orig[i].lat));
+            points[i].lon = c.x;
+            points[i].lat = c.y;
+        }
+    }
+}
+
 class latlon_reprojection_t : public reprojection
 {
 public:
@@ -39,11 +91,22 @@ public:
                                          loc.lat_without_check());
     }
 
+    void reproject_batch(const osmium::Location *locs, osmNode *out,
+                         size_t count) const override
+    {
+        locations_to_points(locs, out, count);
+    }
+
     void target_to_tile(double *lat, double *lon) const override
     {
         latlon2merc(lat, lon);
     }
 
+    void target_to_tile_batch(osmNode *points, size_t count) const override
+    {
+        latlon2merc_batch(points, count);
+    }
+
     int target_srs() const override { return PROJ_LATLONG; }
     const char *target_desc() const override { return "Latlong"; }
 };
@@ -64,9 +127,19 @@ public:
         return osmium::geom::Coordinates(lon, lat);
     }
 
+    void reproject_batch(const osmium::Location *locs, osmNode *out,
+                         size_t count) const override
+    {
+        locations_to_points(locs, out, count);
+        latlon2merc_batch(out, count);
+    }
+
     void target_to_tile(double *, double *) const override
     { /* nothing */ }
 
+    void target_to_tile_batch(osmNode *, size_t) const override
+    { /* nothing */ }
+
     int target_srs() const override { return PROJ_SPHERE_MERC; }
     const char *target_desc() const override { return "Spherical Mercator"; }
 };
@@ -87,6 +160,17 @@ public:
                                      deg_to_rad(loc.lat_without_check())));
     }
 
+    void reproject_batch(const osmium::Location *locs, osmNode *out,
+                         size_t count) const override
+    {
+        using namespace osmium::geom;
+        for (size_t i = 0; i < count; ++i) {
+            out[i].lon = deg_to_rad(locs[i].lon_without_check());
+            out[i].lat = deg_to_rad(locs[i].lat_without_check());
+        }
+        transform_batch(pj_source, pj_target, out, count);
+    }
+
     void target_to_tile(double *lat, double *lon) const override
     {
         auto c = transform(pj_target, pj_tile, osmium::geom::Coordinates(*lon, *lat));
@@ -95,6 +179,11 @@ public:
         *lat = c.y;
     }
 
+    void target_to_tile_batch(osmNode *points, size_t count) const override
+    {
+        transform_batch(pj_target, pj_tile, points, count);
+    }
+
     int target_srs() const override { return m_target_srs; }
     const char *target_desc() const override { return pj_get_def(pj_target.get(), 0); }
 
@@ -136,3 +225,31 @@ void reprojection::coords_to_tile(double *tilex, double *tiley,
     *tilex = map_width * (0.5 + lon / EARTH_CIRCUMFERENCE);
     *tiley = map_width * (0.5 - lat / EARTH_CIRCUMFERENCE);
 }
+
+void reprojection::reproject_batch(const osmium::Location *locs, osmNode *out,
+                                   size_t count) const
+{
+    for (size_t i = 0; i < count; ++i) {
+        auto c = reproject(locs[i]);
+        out[i].lon = c.x;
+        out[i].lat = c.y;
+    }
+}
+
+void reprojection::target_to_tile_batch(osmNode *points, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i) {
+        target_to_tile(&points[i].lat, &points[i].lon);
+    }
+}
+
+void reprojection::coords_to_tile_batch(osmNode *points, size_t count,
+                                        int map_width) const
+{
+    target_to_tile_batch(points, count);
+
+    for (size_t i = 0; i < count; ++i) {
+        points[i].lon = map_width * (0.5 + points[i].lon / EARTH_CIRCUMFERENCE);
+        points[i].lat = map_width * (0.5 - points[i].lat / EARTH_CIRCUMFERENCE);
+    }
+}
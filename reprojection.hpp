@@ -13,6 +13,10 @@
 #include <osmium/geom/projection.hpp>
 #include <osmium/osm/location.hpp>
 
+#include <cstddef>
+
+#include "osmtypes.hpp"
+
 enum Projection { PROJ_LATLONG = 4326, PROJ_SPHERE_MERC = 3857 };
 
 class reprojection : public boost::noncopyable
@@ -26,6 +30,13 @@ public:
      */
     virtual osmium::geom::Coordinates reproject(osmium::Location loc) const = 0;
 
+    /**
+     * Reproject count locations at once, writing the coordinates in
+     * the target projection to out.
+     */
+    virtual void reproject_batch(const osmium::Location *locs, osmNode *out,
+                                 size_t count) const;
+
     /**
      * Converts coordinates from target projection to tile projection (EPSG:3857)
      *
@@ -34,6 +45,9 @@ public:
      */
     virtual void target_to_tile(double *lat, double *lon) const = 0;
 
+    /// Converts count points in place from target to tile projection.
+    virtual void target_to_tile_batch(osmNode *points, size_t count) const;
+
     /**
      * Converts from target coordinates to tile coordinates.
      *
@@ -42,6 +56,9 @@ public:
      */
     void coords_to_tile(double *tilex, double *tiley,
                         double lon, double lat, int map_width);
+
+    /// Converts count points in place from target to tile coordinates.
+    void coords_to_tile_batch(osmNode *points, size_t count, int map_width) const;
     virtual int target_srs() const = 0;
     virtual const char *target_desc() const = 0;
 
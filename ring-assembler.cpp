@@ -0,0 +1,487 @@
+#include "ring-assembler.hpp"
+#include "box-index.hpp"
+#include "ring-kernels.hpp"
+#include "wkb-writer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+
+namespace {
+
+bool same_location(const osmNode &a, const osmNode &b)
+{
+    return a.lon == b.lon && a.lat == b.lat;
+}
+
+/// Orders locations by x, then y, like geos::geom::Coordinate::compareTo().
+int compare_locations(const osmNode &a, const osmNode &b)
+{
+    if (a.lon != b.lon) {
+        return a.lon < b.lon ? -1 : 1;
+    }
+    if (a.lat != b.lat) {
+        return a.lat < b.lat ? -1 : 1;
+    }
+    return 0;
+}
+
+bool less_location(const osmNode &a, const osmNode &b)
+{
+    return compare_locations(a, b) < 0;
+}
+
+/// Orders rings like geos::geom::LineString::compareToSameClass().
+int compare_rings(const nodelist_t &a, const nodelist_t &b)
+{
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        int const cmp = compare_locations(a[i], b[i]);
+        if (cmp) {
+            return cmp;
+        }
+    }
+    return 0;
+}
+
+/// Whether p is inside the ring, which it must not lie on.
+bool ring_contains(const nodelist_t &ring, const osmNode &p)
+{
+    bool inside = false;
+    for (size_t i = 0; i + 1 < ring.size(); ++i) {
+        auto const &a = ring[i];
+        auto const &b = ring[i + 1];
+        if ((a.lat > p.lat) != (b.lat > p.lat)) {
+            double const x = a.lon + (p.lat - a.lat) * (b.lon - a.lon) / (b.lat - a.lat);
+            if (p.lon < x) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+int orientation(const osmNode &a, const osmNode &b, const osmNode &c)
+{
+    double const o = (b.lon - a.lon) * (c.lat - a.lat) - (b.lat - a.lat) * (c.lon - a.lon);
+    return (o > 0) - (o < 0);
+}
+
+/// Whether p, which is in line with a and b, lies on the segment a-b.
+bool in_segment(const osmNode &a, const osmNode &b, const osmNode &p)
+{
+    return std::min(a.lon, b.lon) <= p.lon && p.lon <= std::max(a.lon, b.lon) &&
+           std::min(a.lat, b.lat) <= p.lat && p.lat <= std::max(a.lat, b.lat);
+}
+
+bool segments_intersect(const osmNode &a, const osmNode &b,
+                        const osmNode &c, const osmNode &d)
+{
+    int const o1 = orientation(a, b, c);
+    int const o2 = orientation(a, b, d);
+    int const o3 = orientation(c, d, a);
+    int const o4 = orientation(c, d, b);
+
+    if (o1 * o2 < 0 && o3 * o4 < 0) {
+        return true;
+    }
+
+    return (o1 == 0 && in_segment(a, b, c)) || (o2 == 0 && in_segment(a, b, d)) ||
+           (o3 == 0 && in_segment(c, d, a)) || (o4 == 0 && in_segment(c, d, b));
+}
+
+struct segment_t
+{
+    uint32_t ring;
+    uint32_t index;
+    double minx, maxx, miny, maxy;
+};
+
+/**
+ * Checks that no two segments of the rings have any point in common,
+ * except for neighbouring segments of a ring at their shared end, and
+ * that these do not fold back onto each other.
+ *
+ * Segments are swept from left to right, each one being compared to
+ * those that overlap with it in x.
+ */
+bool rings_are_clean(const multinodelist_t &rings)
+{
+    std::vector<segment_t> segments;
+    for (size_t r = 0; r < rings.size(); ++r) {
+        auto const &ring = rings[r];
+        for (size_t i = 0; i + 1 < ring.size(); ++i) {
+            auto const &a = ring[i];
+            auto const &b = ring[i + 1];
+            segments.push_back(segment_t{uint32_t(r), uint32_t(i),
+                                         std::min(a.lon, b.lon), std::max(a.lon, b.lon),
+                                         std::min(a.lat, b.lat), std::max(a.lat, b.lat)});
+        }
+    }
+
+    std::sort(segments.begin(), segments.end(),
+              [](const segment_t &a, const segment_t &b) { return a.minx < b.minx; });
+
+    std::vector<const segment_t *> active;
+    for (auto const &s : segments) {
+        auto const &ring = rings[s.ring];
+        size_t const num = ring.size() - 1;
+
+        for (size_t k = 0; k < active.size();) {
+            auto const &t = *active[k];
+            if (t.maxx < s.minx) {
+                active[k] = active.back();
+                active.pop_back();
+                continue;
+            }
+            ++k;
+
+            if (t.maxy < s.miny || s.maxy < t.miny) {
+                continue;
+            }
+
+            if (t.ring == s.ring) {
+                // neighbours share one end, they must not run back along each other
+                size_t first, second;
+                if ((s.index + 1) % num == t.index) {
+                    first = s.index;
+                    second = t.index;
+                } else if ((t.index + 1) % num == s.index) {
+                    first = t.index;
+                    second = s.index;
+                } else {
+                    first = second = num;
+                }
+                if (first != num) {
+                    auto const &a = ring[first];
+                    auto const &b = ring[first + 1];
+                    auto const &c = ring[second + 1];
+                    if (orientation(a, b, c) == 0 &&
+                        (a.lon - b.lon) * (c.lon - b.lon) + (a.lat - b.lat) * (c.lat - b.lat) > 0) {
+                        return false;
+                    }
+                    continue;
+                }
+            }
+
+            auto const &other = rings[t.ring];
+            if (segments_intersect(ring[s.index], ring[s.index + 1],
+                                   other[t.index], other[t.index + 1])) {
+                return false;
+            }
+        }
+
+        active.push_back(&s);
+    }
+
+    return true;
+}
+
+/**
+ * Starts the ring at its smallest location and orients it, like
+ * geos::geom::Polygon::normalize() does.
+ */
+void normalize_ring(nodelist_t &ring, bool clockwise)
+{
+    ring.pop_back();
+    auto const min = std::min_element(ring.begin(), ring.end(), less_location);
+    std::rotate(ring.begin(), min, ring.end());
+    ring.push_back(ring.front());
+
+    if (ring_is_ccw(ring) == clockwise) {
+        std::reverse(ring.begin(), ring.end());
+    }
+}
+
+} // anonymous namespace
+
+bool ring_assembler_t::merge(const multinodelist_t &xnodes)
+{
+    m_lines.clear();
+    m_rings.clear();
+    m_polygons.clear();
+
+    // the ways without repeated locations are the edges of a graph,
+    // whose nodes are the locations where they end
+    multinodelist_t edges;
+    edges.reserve(xnodes.size());
+    for (auto const &way : xnodes) {
+        nodelist_t edge;
+        edge.reserve(way.size());
+        for (auto const &n : way) {
+            if (std::isnan(n.lon) || std::isnan(n.lat)) {
+                return false;
+            }
+            if (edge.empty() || !same_location(edge.back(), n)) {
+                edge.push_back(n);
+            }
+        }
+        if (edge.size() > 1) {
+            edges.push_back(std::move(edge));
+        }
+    }
+
+    // end 2e is the start of edge e and 2e + 1 its end
+    size_t const num_ends = 2 * edges.size();
+    nodelist_t locations;
+    locations.reserve(num_ends);
+    for (auto const &edge : edges) {
+        locations.push_back(edge.front());
+        locations.push_back(edge.back());
+    }
+    std::sort(locations.begin(), locations.end(), less_location);
+    locations.erase(std::unique(locations.begin(), locations.end(), same_location),
+                    locations.end());
+
+    std::vector<uint32_t> end_node(num_ends);
+    std::vector<uint32_t> first(locations.size() + 1, 0);
+    for (size_t end = 0; end < num_ends; ++end) {
+        auto const &edge = edges[end / 2];
+        auto const &loc = end % 2 ? edge.back() : edge.front();
+        end_node[end] = std::lower_bound(locations.begin(), locations.end(),
+                                         loc, less_location) - locations.begin();
+        ++first[end_node[end] + 1];
+    }
+    std::partial_sum(first.begin(), first.end(), first.begin());
+
+    std::vector<uint32_t> incident(num_ends);
+    std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+    for (size_t end = 0; end < num_ends; ++end) {
+        incident[fill[end_node[end]]++] = end;
+    }
+
+    auto degree = [&](uint32_t node) { return first[node + 1] - first[node]; };
+
+    std::vector<bool> used(edges.size(), false);
+
+    // follow the edges from the given end on through all nodes where
+    // exactly two of them meet
+    auto add_line = [&](uint32_t end) {
+        nodelist_t line;
+        size_t forward = 0, reverse = 0;
+        for (;;) {
+            auto const &edge = edges[end / 2];
+            used[end / 2] = true;
+            size_t const skip = line.empty() ? 0 : 1;
+            if (end % 2 == 0) {
+                ++forward;
+                line.insert(line.end(), edge.begin() + skip, edge.end());
+            } else {
+                ++reverse;
+                line.insert(line.end(), edge.rbegin() + skip, edge.rend());
+            }
+
+            uint32_t const arrived = end ^ 1;
+            uint32_t const node = end_node[arrived];
+            if (degree(node) != 2) {
+                break;
+            }
+            uint32_t const next = incident[first[node]] == arrived
+                                      ? incident[first[node] + 1]
+                                      : incident[first[node]];
+            if (used[next / 2]) {
+                break;
+            }
+            end = next;
+        }
+
+        // keep the direction of most of the ways
+        if (forward < reverse) {
+            std::reverse(line.begin(), line.end());
+        }
+        m_lines.push_back(std::move(line));
+    };
+
+    for (uint32_t node = 0; node < locations.size(); ++node) {
+        if (degree(node) == 2) {
+            continue;
+        }
+        for (uint32_t i = first[node]; i < first[node + 1]; ++i) {
+            if (!used[incident[i] / 2]) {
+                add_line(incident[i]);
+            }
+        }
+    }
+
+    // what is left are loops through nodes where two edges meet
+    for (uint32_t e = 0; e < edges.size(); ++e) {
+        if (!used[e]) {
+            add_line(2 * e);
+        }
+    }
+
+    return true;
+}
+
+bool ring_assembler_t::assemble(const reprojection *proj)
+{
+    m_rings.clear();
+    m_polygons.clear();
+
+    multinodelist_t lines;
+    for (auto &line : m_lines) {
+        if (line.size() > 3 && same_location(line.front(), line.back())) {
+            if (ring_signed_area2(line) != 0) {
+                m_rings.push_back(std::move(line));
+            }
+        } else {
+            lines.push_back(std::move(line));
+        }
+    }
+    m_lines.swap(lines);
+
+    if (m_rings.empty()) {
+        return true;
+    }
+
+    if (!rings_are_clean(m_rings)) {
+        return false;
+    }
+
+    size_t const num_rings = m_rings.size();
+    std::vector<double> area2(num_rings);
+    box_index_t index;
+    for (size_t r = 0; r < num_rings; ++r) {
+        area2[r] = std::fabs(ring_signed_area2(m_rings[r]));
+        index.add(ring_box(m_rings[r]));
+    }
+    index.build();
+
+    std::vector<size_t> order(num_rings);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return area2[a] > area2[b]; });
+    std::vector<size_t> rank(num_rings);
+    for (size_t j = 0; j < num_rings; ++j) {
+        rank[order[j]] = j;
+    }
+
+    // the ring directly around each ring is the smallest of the larger
+    // ones containing it, as the rings do not cross
+    std::vector<size_t> polygon_of(num_rings);
+    std::vector<bool> is_hole(num_rings, false);
+    std::vector<size_t> candidates;
+    for (size_t j = 0; j < num_rings; ++j) {
+        size_t const ring = order[j];
+
+        // only the larger rings whose boxes cover this one can contain it
+        candidates.clear();
+        index.covering(index.box(ring), [&](size_t other) {
+            if (rank[other] < j) {
+                candidates.push_back(rank[other]);
+            }
+        });
+        std::sort(candidates.begin(), candidates.end());
+
+        size_t parent = num_rings;
+        for (size_t i = candidates.size(); i-- > 0;) {
+            size_t const other = order[candidates[i]];
+            if (ring_contains(m_rings[other], m_rings[ring][0])) {
+                parent = other;
+                break;
+            }
+        }
+
+        if (parent != num_rings && !is_hole[parent]) {
+            is_hole[ring] = true;
+            m_polygons[polygon_of[parent]].rings.push_back(ring);
+        } else {
+            polygon_of[ring] = m_polygons.size();
+            m_polygons.push_back(polygon_t{{ring}, 0});
+        }
+    }
+
+    for (auto &poly : m_polygons) {
+        for (size_t i = 0; i < poly.rings.size(); ++i) {
+            auto &ring = m_rings[poly.rings[i]];
+            normalize_ring(ring, i == 0);
+            double const area = proj ? ring_tile_area(ring, proj) : area2[poly.rings[i]] / 2;
+            poly.area += i == 0 ? area : -area;
+        }
+        std::sort(poly.rings.begin() + 1, poly.rings.end(), [&](size_t a, size_t b) {
+            return compare_rings(m_rings[a], m_rings[b]) > 0;
+        });
+    }
+
+    return true;
+}
+
+bool ring_assembler_t::assemble_ring(const nodelist_t &nodes, const reprojection *proj)
+{
+    m_lines.clear();
+    m_rings.clear();
+    m_polygons.clear();
+
+    nodelist_t ring;
+    ring.reserve(nodes.size());
+    for (auto const &n : nodes) {
+        if (std::isnan(n.lon) || std::isnan(n.lat)) {
+            return false;
+        }
+        if (ring.empty() || !same_location(ring.back(), n)) {
+            ring.push_back(n);
+        }
+    }
+
+    if (ring.size() < 4 || !same_location(ring.front(), ring.back()) ||
+        ring_signed_area2(ring) == 0) {
+        return false;
+    }
+
+    m_rings.push_back(std::move(ring));
+    if (!rings_are_clean(m_rings)) {
+        return false;
+    }
+
+    // repeated nodes are only left out for the checks, GEOS keeps them
+    // in the polygon
+    m_rings[0] = nodes;
+    auto &shell = m_rings[0];
+    normalize_ring(shell, true);
+    double const area = proj ? ring_tile_area(shell, proj) : std::fabs(ring_signed_area2(shell)) / 2;
+    m_polygons.push_back(polygon_t{{0}, area});
+
+    return true;
+}
+
+void ring_assembler_t::write_polygon(std::string &out, const polygon_t &poly) const
+{
+    wkb_writer_t writer(out);
+    writer.header(wkb_writer_t::wkb_polygon);
+    writer.count(poly.rings.size());
+    for (auto r : poly.rings) {
+        writer.points(m_rings[r]);
+    }
+}
+
+std::string ring_assembler_t::polygon_wkb(size_t n) const
+{
+    std::string wkb;
+    write_polygon(wkb, m_polygons[n]);
+    return wkb;
+}
+
+std::string ring_assembler_t::multipolygon_wkb() const
+{
+    // polygons in the order geos::geom::GeometryCollection::normalize()
+    // puts them in
+    std::vector<const polygon_t *> polys;
+    for (auto const &poly : m_polygons) {
+        polys.push_back(&poly);
+    }
+    std::sort(polys.begin(), polys.end(), [&](const polygon_t *a, const polygon_t *b) {
+        return compare_rings(m_rings[a->rings[0]], m_rings[b->rings[0]]) > 0;
+    });
+
+    std::string wkb;
+    wkb_writer_t writer(wkb);
+    writer.header(wkb_writer_t::wkb_multi_polygon);
+    writer.count(polys.size());
+    for (auto const *poly : polys) {
+        write_polygon(wkb, *poly);
+    }
+    return wkb;
+}
@@ -0,0 +1,75 @@
+#ifndef RING_ASSEMBLER_HPP
+#define RING_ASSEMBLER_HPP
+
+#include "osmtypes.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class reprojection;
+
+/**
+ * Assembles the member ways of a relation into lines and polygons
+ * without going through GEOS.
+ *
+ * Ways are joined where they end at the same location, following the
+ * rules of the GEOS LineMerger: only at locations where exactly two ways
+ * end. The closed rings are then nested, a ring inside an odd number of
+ * other rings being a hole of the smallest one around it.
+ *
+ * Only clean rings are assembled here, which neither cross nor touch
+ * each other or themselves. Anything else is left to GEOS, which can
+ * repair it.
+ */
+class ring_assembler_t
+{
+public:
+    struct polygon_t
+    {
+        /// Rings of the polygon, the shell first.
+        std::vector<size_t> rings;
+        double area;
+    };
+
+    /**
+     * Join the lines in xnodes at the ends they share. Returns false if
+     * there are invalid locations, which cannot be handled here.
+     */
+    bool merge(const multinodelist_t &xnodes);
+
+    /**
+     * Nest the closed lines into polygons. Returns false if the rings
+     * are not clean. Areas are computed in the tile projection of proj
+     * if it is given.
+     */
+    bool assemble(const reprojection *proj = nullptr);
+
+    /**
+     * Take the closed way in nodes as the shell of the only polygon,
+     * instead of merge() and assemble(). Returns false if it is not a
+     * clean ring. Repeated nodes are kept in the ring.
+     */
+    bool assemble_ring(const nodelist_t &nodes, const reprojection *proj = nullptr);
+
+    /// Joined lines, without the rings once assemble() has run.
+    const multinodelist_t &lines() const { return m_lines; }
+
+    /// Polygons, the largest first.
+    const std::vector<polygon_t> &polygons() const { return m_polygons; }
+
+    /// Hex encoded WKB of polygon n.
+    std::string polygon_wkb(size_t n) const;
+
+    /// Hex encoded WKB of a multipolygon made of all polygons.
+    std::string multipolygon_wkb() const;
+
+private:
+    void write_polygon(std::string &out, const polygon_t &poly) const;
+
+    multinodelist_t m_lines;
+    multinodelist_t m_rings;
+    std::vector<polygon_t> m_polygons;
+};
+
+#endif // RING_ASSEMBLER_HPP
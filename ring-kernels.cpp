@@ -0,0 +1,113 @@
+#include "ring-kernels.hpp"
+#include "reprojection.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/// Partial results kept apart in the loops below.
+size_t const lanes = 4;
+
+/**
+ * Twice the signed area the line through the points sweeps around the
+ * origin (x0, y0). Going round a closed ring this is the shoelace formula.
+ */
+double swept_area2(const osmNode *points, size_t count, double x0, double y0)
+{
+    double acc[lanes] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + lanes < count; i += lanes) {
+        for (size_t k = 0; k < lanes; ++k) {
+            auto const &a = points[i + k];
+            auto const &b = points[i + k + 1];
+            acc[k] += (a.lon - x0) * (b.lat - y0) - (b.lon - x0) * (a.lat - y0);
+        }
+    }
+
+    double sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i + 1 < count; ++i) {
+        auto const &a = points[i];
+        auto const &b = points[i + 1];
+        sum += (a.lon - x0) * (b.lat - y0) - (b.lon - x0) * (a.lat - y0);
+    }
+    return sum;
+}
+
+} // anonymous namespace
+
+double ring_signed_area2(const osmNode *points, size_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    return swept_area2(points, count, points[0].lon, points[0].lat);
+}
+
+double ring_tile_area(const osmNode *points, size_t count, const reprojection *proj)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    if (proj->target_srs() == PROJ_SPHERE_MERC) {
+        return std::fabs(ring_signed_area2(points, count)) / 2;
+    }
+
+    // each block starts with the last point of the one before
+    size_t const block = 256;
+    osmNode tile[block + 1];
+    size_t carry = 0;
+    double x0 = 0, y0 = 0, sum = 0;
+    for (size_t done = 0; done < count;) {
+        size_t const n = std::min(block, count - done);
+        std::copy(points + done, points + done + n, tile + carry);
+        proj->target_to_tile_batch(tile + carry, n);
+        if (done == 0) {
+            x0 = tile[0].lon;
+            y0 = tile[0].lat;
+        }
+        sum += swept_area2(tile, carry + n, x0, y0);
+
+        tile[0] = tile[carry + n - 1];
+        carry = 1;
+        done += n;
+    }
+
+    return std::fabs(sum) / 2;
+}
+
+box_index_t::box_t ring_box(const osmNode *points, size_t count)
+{
+    double minx[lanes], miny[lanes], maxx[lanes], maxy[lanes];
+    for (size_t k = 0; k < lanes; ++k) {
+        minx[k] = maxx[k] = points[0].lon;
+        miny[k] = maxy[k] = points[0].lat;
+    }
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        for (size_t k = 0; k < lanes; ++k) {
+            auto const &p = points[i + k];
+            minx[k] = std::min(minx[k], p.lon);
+            maxx[k] = std::max(maxx[k], p.lon);
+            miny[k] = std::min(miny[k], p.lat);
+            maxy[k] = std::max(maxy[k], p.lat);
+        }
+    }
+    for (; i < count; ++i) {
+        minx[0] = std::min(minx[0], points[i].lon);
+        maxx[0] = std::max(maxx[0], points[i].lon);
+        miny[0] = std::min(miny[0], points[i].lat);
+        maxy[0] = std::max(maxy[0], points[i].lat);
+    }
+
+    box_index_t::box_t box{minx[0], miny[0], maxx[0], maxy[0]};
+    for (size_t k = 1; k < lanes; ++k) {
+        box.minx = std::min(box.minx, minx[k]);
+        box.miny = std::min(box.miny, miny[k]);
+        box.maxx = std::max(box.maxx, maxx[k]);
+        box.maxy = std::max(box.maxy, maxy[k]);
+    }
+    return box;
+}
@@ -0,0 +1,51 @@
+#ifndef RING_KERNELS_HPP
+#define RING_KERNELS_HPP
+
+#include "box-index.hpp"
+#include "osmtypes.hpp"
+
+#include <cstddef>
+
+class reprojection;
+
+/*
+ * Arithmetic over the points of closed rings, kept in plain arrays. The
+ * loops keep several partial results, so that the compiler can turn them
+ * into vector instructions.
+ */
+
+/// Twice the area of a closed ring, positive if it is counterclockwise.
+double ring_signed_area2(const osmNode *points, size_t count);
+
+inline double ring_signed_area2(const nodelist_t &ring)
+{
+    return ring_signed_area2(ring.data(), ring.size());
+}
+
+/// Whether a closed ring runs counterclockwise.
+inline bool ring_is_ccw(const nodelist_t &ring)
+{
+    return ring_signed_area2(ring) > 0;
+}
+
+/**
+ * Area of a closed ring in target coordinates, measured in the tile
+ * projection. The points are converted block by block as the area is
+ * summed up, without copying the whole ring.
+ */
+double ring_tile_area(const osmNode *points, size_t count, const reprojection *proj);
+
+inline double ring_tile_area(const nodelist_t &ring, const reprojection *proj)
+{
+    return ring_tile_area(ring.data(), ring.size(), proj);
+}
+
+/// Bounding box of a non-empty list of points.
+box_index_t::box_t ring_box(const osmNode *points, size_t count);
+
+inline box_index_t::box_t ring_box(const nodelist_t &ring)
+{
+    return ring_box(ring.data(), ring.size());
+}
+
+#endif // RING_KERNELS_HPP
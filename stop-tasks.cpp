@@ -0,0 +1,126 @@
+#include "stop-tasks.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+stop_task_runner_t::stop_task_runner_t(size_t max_parallel)
+: m_max_parallel(max_parallel), m_start(std::chrono::steady_clock::now()),
+  m_next(0), m_running_threads(0), m_max_threads(0), m_failed(false)
+{}
+
+stop_task_runner_t::~stop_task_runner_t()
+{
+    // only happens without finish() when something else went wrong,
+    // don't start anything new then
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = true;
+    }
+    join();
+}
+
+void stop_task_runner_t::add(const stop_task_t &task)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(task);
+    m_seconds.push_back(0.0);
+
+    // threads finish when they run out of tasks, so start a new one
+    // whenever there is room
+    if (m_max_parallel == 0 || m_running_threads < m_max_parallel) {
+        ++m_running_threads;
+        m_max_threads = std::max(m_max_threads, m_running_threads);
+        m_threads.emplace_back(&stop_task_runner_t::work, this);
+    }
+}
+
+void stop_task_runner_t::add(const stop_tasks_t &tasks)
+{
+    for (auto const &task : tasks) {
+        add(task);
+    }
+}
+
+void stop_task_runner_t::work()
+{
+    for (;;) {
+        size_t idx;
+        const stop_task_t *task;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_failed || m_next >= m_tasks.size()) {
+                --m_running_threads;
+                return;
+            }
+            idx = m_next++;
+            // the deque does not move its elements when new tasks are added
+            task = &m_tasks[idx];
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        try {
+            task->run();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_failed) {
+                m_failed = true;
+                m_error = std::current_exception();
+            }
+            --m_running_threads;
+            return;
+        }
+        auto const end = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_seconds[idx] = std::chrono::duration<double>(end - start).count();
+    }
+}
+
+void stop_task_runner_t::join()
+{
+    // no threads are added anymore, the vector can be used unlocked
+    for (auto &t : m_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+void stop_task_runner_t::finish()
+{
+    join();
+
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+
+    if (m_tasks.empty()) {
+        return;
+    }
+
+    auto const end = std::chrono::steady_clock::now();
+
+    // report the slowest tasks first
+    std::vector<size_t> order(m_tasks.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return m_seconds[a] > m_seconds[b];
+    });
+
+    fprintf(stderr, "\nFinished %zu tasks using %zu threads in %.0fs:\n",
+            m_tasks.size(), m_max_threads,
+            std::chrono::duration<double>(end - m_start).count());
+    for (auto const idx : order) {
+        fprintf(stderr, "  %-40s %8.0fs\n", m_tasks[idx].name.c_str(),
+                m_seconds[idx]);
+    }
+}
+
+void run_stop_tasks(const stop_tasks_t &tasks, size_t max_parallel)
+{
+    stop_task_runner_t runner(max_parallel);
+    runner.add(tasks);
+    runner.finish();
+}
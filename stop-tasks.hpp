@@ -0,0 +1,83 @@
+#ifndef STOP_TASKS_H
+#define STOP_TASKS_H
+
+#include <boost/noncopyable.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A piece of work needed to finish an import, like clustering and indexing
+ * a single table. The tasks of the middle and all outputs are collected
+ * and then run together, so that independent tables are worked on at the
+ * same time on their own database connections.
+ */
+struct stop_task_t {
+    stop_task_t(const std::string &name_, const std::function<void()> &run_)
+    : name(name_), run(run_) {}
+
+    std::string name; ///< name shown in the timing report
+    std::function<void()> run;
+};
+
+typedef std::vector<stop_task_t> stop_tasks_t;
+
+/**
+ * Runs tasks in the background as they are added, with at most
+ * max_parallel of them at the same time (0 for no limit). Tasks can be
+ * added while others are already running, so that work which only needs
+ * part of the import to be done can start early.
+ *
+ * If a task throws, no further tasks are started and finish() rethrows
+ * the first exception once the running tasks are done.
+ */
+class stop_task_runner_t : public boost::noncopyable
+{
+public:
+    explicit stop_task_runner_t(size_t max_parallel);
+    ~stop_task_runner_t();
+
+    void add(const stop_task_t &task);
+    void add(const stop_tasks_t &tasks);
+
+    /// Wait for all tasks and print how long each of them took.
+    void finish();
+
+private:
+    void work();
+    void join();
+
+    size_t m_max_parallel;
+    std::chrono::steady_clock::time_point m_start;
+
+    std::mutex m_mutex;
+    // tasks and their run times in the order they were added, the tasks
+    // from m_next on have not been started yet
+    std::deque<stop_task_t> m_tasks;
+    std::deque<double> m_seconds;
+    size_t m_next;
+
+    std::vector<std::thread> m_threads;
+    size_t m_running_threads;
+    size_t m_max_threads;
+    bool m_failed;
+    std::exception_ptr m_error;
+};
+
+/**
+ * Run all tasks with at most max_parallel of them at the same time
+ * (0 to start all at once) and print how long each of them took.
+ *
+ * If a task throws, no further tasks are started and the first exception
+ * is rethrown once the running tasks are finished.
+ */
+void run_stop_tasks(const stop_tasks_t &tasks, size_t max_parallel);
+
+#endif
@@ -0,0 +1,160 @@
+#include "string-table.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+// FNV-1a
+size_t hash_string(const char *str, size_t len)
+{
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(str[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// stands for the string being looked up in add()
+const string_table_t::handle_t candidate = UINT32_MAX;
+
+} // anonymous namespace
+
+/**
+ * Part of the index from strings to their handles. The set only holds
+ * handles, the string looked up is found through the candidate handle.
+ */
+struct string_table_t::shard_t
+{
+    struct hash_t {
+        const shard_t *shard;
+        size_t operator()(handle_t handle) const
+        {
+            size_t len;
+            const char *str = shard->data(handle, &len);
+            return hash_string(str, len);
+        }
+    };
+
+    struct equal_t {
+        const shard_t *shard;
+        bool operator()(handle_t a, handle_t b) const
+        {
+            size_t len_a, len_b;
+            const char *str_a = shard->data(a, &len_a);
+            const char *str_b = shard->data(b, &len_b);
+            return len_a == len_b && memcmp(str_a, str_b, len_a) == 0;
+        }
+    };
+
+    shard_t()
+    : table(nullptr), index(0, hash_t{this}, equal_t{this}),
+      candidate_str(nullptr), candidate_len(0)
+    {}
+
+    const char *data(handle_t handle, size_t *len) const
+    {
+        if (handle == candidate) {
+            *len = candidate_len;
+            return candidate_str;
+        }
+        return table->data(handle, len);
+    }
+
+    const string_table_t *table;
+    std::mutex mutex;
+    std::unordered_set<handle_t, hash_t, equal_t> index;
+    const char *candidate_str;
+    size_t candidate_len;
+};
+
+string_table_t::string_table_t()
+: m_chunks(new std::atomic<const char **>[max_chunks]),
+  m_shards(new shard_t[num_shards]), m_count(0)
+{
+    for (size_t i = 0; i < max_chunks; ++i) {
+        m_chunks[i] = nullptr;
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+        m_shards[i].table = this;
+    }
+}
+
+string_table_t::~string_table_t()
+{
+    clear();
+}
+
+const char *string_table_t::data(handle_t handle, size_t *len) const
+{
+    const char **chunk = m_chunks[handle >> chunk_shift].load(std::memory_order_acquire);
+    const char *entry = chunk[handle & (chunk_size - 1)];
+    uint32_t entry_len;
+    memcpy(&entry_len, entry, sizeof(entry_len));
+    *len = entry_len;
+    return entry + sizeof(entry_len);
+}
+
+string_table_t::handle_t string_table_t::add(const char *str, size_t len)
+{
+    shard_t &shard = m_shards[hash_string(str, len) % num_shards];
+    std::lock_guard<std::mutex> shard_lock(shard.mutex);
+
+    shard.candidate_str = str;
+    shard.candidate_len = len;
+    auto const it = shard.index.find(candidate);
+    if (it != shard.index.end()) {
+        return *it;
+    }
+
+    handle_t handle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_count >= candidate) {
+            throw std::runtime_error("Too many different strings.\n");
+        }
+        handle = m_count;
+
+        uint32_t const entry_len = len;
+        char *entry = m_arena.at(m_arena.alloc(sizeof(entry_len) + len));
+        memcpy(entry, &entry_len, sizeof(entry_len));
+        memcpy(entry + sizeof(entry_len), str, len);
+
+        auto &slot = m_chunks[handle >> chunk_shift];
+        const char **chunk = slot.load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new const char *[chunk_size];
+            slot.store(chunk, std::memory_order_release);
+        }
+        chunk[handle & (chunk_size - 1)] = entry;
+        ++m_count;
+    }
+
+    shard.index.insert(handle);
+    return handle;
+}
+
+size_t string_table_t::allocated() const
+{
+    size_t chunks = 0;
+    for (size_t i = 0; i < max_chunks; ++i) {
+        if (m_chunks[i].load()) {
+            ++chunks;
+        }
+    }
+    return m_arena.allocated() + chunks * chunk_size * sizeof(const char *) +
+           m_count * (sizeof(handle_t) + 2 * sizeof(void *));
+}
+
+void string_table_t::clear()
+{
+    for (size_t i = 0; i < num_shards; ++i) {
+        m_shards[i].index.clear();
+    }
+    for (size_t i = 0; i < max_chunks; ++i) {
+        delete[] m_chunks[i].exchange(nullptr);
+    }
+    m_arena.clear();
+    m_count = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef STRING_TABLE_HPP
+#define STRING_TABLE_HPP
+
+#include "arena.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * Set of strings, each stored once and referred to by a 32 bit handle,
+ * for things that repeat a lot, like the keys and values of tags.
+ *
+ * Strings can be added from several threads at once, the index is split
+ * into shards with a lock each. Getting the string of a handle takes no
+ * lock, strings never move once added.
+ */
+class string_table_t : public boost::noncopyable
+{
+public:
+    typedef uint32_t handle_t;
+
+    string_table_t();
+    ~string_table_t();
+
+    /// Handle of the string, which is added if it is new.
+    handle_t add(const char *str, size_t len);
+    handle_t add(const std::string &str) { return add(str.data(), str.size()); }
+
+    /// Characters of the string of a handle, their number goes to len.
+    const char *data(handle_t handle, size_t *len) const;
+
+    std::string get(handle_t handle) const
+    {
+        size_t len;
+        const char *str = data(handle, &len);
+        return std::string(str, len);
+    }
+
+    /// Number of strings.
+    size_t size() const { return m_count; }
+
+    /// Bytes used for the strings and their index.
+    size_t allocated() const;
+
+    /// Remove all strings. Must not run at the same time as anything else.
+    void clear();
+
+private:
+    struct shard_t;
+
+    static const size_t num_shards = 64;
+    static const size_t chunk_shift = 20;
+    static const size_t chunk_size = size_t(1) << chunk_shift;
+    static const size_t max_chunks = size_t(1) << (32 - chunk_shift);
+
+    // where the strings are, in chunks allocated as needed
+    std::unique_ptr<std::atomic<const char **>[]> m_chunks;
+    std::unique_ptr<shard_t[]> m_shards;
+
+    // the arena and the number of strings are changed under this lock
+    std::mutex m_mutex;
+    arena_t m_arena;
+    std::atomic<size_t> m_count;
+};
+
+#endif // STRING_TABLE_HPP
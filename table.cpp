@@ -14,18 +14,117 @@ typedef boost::format fmt;
 
 #define BUFFER_SEND_SIZE 1024
 
+namespace {
+
+using pgsql_binary::put_int16;
+using pgsql_binary::put_int32;
+using pgsql_binary::put_int64;
+using pgsql_binary::put_float4;
+using pgsql_binary::put_float8;
+using pgsql_binary::reserve_int32;
+using pgsql_binary::set_int32;
+using pgsql_binary::end_field;
+using pgsql_binary::put_null;
+
+//EWKB flag telling that the geometry type is followed by an srid
+const uint32_t ewkb_srid_flag = 0x20000000;
+
+//a length-prefixed string as used inside binary hstores
+void put_hstore_string(string &dst, const char *str, size_t len)
+{
+    put_int32(dst, len);
+    dst.append(str, len);
+}
+
+int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// For integers we take the first number, or the average if it's a-b
+bool parse_int4(const string &value, int &result)
+{
+    int from, to;
+    int items = sscanf(value.c_str(), "%d-%d", &from, &to);
+    if (items == 1)
+        result = from;
+    else if (items == 2)
+        result = (from + to) / 2;
+    else
+        return false;
+    return true;
+}
+
+/* try to "repair" real values as follows:
+ * assume "," to be a decimal mark which need to be replaced by "."
+ * like int4 take the first number, or the average if it's a-b
+ * assume SI unit (meters)
+ * convert feet to meters (1 foot = 0.3048 meters)
+ * reject anything else
+ */
+bool parse_real(const string &value, float &result)
+{
+    string escaped(value);
+    std::replace(escaped.begin(), escaped.end(), ',', '.');
+
+    float from, to;
+    int items = sscanf(escaped.c_str(), "%f-%f", &from, &to);
+    bool feet = escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0;
+    if (items == 1)
+    {
+        if (feet)
+            from *= 0.3048;
+        result = from;
+    }
+    else if (items == 2)
+    {
+        if (feet)
+        {
+            from *= 0.3048;
+            to *= 0.3048;
+        }
+        result = (from + to) / 2;
+    }
+    else
+        return false;
+    return true;
+}
+
+} // anonymous namespace
+
 
 table_t::table_t(const string& conninfo, const string& name, const string& type, const columns_t& columns, const hstores_t& hstore_columns,
     const int srid, const bool append, const bool slim, const bool drop_temp, const int hstore_mode,
-    const bool enable_hstore_index, const boost::optional<string>& table_space, const boost::optional<string>& table_space_index) :
+    const bool enable_hstore_index, const boost::optional<string>& table_space, const boost::optional<string>& table_space_index,
+    const bool copy_binary) :
     conninfo(conninfo), name(name), type(type), sql_conn(nullptr), copyMode(false), srid((fmt("%1%") % srid).str()),
     append(append), slim(slim), drop_temp(drop_temp), hstore_mode(hstore_mode), enable_hstore_index(enable_hstore_index),
-    columns(columns), hstore_columns(hstore_columns), table_space(table_space), table_space_index(table_space_index)
+    columns(columns), hstore_columns(hstore_columns), table_space(table_space), table_space_index(table_space_index),
+    copy_binary(copy_binary), binary_srid(srid)
 {
     //if we dont have any columns
     if(columns.size() == 0 && hstore_mode != HSTORE_ALL)
         throw std::runtime_error((fmt("No columns provided for table %1%") % name).str());
 
+    //binary COPY needs to know the wire format of each column, other types
+    //are left to postgres to parse from text
+    if (copy_binary) {
+        for(columns_t::const_iterator column = columns.begin(); column != columns.end(); ++column) {
+            if (column->second != "text" && column->second != "int4" && column->second != "real") {
+                fprintf(stderr, "Column \"%s\" of %s has type %s, using text COPY for this table.\n",
+                        column->first.c_str(), name.c_str(), column->second.c_str());
+                this->copy_binary = false;
+                break;
+            }
+        }
+    }
+
     //nothing to copy to start with
     buffer = "";
 
@@ -39,7 +138,8 @@ table_t::table_t(const table_t& other):
     conninfo(other.conninfo), name(other.name), type(other.type), sql_conn(nullptr), copyMode(false), buffer(), srid(other.srid),
     append(other.append), slim(other.slim), drop_temp(other.drop_temp), hstore_mode(other.hstore_mode), enable_hstore_index(other.enable_hstore_index),
     columns(other.columns), hstore_columns(other.hstore_columns), copystr(other.copystr), table_space(other.table_space),
-    table_space_index(other.table_space_index), single_fmt(other.single_fmt), point_fmt(other.point_fmt), del_fmt(other.del_fmt)
+    table_space_index(other.table_space_index), copy_binary(other.copy_binary), binary_srid(other.binary_srid),
+    single_fmt(other.single_fmt), point_fmt(other.point_fmt), del_fmt(other.del_fmt)
 {
     // if the other table has already started, then we want to execute
     // the same stuff to get into the same state. but if it hasn't, then
@@ -50,8 +150,7 @@ table_t::table_t(const table_t& other):
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("PREPARE get_wkb (" POSTGRES_OSMID_TYPE ") AS SELECT way FROM %1% WHERE osm_id = $1") % name).str());
         //start the copy
         begin();
-        pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
-        copyMode = true;
+        start_copy();
     }
 }
 
@@ -200,9 +299,9 @@ void table_t::start()
         cols += "way";
 
     //get into copy mode
-    copystr = (fmt("COPY %1% (%2%) FROM STDIN") % name % cols).str();
-    pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
-    copyMode = true;
+    copystr = (fmt("COPY %1% (%2%) FROM STDIN%3%") % name % cols %
+               (copy_binary ? " WITH (FORMAT binary)" : "")).str();
+    start_copy();
 }
 
 void table_t::stop()
@@ -256,6 +355,15 @@ void table_t::stop()
     fprintf(stderr, "Completed %s\n", name.c_str());
 }
 
+void table_t::start_copy()
+{
+    pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
+    copyMode = true;
+
+    if (copy_binary)
+        pgsql_binary::put_copy_header(buffer);
+}
+
 void table_t::stop_copy()
 {
     PGresult* res;
@@ -264,8 +372,12 @@ void table_t::stop_copy()
     //we werent copying anyway
     if(!copyMode)
         return;
+
+    if (copy_binary)
+        pgsql_binary::put_copy_trailer(buffer);
+
     //if there is stuff left over in the copy buffer send it offand copy it before we stop
-    else if(buffer.length() != 0)
+    if(buffer.length() != 0)
     {
         pgsql_CopyData(name.c_str(), sql_conn, buffer);
         buffer.clear();
@@ -300,40 +412,42 @@ void table_t::delete_row(const osmid_t id)
 
 void table_t::write_row(const osmid_t id, const taglist_t &tags, const std::string &geom)
 {
-    //add the osm id
-    buffer.append((single_fmt % id).str());
-    buffer.push_back('\t');
-
-    // used to remember which columns have been written out already.
-    std::vector<bool> used;
-
-    if (hstore_mode != HSTORE_NONE)
-        used.assign(tags.size(), false);
-
-    //get the regular columns' values
-    write_columns(tags, buffer, hstore_mode == HSTORE_NORM?&used:nullptr);
-
-    //get the hstore columns' values
-    write_hstore_columns(tags, buffer);
-
-    //get the key value pairs for the tags column
-    if (hstore_mode != HSTORE_NONE)
-        write_tags_column(tags, buffer, used);
-
-    //give the geometry an srid
-    buffer.append("SRID=");
-    buffer.append(srid);
-    buffer.push_back(';');
-    //add the geometry
-    buffer.append(geom);
-    //we need \n because we are copying from stdin
-    buffer.push_back('\n');
-
     //tell the db we are copying if for some reason we arent already
     if (!copyMode)
+        start_copy();
+
+    if (copy_binary)
+        write_row_binary(id, tags, geom);
+    else
     {
-        pgsql_exec_simple(sql_conn, PGRES_COPY_IN, copystr);
-        copyMode = true;
+        //add the osm id
+        buffer.append((single_fmt % id).str());
+        buffer.push_back('\t');
+
+        // used to remember which columns have been written out already.
+        std::vector<bool> used;
+
+        if (hstore_mode != HSTORE_NONE)
+            used.assign(tags.size(), false);
+
+        //get the regular columns' values
+        write_columns(tags, buffer, hstore_mode == HSTORE_NORM?&used:nullptr);
+
+        //get the hstore columns' values
+        write_hstore_columns(tags, buffer);
+
+        //get the key value pairs for the tags column
+        if (hstore_mode != HSTORE_NONE)
+            write_tags_column(tags, buffer, used);
+
+        //give the geometry an srid
+        buffer.append("SRID=");
+        buffer.append(srid);
+        buffer.push_back(';');
+        //add the geometry
+        buffer.append(geom);
+        //we need \n because we are copying from stdin
+        buffer.push_back('\n');
     }
 
     //send all the data to postgres
@@ -461,51 +575,194 @@ void table_t::escape4hstore(const char *src, string& dst)
 /* Escape data appropriate to the type */
 void table_t::escape_type(const string &value, const string &type, string& dst) {
 
-    // For integers we take the first number, or the average if it's a-b
     if (type == "int4") {
-        int from, to;
-        int items = sscanf(value.c_str(), "%d-%d", &from, &to);
-        if (items == 1)
-            dst.append((single_fmt % from).str());
-        else if (items == 2)
-            dst.append((single_fmt % ((from + to) / 2)).str());
+        int result;
+        if (parse_int4(value, result))
+            dst.append((single_fmt % result).str());
         else
             dst.append("\\N");
     }
-        /* try to "repair" real values as follows:
-         * assume "," to be a decimal mark which need to be replaced by "."
-         * like int4 take the first number, or the average if it's a-b
-         * assume SI unit (meters)
-         * convert feet to meters (1 foot = 0.3048 meters)
-         * reject anything else
-         */
     else if (type == "real")
     {
-        string escaped(value);
-        std::replace(escaped.begin(), escaped.end(), ',', '.');
+        float result;
+        if (parse_real(value, result))
+            dst.append((single_fmt % result).str());
+        else
+            dst.append("\\N");
+    }//just a string
+    else
+        escape(value, dst);
+}
 
-        float from, to;
-        int items = sscanf(escaped.c_str(), "%f-%f", &from, &to);
-        if (items == 1)
-        {
-            if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0)
-                from *= 0.3048;
-            dst.append((single_fmt % from).str());
+/* Write a row in binary COPY format: a field count followed by the
+ * length-prefixed fields, with no escaping needed anywhere. */
+void table_t::write_row_binary(const osmid_t id, const taglist_t &tags, const std::string &geom)
+{
+    put_int16(buffer, 2 + columns.size() + hstore_columns.size() +
+                      (hstore_mode != HSTORE_NONE ? 1 : 0));
+
+    //add the osm id
+    put_int32(buffer, 8);
+    put_int64(buffer, id);
+
+    // used to remember which columns have been written out already.
+    std::vector<bool> used;
+
+    if (hstore_mode != HSTORE_NONE)
+        used.assign(tags.size(), false);
+
+    write_columns_binary(tags, buffer, hstore_mode == HSTORE_NORM?&used:nullptr);
+    write_hstore_columns_binary(tags, buffer);
+    if (hstore_mode != HSTORE_NONE)
+        write_tags_column_binary(tags, buffer, used);
+    write_geometry_binary(geom, buffer);
+}
+
+void table_t::write_columns_binary(const taglist_t &tags, string& values, std::vector<bool> *used)
+{
+    for(columns_t::const_iterator column = columns.begin(); column != columns.end(); ++column)
+    {
+        int idx = tags.indexof(column->first);
+        if (idx < 0) {
+            put_null(values);
+            continue;
+        }
+
+        if (used)
+            (*used)[idx] = true;
+
+        const string &value = tags[idx].value;
+        if (column->second == "int4") {
+            int result;
+            if (parse_int4(value, result)) {
+                put_int32(values, 4);
+                put_int32(values, result);
+            } else
+                put_null(values);
+        } else if (column->second == "real") {
+            float result;
+            if (parse_real(value, result)) {
+                put_int32(values, 4);
+                put_float4(values, result);
+            } else
+                put_null(values);
+        } else {
+            put_int32(values, value.size());
+            values.append(value);
         }
-        else if (items == 2)
+    }
+}
+
+void table_t::write_tags_column_binary(const taglist_t &tags, string& values,
+                                       const std::vector<bool> &used)
+{
+    size_t pos = reserve_int32(values);
+    size_t count_pos = reserve_int32(values);
+    int32_t count = 0;
+
+    for (size_t i = 0; i < tags.size(); ++i)
+    {
+        const tag_t& xtag = tags[i];
+        //skip z_order tag and keys which have their own column
+        if (used[i] || ("z_order" == xtag.key))
+            continue;
+
+        put_hstore_string(values, xtag.key.c_str(), xtag.key.size());
+        put_hstore_string(values, xtag.value.c_str(), xtag.value.size());
+        ++count;
+    }
+
+    //the tags column is an empty hstore rather than NULL when nothing is left
+    set_int32(values, count_pos, count);
+    end_field(values, pos);
+}
+
+void table_t::write_hstore_columns_binary(const taglist_t &tags, string& values)
+{
+    for(hstores_t::const_iterator hstore_column = hstore_columns.begin(); hstore_column != hstore_columns.end(); ++hstore_column)
+    {
+        size_t pos = reserve_int32(values);
+        size_t count_pos = reserve_int32(values);
+        int32_t count = 0;
+
+        for (taglist_t::const_iterator xtags = tags.begin(); xtags != tags.end(); ++xtags)
         {
-            if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0)
+            if(xtags->key.compare(0, hstore_column->size(), *hstore_column) == 0)
             {
-                from *= 0.3048;
-                to *= 0.3048;
+                put_hstore_string(values, xtags->key.c_str() + hstore_column->size(),
+                                  xtags->key.size() - hstore_column->size());
+                put_hstore_string(values, xtags->value.c_str(), xtags->value.size());
+                ++count;
             }
-            dst.append((single_fmt % ((from + to) / 2)).str());
         }
-        else
-            dst.append("\\N");
-    }//just a string
-    else
-        escape(value, dst);
+
+        //no matching tags means NULL
+        if (count == 0) {
+            values.resize(pos);
+            put_null(values);
+            continue;
+        }
+
+        set_int32(values, count_pos, count);
+        end_field(values, pos);
+    }
+}
+
+/* Geometries come either as hex encoded WKB or, for nodes, as a WKT
+ * point. Both are sent as EWKB carrying the srid of the table. */
+void table_t::write_geometry_binary(const string &geom, string& values)
+{
+    size_t pos = reserve_int32(values);
+
+    if (geom.compare(0, 6, "POINT(") == 0) {
+        double x, y;
+        if (sscanf(geom.c_str(), "POINT(%lf %lf)", &x, &y) != 2)
+            throw std::runtime_error((fmt("Invalid point geometry for %1%: %2%") % name % geom).str());
+        //big endian point with srid
+        values.push_back('\0');
+        put_int32(values, 1 | ewkb_srid_flag);
+        put_int32(values, binary_srid);
+        put_float8(values, x);
+        put_float8(values, y);
+        end_field(values, pos);
+        return;
+    }
+
+    if (geom.size() < 10 || geom.size() % 2 != 0)
+        throw std::runtime_error((fmt("Invalid WKB geometry for %1%") % name).str());
+
+    size_t wkb = values.size();
+    for (size_t i = 0; i < geom.size(); i += 2) {
+        int hi = hex_value(geom[i]);
+        int lo = hex_value(geom[i + 1]);
+        if (hi < 0 || lo < 0)
+            throw std::runtime_error((fmt("Invalid WKB geometry for %1%") % name).str());
+        values.push_back(char((hi << 4) | lo));
+    }
+
+    //set the srid in the header of the outermost geometry, keeping its byte order
+    const bool little_endian = values[wkb] == 1;
+    uint32_t geom_type = 0;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t byte = (unsigned char) values[wkb + 1 + i];
+        geom_type |= byte << (little_endian ? 8 * i : 24 - 8 * i);
+    }
+
+    string srid_bytes;
+    put_int32(srid_bytes, binary_srid);
+    if (little_endian)
+        std::reverse(srid_bytes.begin(), srid_bytes.end());
+
+    if (geom_type & ewkb_srid_flag) {
+        values.replace(wkb + 5, 4, srid_bytes);
+    } else {
+        geom_type |= ewkb_srid_flag;
+        for (int i = 0; i < 4; ++i)
+            values[wkb + 1 + i] = char((geom_type >> (little_endian ? 8 * i : 24 - 8 * i)) & 0xff);
+        values.insert(wkb + 5, srid_bytes);
+    }
+
+    end_field(values, pos);
 }
 
 table_t::wkb_reader table_t::get_wkb_reader(const osmid_t id)
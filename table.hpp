@@ -5,6 +5,7 @@
 #include "osmtypes.hpp"
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <utility>
@@ -21,7 +22,8 @@ class table_t
     public:
         table_t(const std::string& conninfo, const std::string& name, const std::string& type, const columns_t& columns, const hstores_t& hstore_columns, const int srid,
                 const bool append, const bool slim, const bool droptemp, const int hstore_mode, const bool enable_hstore_index,
-                const boost::optional<std::string>& table_space, const boost::optional<std::string>& table_space_index);
+                const boost::optional<std::string>& table_space, const boost::optional<std::string>& table_space_index,
+                const bool copy_binary = false);
         table_t(const table_t& other);
         ~table_t();
 
@@ -79,6 +81,7 @@ class table_t
 
     protected:
         void connect();
+        void start_copy();
         void stop_copy();
         void teardown();
 
@@ -87,6 +90,14 @@ class table_t
                                const std::vector<bool> &used);
         void write_hstore_columns(const taglist_t &tags, std::string& values);
 
+        //binary COPY counterparts of the above, see write_row
+        void write_row_binary(const osmid_t id, const taglist_t &tags, const std::string &geom);
+        void write_columns_binary(const taglist_t &tags, std::string& values, std::vector<bool> *used);
+        void write_tags_column_binary(const taglist_t &tags, std::string& values,
+                                      const std::vector<bool> &used);
+        void write_hstore_columns_binary(const taglist_t &tags, std::string& values);
+        void write_geometry_binary(const std::string &geom, std::string& values);
+
         void escape4hstore(const char *src, std::string& dst);
         void escape_type(const std::string &value, const std::string &type, std::string& dst);
 
@@ -107,6 +118,8 @@ class table_t
         std::string copystr;
         boost::optional<std::string> table_space;
         boost::optional<std::string> table_space_index;
+        bool copy_binary;
+        int32_t binary_srid;
 
         boost::format single_fmt, point_fmt, del_fmt;
 };
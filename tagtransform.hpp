@@ -23,6 +23,9 @@ public:
 	tagtransform(const options_t *options_);
 	~tagtransform();
 
+    /// Whether objects without tags are always filtered out.
+    bool filters_untagged() const { return !transform_method; }
+
     unsigned filter_node_tags(const taglist_t &tags, const export_list &exlist,
                               taglist_t &out_tags, bool strict = false);
     unsigned filter_way_tags(const taglist_t &tags, int *polygon, int *roads,
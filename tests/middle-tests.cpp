@@ -6,6 +6,7 @@
 #include <list>
 #include <tuple>
 
+#include "id-tracker.hpp"
 #include "osmtypes.hpp"
 #include "tests/middle-tests.hpp"
 
@@ -138,7 +139,7 @@ struct test_pending_processor : public middle_t::pending_processor {
         pending_ways.push_back(id);
     }
     virtual void process_ways() {
-        pending_ways.clear();
+        processed_ways.splice(processed_ways.end(), pending_ways);
     }
     virtual void enqueue_relations(osmid_t id) {
         pending_rels.push_back(id);
@@ -154,6 +155,7 @@ struct test_pending_processor : public middle_t::pending_processor {
     }
     std::list<osmid_t> pending_ways;
     std::list<osmid_t> pending_rels;
+    std::list<osmid_t> processed_ways;
 };
 
 int test_way_set(middle_t *mid)
@@ -172,8 +174,18 @@ int test_way_set(middle_t *mid)
     mid->nodes_set(nds[i], lat, lon, tags);
   }
 
-  // set the way
-  mid->ways_set(way_id, nds, tags);
+  // set the way, with tags that need escaping in text formats
+  taglist_t way_tags;
+  way_tags.push_back(tag_t("name", "a \"quoted\", {braced} \\ name\twith\ntabs"));
+  way_tags.push_back(tag_t("note", std::string(2000, 'x')));
+  mid->ways_set(way_id, nds, way_tags);
+
+  // and a second way sharing some of the nodes, and with a missing one
+  idlist_t nds2;
+  nds2.push_back(10);
+  nds2.push_back(11);
+  nds2.push_back(5);
+  mid->ways_set(way_id + 1, nds2, tags);
 
   // commit the setup data
   mid->commit();
@@ -197,6 +209,19 @@ int test_way_set(middle_t *mid)
               << xways[0] << " from middle.\n";
     return 1;
   }
+  if (xtags[0].size() != way_tags.size()) {
+    std::cerr << "ERROR: Way should have " << way_tags.size() << " tags, but got back "
+              << xtags[0].size() << " from middle.\n";
+    return 1;
+  }
+  for (size_t i = 0; i < way_tags.size(); ++i) {
+    if (xtags[0][i].key != way_tags[i].key || xtags[0][i].value != way_tags[i].value) {
+      std::cerr << "ERROR: Way tag " << way_tags[i].key << " should be '"
+                << way_tags[i].value << "', but got back '" << xtags[0][i].key
+                << "'='" << xtags[0][i].value << "' from middle.\n";
+      return 1;
+    }
+  }
   for (size_t i = 0; i < nds.size(); ++i) {
     if (xnodes[0][i].lon != lon) {
       std::cerr << "ERROR: Way node should have lon=" << lon << ", but got back "
@@ -210,6 +235,25 @@ int test_way_set(middle_t *mid)
     }
   }
 
+  // get both ways back in one go, asking for a missing way in between
+  ways.clear();
+  ways.push_back(way_id + 1);
+  ways.push_back(way_id + 100);
+  ways.push_back(way_id);
+  xways.clear();
+  xtags.clear();
+  xnodes.clear();
+  way_count = mid->ways_get_list(ways, xways, xtags, xnodes);
+  if (way_count != 2 || xways[0] != way_id + 1 || xways[1] != way_id) {
+    std::cerr << "ERROR: Unable to get list of two ways.\n";
+    return 1;
+  }
+  if (xnodes[0].size() != 2 || xnodes[1].size() != nds.size()) {
+    std::cerr << "ERROR: Ways should have 2 and " << nds.size() << " nodes, but got back "
+              << xnodes[0].size() << " and " << xnodes[1].size() << " from middle.\n";
+    return 1;
+  }
+
   // the way we just inserted should not be pending
   test_pending_processor tpp;
   mid->iterate_ways(tpp);
@@ -235,6 +279,84 @@ int test_way_set(middle_t *mid)
                     << slim->pending_count() << " from middle.\n";
           return 1;
       }
+
+      // several node changes are resolved together, a way using more
+      // than one of the nodes is pending only once
+      test_pending_processor tpp2;
+      slim->node_changed(nds[1]);
+      slim->node_changed(nds[9]);
+      slim->node_changed(nds[9]);
+      slim->node_changed(1000);
+      slim->iterate_ways(tpp2);
+      tpp2.processed_ways.remove(id_tracker::max());
+      tpp2.processed_ways.sort();
+      if (tpp2.processed_ways != std::list<osmid_t>{way_id, way_id + 1}) {
+          std::cerr << "ERROR: Was expecting both ways pending from node updates, but got "
+                    << tpp2.processed_ways.size() << " from middle.\n";
+          return 1;
+      }
+  }
+
+  return 0;
+}
+
+int test_relation_set(middle_t *mid)
+{
+  taglist_t tags;
+  tags.push_back(tag_t("type", "multipolygon"));
+
+  memberlist_t members;
+  members.push_back(member(OSMTYPE_WAY, 1, "outer"));
+  members.push_back(member(OSMTYPE_WAY, 2, "inner"));
+  members.push_back(member(OSMTYPE_NODE, 3, "label"));
+  mid->relations_set(1, members, tags);
+
+  memberlist_t members2;
+  members2.push_back(member(OSMTYPE_RELATION, 1, ""));
+  mid->relations_set(2, members2, taglist_t());
+
+  mid->commit();
+
+  memberlist_t xmembers;
+  taglist_t xtags;
+  if (!mid->relations_get(1, xmembers, xtags)) {
+    std::cerr << "ERROR: Unable to get relation.\n";
+    return 1;
+  }
+  if (xmembers.size() != members.size() || xtags.size() != tags.size()) {
+    std::cerr << "ERROR: Relation should have " << members.size() << " members and "
+              << tags.size() << " tags, but got back " << xmembers.size() << " and "
+              << xtags.size() << " from middle.\n";
+    return 1;
+  }
+
+  // get both relations back in one go, asking for a missing one in between
+  idlist_t ids, xids;
+  ids.push_back(2);
+  ids.push_back(100);
+  ids.push_back(1);
+  multimemberlist_t xmemberlists;
+  multitaglist_t xtaglists;
+  size_t rel_count = mid->relations_get_list(ids, xids, xmemberlists, xtaglists);
+  if (rel_count != 2 || xids.size() != 2 || xids[0] != 2 || xids[1] != 1) {
+    std::cerr << "ERROR: Unable to get list of two relations.\n";
+    return 1;
+  }
+  if (xmemberlists[0].size() != 1 || xmemberlists[0][0].type != OSMTYPE_RELATION ||
+      !xtaglists[0].empty()) {
+    std::cerr << "ERROR: Second relation came back wrong from middle.\n";
+    return 1;
+  }
+  for (size_t i = 0; i < members.size(); ++i) {
+    if (xmemberlists[1][i].type != members[i].type ||
+        xmemberlists[1][i].id != members[i].id ||
+        xmemberlists[1][i].role != members[i].role) {
+      std::cerr << "ERROR: Relation member " << i << " should be "
+                << members[i].id << " (" << members[i].role << "), but got back "
+                << xmemberlists[1][i].id << " (" << xmemberlists[1][i].role
+                << ") from middle.\n";
+      return 1;
+    }
   }
 
   return 0;
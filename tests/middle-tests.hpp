@@ -13,4 +13,8 @@ int test_nodes_comprehensive_set(middle_t *mid);
 // returns 0 on success.
 int test_way_set(middle_t *mid);
 
+// tests that relations can be set and retrieved, also several at once.
+// returns 0 on success.
+int test_relation_set(middle_t *mid);
+
 #endif /* TESTS_MIDDLE_TEST_HPP */
@@ -25,6 +25,9 @@ struct dummy_middle_t : public middle_t {
 
     void relations_set(osmid_t, const memberlist_t &, const taglist_t &) { }
     bool relations_get(osmid_t, memberlist_t &, taglist_t &) const { return 0; }
+    size_t relations_get_list(const idlist_t &, idlist_t &,
+                              multimemberlist_t &,
+                              multitaglist_t &) const { return 0; }
 
     void iterate_ways(pending_processor&) { }
     void iterate_relations(pending_processor&) { }
@@ -57,6 +60,9 @@ struct dummy_slim_middle_t : public slim_middle_t {
 
     void relations_set(osmid_t, const memberlist_t &, const taglist_t &) { }
     bool relations_get(osmid_t, memberlist_t &, taglist_t &) const { return 0; }
+    size_t relations_get_list(const idlist_t &, idlist_t &,
+                              multimemberlist_t &,
+                              multitaglist_t &) const { return 0; }
 
     void iterate_ways(pending_processor&) { }
     void iterate_relations(pending_processor&) { }
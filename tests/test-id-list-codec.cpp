@@ -0,0 +1,116 @@
+#include "id-list-codec.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+idlist_t round_trip(const idlist_t &ids)
+{
+    std::string encoded;
+    encode_id_list(ids, encoded);
+    idlist_t decoded;
+    decode_id_list(encoded.data(), encoded.size(), decoded);
+    return decoded;
+}
+
+void test_empty()
+{
+    std::string encoded;
+    encode_id_list(idlist_t(), encoded);
+    ASSERT_EQ(encoded.size(), 0);
+    ASSERT_EQ(round_trip(idlist_t()).size(), 0);
+}
+
+void test_round_trip()
+{
+    idlist_t ids = { 1, 2, 3, 2, 1000000000, 4, -5, 4, 4,
+                     osmid_t(1) << 40, -(osmid_t(1) << 40), 0 };
+    idlist_t decoded = round_trip(ids);
+    ASSERT_EQ(decoded.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(decoded[i], ids[i]);
+    }
+}
+
+// a way of consecutive nodes needs a byte per node after the first
+void test_consecutive_size()
+{
+    idlist_t ids;
+    for (osmid_t id = 4000000000; id < 4000001000; ++id) {
+        ids.push_back(id);
+    }
+    std::string encoded;
+    encode_id_list(ids, encoded);
+    ASSERT_EQ(encoded.size(), 5 + 999);
+    ASSERT_EQ(round_trip(ids) == ids, true);
+}
+
+void test_appends()
+{
+    std::string encoded = "x";
+    encode_id_list({ 7, 8 }, encoded);
+    ASSERT_EQ(encoded.size(), 3);
+
+    idlist_t decoded = { 1 };
+    decode_id_list(encoded.data() + 1, encoded.size() - 1, decoded);
+    ASSERT_EQ(decoded.size(), 3);
+    ASSERT_EQ(decoded[1], 7);
+    ASSERT_EQ(decoded[2], 8);
+}
+
+void test_malformed()
+{
+    idlist_t decoded;
+    bool thrown = false;
+    try {
+        decode_id_list("\x02\x80", 2, decoded);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    ASSERT_EQ(thrown, true);
+
+    thrown = false;
+    try {
+        decode_id_list("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 11, decoded);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    ASSERT_EQ(thrown, true);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_empty);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_consecutive_size);
+    RUN_TEST(test_appends);
+    RUN_TEST(test_malformed);
+
+    //passed
+    return 0;
+}
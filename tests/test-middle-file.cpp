@@ -0,0 +1,113 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <stdexcept>
+
+#include "osmtypes.hpp"
+#include "output-null.hpp"
+#include "options.hpp"
+#include "middle-file.hpp"
+
+#include "tests/middle-tests.hpp"
+#include "tests/common-cleanup.hpp"
+
+/* This is basically the same as test-middle-pgsql, but with the middle
+ * data in files instead of the database. */
+
+void run_tests(options_t options, const std::string cache_type) {
+  options.append = false;
+  options.create = true;
+  {
+    middle_file_t mid_file;
+    output_null_t out_test(&mid_file, options);
+
+    mid_file.start(&options);
+
+    if (test_node_set(&mid_file) != 0) { throw std::runtime_error("test_node_set failed with " + cache_type + " cache."); }
+
+    mid_file.commit();
+    mid_file.stop();
+  }
+  {
+    middle_file_t mid_file;
+    output_null_t out_test(&mid_file, options);
+
+    mid_file.start(&options);
+
+    if (test_nodes_comprehensive_set(&mid_file) != 0) { throw std::runtime_error("test_nodes_comprehensive_set failed with " + cache_type + " cache."); }
+
+    mid_file.commit();
+    mid_file.stop();
+  }
+  {
+    middle_file_t mid_file;
+    output_null_t out_test(&mid_file, options);
+
+    mid_file.start(&options);
+    mid_file.commit();
+    mid_file.stop();
+    // Switch to append mode because this tests updates
+    options.append = true;
+    options.create = false;
+    mid_file.start(&options);
+    if (test_way_set(&mid_file) != 0) { throw std::runtime_error("test_way_set failed with " + cache_type + " cache."); }
+
+    mid_file.commit();
+    mid_file.stop();
+  }
+  {
+    middle_file_t mid_file;
+    output_null_t out_test(&mid_file, options);
+
+    mid_file.start(&options);
+
+    if (test_relation_set(&mid_file) != 0) { throw std::runtime_error("test_relation_set failed with " + cache_type + " cache."); }
+
+    mid_file.commit();
+    mid_file.stop();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    options_t options;
+    options.scale = 10000000;
+    options.cache = 1;
+    options.num_procs = 1;
+    options.prefix = "test-middle-file";
+    options.slim = true;
+    options.middle_dir = std::string("tests");
+    options.flat_node_cache_enabled = true;
+    options.flat_node_file = std::string("tests/test-middle-file_nodes.cache");
+    cleanup::file flat_nodes(*options.flat_node_file);
+
+    options.alloc_chunkwise = ALLOC_SPARSE | ALLOC_DENSE; // what you get with optimized
+    run_tests(options, "optimized");
+
+    options.alloc_chunkwise = ALLOC_SPARSE;
+    run_tests(options, "sparse");
+
+    options.alloc_chunkwise = ALLOC_DENSE;
+    run_tests(options, "dense");
+
+    options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
+    run_tests(options, "chunk");
+
+    // remove the middle files
+    options.droptemp = true;
+    middle_file_t mid_file;
+    mid_file.start(&options);
+    mid_file.commit();
+    mid_file.stop();
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "UNKNOWN ERROR" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
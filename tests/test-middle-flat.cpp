@@ -6,6 +6,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <memory>
+#include <cmath>
 
 #include "osmtypes.hpp"
 #include "output-null.hpp"
@@ -52,6 +53,31 @@ void run_tests(options_t options, const std::string cache_type) {
     mid_pgsql.commit();
     mid_pgsql.stop();
   }
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+
+    if (test_node_set(&mid_pgsql) != 0) { throw std::runtime_error("test_node_set failed."); }
+
+    mid_pgsql.commit();
+
+    // After the commit, nodes are read through the instances handed
+    // out for pending processing, which share the flat node file.
+    {
+      std::shared_ptr<const middle_query_t> mid_instance = mid_pgsql.get_instance();
+      idlist_t ids;
+      ids.push_back(1234);
+      nodelist_t nodes;
+      if (mid_instance->nodes_get_list(nodes, ids) != 1) { throw std::runtime_error("Node not found through middle instance."); }
+      if (std::abs(nodes[0].lon - 12.3456789) > 1e-6 || std::abs(nodes[0].lat - 98.7654321) > 1e-6) {
+        throw std::runtime_error("Wrong node returned through middle instance.");
+      }
+    }
+
+    mid_pgsql.stop();
+  }
   /* This should work, but doesn't. More tests are needed that look at updates
      without the complication of ways.
   */
@@ -56,6 +56,17 @@ void run_tests(options_t options, const std::string cache_type) {
     mid_pgsql.start(&options);
     if (test_way_set(&mid_pgsql) != 0) { throw std::runtime_error("test_way_set failed."); }
 
+    mid_pgsql.commit();
+    mid_pgsql.stop();
+  }
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+
+    if (test_relation_set(&mid_pgsql) != 0) { throw std::runtime_error("test_relation_set failed."); }
+
     mid_pgsql.commit();
     mid_pgsql.stop();
   }
@@ -89,6 +100,14 @@ int main(int argc, char *argv[]) {
 
     options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
     run_tests(options, "chunk");
+
+    options.compact_way_nodes = true;
+    run_tests(options, "compact way nodes");
+
+    options.compact_way_nodes = false;
+    options.way_node_index_file = std::string("tests/test-middle-pgsql.way-nodes");
+    run_tests(options, "way node index");
+    unlink(options.way_node_index_file->c_str());
   } catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
     return 1;
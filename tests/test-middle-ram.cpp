@@ -43,6 +43,16 @@ void run_tests(const options_t options, const std::string cache_type) {
     mid_ram.commit();
     mid_ram.stop();
   }
+  {
+    middle_ram_t mid_ram;
+    output_null_t out_test(&mid_ram, options);
+
+    mid_ram.start(&options);
+
+    if (test_relation_set(&mid_ram) != 0) { throw std::runtime_error("test_relation_set failed with " + cache_type + " cache."); }
+    mid_ram.commit();
+    mid_ram.stop();
+  }
 }
 
 int main(int argc, char *argv[]) {
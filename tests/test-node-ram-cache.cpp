@@ -0,0 +1,214 @@
+#include "node-ram-cache.hpp"
+
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+const int scale = 10000000;
+const taglist_t no_tags;
+
+double test_lat(osmid_t id) { return (id % 1800) / 10.0 - 90.0; }
+double test_lon(osmid_t id) { return (id % 3600) / 10.0 - 180.0; }
+
+void assert_node(node_ram_cache &cache, osmid_t id, double lat, double lon)
+{
+    osmNode node;
+    ASSERT_EQ(cache.get(&node, id), 0);
+    ASSERT_EQ(std::abs(node.lat - lat) < 1e-6, true);
+    ASSERT_EQ(std::abs(node.lon - lon) < 1e-6, true);
+}
+
+void assert_no_node(node_ram_cache &cache, osmid_t id)
+{
+    osmNode node;
+    ASSERT_EQ(cache.get(&node, id), 1);
+}
+
+// ids with small, medium and very large gaps, so that the id differences
+// take up one to several bytes
+void test_sparse_scattered()
+{
+    node_ram_cache cache(ALLOC_SPARSE, 16, scale);
+
+    std::vector<osmid_t> ids;
+    osmid_t id = 1;
+    for (int i = 0; i < 100000; ++i) {
+        ids.push_back(id);
+        cache.set(id, test_lat(id), test_lon(id), no_tags);
+        if (i % 1000 == 999) {
+            id += osmid_t(1) << 33;
+        } else {
+            id += 1 + (i * 7919) % 20000;
+        }
+    }
+
+    for (auto i : ids) {
+        assert_node(cache, i, test_lat(i), test_lon(i));
+    }
+
+    assert_no_node(cache, 0);
+    assert_no_node(cache, ids.back() + 1);
+    for (size_t i = 1; i < ids.size(); ++i) {
+        if (ids[i] - ids[i - 1] > 1) {
+            assert_no_node(cache, ids[i] - 1);
+        }
+    }
+}
+
+void test_sparse_negative_ids()
+{
+    node_ram_cache cache(ALLOC_SPARSE, 16, scale);
+
+    cache.set(-300, 1.0, 2.0, no_tags);
+    cache.set(-2, 3.0, 4.0, no_tags);
+    cache.set(5, 5.0, 6.0, no_tags);
+
+    assert_node(cache, -300, 1.0, 2.0);
+    assert_node(cache, -2, 3.0, 4.0);
+    assert_node(cache, 5, 5.0, 6.0);
+    assert_no_node(cache, -1);
+}
+
+void test_sparse_set_twice()
+{
+    node_ram_cache cache(ALLOC_SPARSE, 16, scale);
+
+    cache.set(5, 1.0, 2.0, no_tags);
+    cache.set(5, 3.0, 4.0, no_tags);
+    cache.set(6, 5.0, 6.0, no_tags);
+
+    assert_node(cache, 5, 3.0, 4.0);
+    assert_node(cache, 6, 5.0, 6.0);
+}
+
+void test_sparse_out_of_order()
+{
+    node_ram_cache cache(ALLOC_SPARSE | ALLOC_LOSSY, 16, scale);
+
+    cache.set(10, 1.0, 2.0, no_tags);
+    cache.set(5, 3.0, 4.0, no_tags);
+
+    assert_node(cache, 10, 1.0, 2.0);
+    assert_no_node(cache, 5);
+}
+
+// nodes a few thousand ids apart need no more than about 11 bytes each
+void test_sparse_size()
+{
+    node_ram_cache cache(ALLOC_SPARSE | ALLOC_LOSSY, 1, scale);
+
+    const osmid_t count = (1 << 20) / 11;
+    for (osmid_t i = 1; i <= 2 * count; ++i) {
+        cache.set(i * 3000, test_lat(i), test_lon(i), no_tags);
+    }
+
+    for (osmid_t i = 1; i <= count; ++i) {
+        assert_node(cache, i * 3000, test_lat(i), test_lon(i));
+    }
+}
+
+// when the cache is full, blocks with few nodes are replaced before
+// densely filled ones
+void test_dense_replacement()
+{
+    node_ram_cache cache(ALLOC_DENSE | ALLOC_LOSSY, 1, scale);
+
+    const osmid_t per_block = 1 << 13;
+    const osmid_t num_blocks = 64;
+    for (osmid_t id = 0; id < num_blocks * per_block; ++id) {
+        const bool dense = (id / per_block) % 2 == 0;
+        if (dense || id % 16 == 0) {
+            cache.set(id, test_lat(id), test_lon(id), no_tags);
+        }
+    }
+
+    int dense_blocks = 0, sparse_blocks = 0;
+    for (osmid_t block = 0; block < num_blocks; ++block) {
+        osmNode node;
+        if (cache.get(&node, block * per_block) == 0) {
+            if (block % 2 == 0) {
+                ++dense_blocks;
+            } else {
+                ++sparse_blocks;
+            }
+        }
+    }
+
+    // 16 blocks fit into the cache, only the last block is allowed to be
+    // one with few nodes, because it was filled last
+    ASSERT_EQ(dense_blocks + sparse_blocks, 16);
+    ASSERT_EQ(sparse_blocks <= 1, true);
+}
+
+void test_concurrent_lookups()
+{
+    node_ram_cache cache(ALLOC_DENSE | ALLOC_SPARSE, 16, scale);
+
+    std::vector<osmid_t> ids;
+    for (osmid_t id = 1; id < 100000; id += (id < 50000) ? 1 : 97) {
+        ids.push_back(id);
+        cache.set(id, test_lat(id), test_lon(id), no_tags);
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<int> errors(4, 0);
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&cache, &ids, &errors, t]() {
+            for (auto id : ids) {
+                osmNode node;
+                if (cache.get(&node, id) != 0 ||
+                    std::abs(node.lat - test_lat(id)) > 1e-6) {
+                    ++errors[t];
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < 4; ++t) {
+        ASSERT_EQ(errors[t], 0);
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_sparse_scattered);
+    RUN_TEST(test_sparse_negative_ids);
+    RUN_TEST(test_sparse_set_twice);
+    RUN_TEST(test_sparse_out_of_order);
+    RUN_TEST(test_sparse_size);
+    RUN_TEST(test_dense_replacement);
+    RUN_TEST(test_concurrent_lookups);
+
+    //passed
+    return 0;
+}
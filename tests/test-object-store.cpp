@@ -0,0 +1,121 @@
+#include "object-store.hpp"
+
+#include <cstdio>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+const std::string basename = "tests/test-object-store";
+
+std::string data_of(osmid_t id)
+{
+    return "object " + std::to_string(id);
+}
+
+std::string get(const object_store_t &store, osmid_t id)
+{
+    std::string data;
+    return store.get(id, data) ? data : std::string("missing");
+}
+
+void test_import()
+{
+    object_store_t store(basename, false);
+    for (osmid_t id = 1; id <= 1000; id += 2) {
+        store.set(id, data_of(id));
+    }
+    // out of order and repeated objects
+    store.set(4, data_of(4));
+    store.set(5, "changed");
+    store.set(2000, "");
+    store.end_write();
+
+    ASSERT_EQ(get(store, 1), data_of(1));
+    ASSERT_EQ(get(store, 999), data_of(999));
+    ASSERT_EQ(get(store, 4), data_of(4));
+    ASSERT_EQ(get(store, 5), std::string("changed"));
+    ASSERT_EQ(get(store, 2000), std::string(""));
+    ASSERT_EQ(get(store, 2), std::string("missing"));
+
+    store.flush();
+    ASSERT_EQ(store.segment_count(), 2);
+    ASSERT_EQ(get(store, 4), data_of(4));
+    ASSERT_EQ(get(store, 5), std::string("changed"));
+    ASSERT_EQ(get(store, 6), std::string("missing"));
+}
+
+void test_update()
+{
+    {
+        object_store_t store(basename, false);
+        for (osmid_t id = 1; id <= 100; ++id) {
+            store.set(id, data_of(id));
+        }
+        store.flush();
+    }
+
+    object_store_t store(basename, true);
+    ASSERT_EQ(store.segment_count(), 1);
+    ASSERT_EQ(get(store, 50), data_of(50));
+
+    // one segment for each round of changes, until they are merged
+    for (size_t round = 1; round <= object_store_t::max_segments; ++round) {
+        store.set(round, "round " + std::to_string(round));
+        store.remove(100 + round);
+        store.remove(50 + round);
+        store.flush();
+        ASSERT_EQ(get(store, round), "round " + std::to_string(round));
+        ASSERT_EQ(get(store, 50 + round), std::string("missing"));
+    }
+    ASSERT_EQ(store.segment_count(), 1);
+
+    object_store_t reopened(basename, true);
+    ASSERT_EQ(reopened.segment_count(), 1);
+    ASSERT_EQ(get(reopened, 1), std::string("round 1"));
+    ASSERT_EQ(get(reopened, 8), std::string("round 8"));
+    ASSERT_EQ(get(reopened, 9), data_of(9));
+    ASSERT_EQ(get(reopened, 51), std::string("missing"));
+    ASSERT_EQ(get(reopened, 59), data_of(59));
+    ASSERT_EQ(get(reopened, 101), std::string("missing"));
+
+    // changes are seen before the flush
+    reopened.set(59, "new");
+    ASSERT_EQ(get(reopened, 59), std::string("new"));
+    reopened.destroy();
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_import);
+    RUN_TEST(test_update);
+
+    object_store_t(basename, false).destroy();
+
+    //passed
+    return 0;
+}
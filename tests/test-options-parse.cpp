@@ -1,4 +1,5 @@
 #include "options.hpp"
+#include "middle-file.hpp"
 #include "middle-pgsql.hpp"
 #include "middle-ram.hpp"
 #include "output-pgsql.hpp"
@@ -69,7 +70,7 @@ void test_middles()
 {
     const char* a1[] = {"osm2pgsql", "--slim", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options_t options = options_t(len(a1), const_cast<char **>(a1));
-    std::shared_ptr<middle_t> mid = middle_t::create_middle(options.slim);
+    std::shared_ptr<middle_t> mid = middle_t::create_middle(options);
     if(dynamic_cast<middle_pgsql_t *>(mid.get()) == nullptr)
     {
         throw std::logic_error("Using slim mode we expected a pgsql middle");
@@ -77,18 +78,30 @@ void test_middles()
 
     const char* a2[] = {"osm2pgsql", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a2), const_cast<char **>(a2));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     if(dynamic_cast<middle_ram_t *>(mid.get()) == nullptr)
     {
         throw std::logic_error("Using without slim mode we expected a ram middle");
     }
+
+    const char* a3[] = {"osm2pgsql", "--slim", "--middle-dir", "tests", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    options = options_t(len(a3), const_cast<char **>(a3));
+    mid = middle_t::create_middle(options);
+    if(dynamic_cast<middle_file_t *>(mid.get()) == nullptr)
+    {
+        throw std::logic_error("Using a middle directory we expected a file middle");
+    }
+    if(options.flat_node_file != std::string("tests/planet_osm_nodes.cache"))
+    {
+        throw std::logic_error("Using a middle directory we expected flat nodes in it");
+    }
 }
 
 void test_outputs()
 {
     const char* a1[] = {"osm2pgsql", "-O", "pgsql", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options_t options = options_t(len(a1), const_cast<char **>(a1));
-    std::shared_ptr<middle_t> mid = middle_t::create_middle(options.slim);
+    std::shared_ptr<middle_t> mid = middle_t::create_middle(options);
     std::vector<std::shared_ptr<output_t> > outs = output_t::create_outputs(mid.get(), options);
     output_t* out = outs.front().get();
     if(dynamic_cast<output_pgsql_t *>(out) == nullptr)
@@ -98,7 +111,7 @@ void test_outputs()
 
     const char* a2[] = {"osm2pgsql", "-O", "gazetteer", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a2), const_cast<char **>(a2));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     outs = output_t::create_outputs(mid.get(), options);
     out = outs.front().get();
     if(dynamic_cast<output_gazetteer_t *>(out) == nullptr)
@@ -108,7 +121,7 @@ void test_outputs()
 
     const char* a3[] = {"osm2pgsql", "-O", "null", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a3), const_cast<char **>(a3));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     outs = output_t::create_outputs(mid.get(), options);
     out = outs.front().get();
     if(dynamic_cast<output_null_t *>(out) == nullptr)
@@ -118,7 +131,7 @@ void test_outputs()
 
     const char* a4[] = {"osm2pgsql", "-O", "keine_richtige_ausgabe", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a4), const_cast<char **>(a4));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     try
     {
         outs = output_t::create_outputs(mid.get(), options);
@@ -243,6 +256,8 @@ void test_random_perms()
 
         add_arg_or_not("--unlogged", args, options.unlogged);
 
+        add_arg_or_not("--copy-binary", args, options.copy_binary);
+
         //--cache-strategy  Specifies the method used to cache nodes in ram. Available options are: dense chunk sparse optimized
 
         if (options.flat_node_file) {
@@ -45,7 +45,7 @@ int main(int argc, char *argv[]) {
         options.style = "tests/test_output_multi_line_trivial.style.json";
 
         //setup the middle
-        std::shared_ptr<middle_t> middle = middle_t::create_middle(options.slim);
+        std::shared_ptr<middle_t> middle = middle_t::create_middle(options);
 
         //setup the backend (output)
         std::vector<std::shared_ptr<output_t> > outputs = output_t::create_outputs(middle.get(), options);
@@ -25,7 +25,7 @@
 
 void run_osm2pgsql(options_t &options) {
   //setup the middle
-  std::shared_ptr<middle_t> middle = middle_t::create_middle(options.slim);
+  std::shared_ptr<middle_t> middle = middle_t::create_middle(options);
 
   //setup the backend (output)
   std::vector<std::shared_ptr<output_t> > outputs = output_t::create_outputs(middle.get(), options);
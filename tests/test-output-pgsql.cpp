@@ -104,6 +104,47 @@ void test_regression_simple() {
     db->check_count(1, "SELECT count(*) FROM osm2pgsql_test_point WHERE ST_DWithin(way, 'SRID=3857;POINT(1062645.12 5972593.4)'::geometry, 0.1)");
 }
 
+// same import as test_regression_simple, but with rows sent using binary COPY
+void test_copy_binary() {
+    std::unique_ptr<pg::tempdb> db;
+
+    try {
+        db.reset(new pg::tempdb);
+    } catch (const std::exception &e) {
+        std::cerr << "Unable to setup database: " << e.what() << "\n";
+        throw skip_test();
+    }
+
+    std::string proc_name("test-output-pgsql"), input_file("-");
+    char *argv[] = { &proc_name[0], &input_file[0], nullptr };
+
+    std::shared_ptr<middle_pgsql_t> mid_pgsql(new middle_pgsql_t());
+    options_t options = options_t(2, argv);
+    options.database_options = db->database_options;
+    options.num_procs = 1;
+    options.prefix = "osm2pgsql_test";
+    options.slim = true;
+    options.style = "default.style";
+    options.copy_binary = true;
+
+    auto out_test = std::make_shared<output_pgsql_t>(mid_pgsql.get(), options);
+
+    osmdata_t osmdata(mid_pgsql, out_test);
+
+    testing::parse("tests/liechtenstein-2013-08-03.osm.pbf", "pbf",
+                   options, &osmdata);
+
+    db->check_count(1342, "SELECT count(*) FROM osm2pgsql_test_point");
+    db->check_count(3300, "SELECT count(*) FROM osm2pgsql_test_line");
+    db->check_count( 375, "SELECT count(*) FROM osm2pgsql_test_roads");
+    db->check_count(4128, "SELECT count(*) FROM osm2pgsql_test_polygon");
+
+    db->check_count(0, "SELECT count(*) FROM osm2pgsql_test_polygon WHERE ST_SRID(way) <> 3857");
+    db->check_number(1696.04, "SELECT ST_Length(way) FROM osm2pgsql_test_line WHERE osm_id = 44822682");
+    db->check_number(311.21, "SELECT way_area FROM osm2pgsql_test_polygon WHERE osm_id = 157261342");
+    db->check_count(1, "SELECT count(*) FROM osm2pgsql_test_point WHERE ST_DWithin(way, 'SRID=3857;POINT(1062645.12 5972593.4)'::geometry, 0.1)");
+}
+
 void test_latlong() {
     std::unique_ptr<pg::tempdb> db;
 
@@ -292,6 +333,7 @@ int main(int argc, char *argv[]) {
 
     RUN_TEST(test_regression_simple);
     RUN_TEST(test_latlong);
+    RUN_TEST(test_copy_binary);
     RUN_TEST(test_clone);
     RUN_TEST(test_area_way_simple);
     RUN_TEST(test_route_rel);
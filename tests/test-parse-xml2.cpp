@@ -29,7 +29,7 @@ struct test_output_t : public output_t {
     }
 
     explicit test_output_t(const test_output_t &other)
-        : output_t(this->m_mid, this->m_options), sum_ids(0), num_nodes(0), num_ways(0), num_relations(0),
+        : output_t(other.m_mid, other.m_options), sum_ids(0), num_nodes(0), num_ways(0), num_relations(0),
           num_nds(0), num_members(0) {
     }
 
@@ -98,28 +98,47 @@ void assert_equal(uint64_t actual, uint64_t expected) {
   }
 }
 
-int main(int argc, char *argv[]) {
-
-  std::string inputfile = "tests/test_multipolygon.osm";
-
+void check_parse(const std::string &inputfile, int input_threads,
+                 size_t num_outputs) {
   options_t options;
   std::shared_ptr<reprojection> projection(reprojection::create_projection(PROJ_SPHERE_MERC));
   options.projection = projection;
+  options.num_procs = 2;
 
-  auto out_test = std::make_shared<test_output_t>(options);
-  osmdata_t osmdata(std::make_shared<dummy_middle_t>(), out_test);
+  std::vector<std::shared_ptr<test_output_t> > out_tests;
+  std::vector<std::shared_ptr<output_t> > outputs;
+  for (size_t i = 0; i < num_outputs; ++i) {
+    out_tests.push_back(std::make_shared<test_output_t>(options));
+    outputs.push_back(out_tests.back());
+  }
+  osmdata_t osmdata(std::make_shared<dummy_middle_t>(), outputs);
 
   boost::optional<std::string> bbox;
-  parse_osmium_t parser(false, bbox, projection.get(), false, &osmdata);
+  parse_osmium_t parser(false, bbox, projection.get(), false, &osmdata,
+                        input_threads);
 
   parser.stream_file(inputfile, "");
+  osmdata.stop();
+
+  for (auto const &out_test : out_tests) {
+    assert_equal(out_test->sum_ids,       73514L);
+    assert_equal(out_test->num_nodes,       353L);
+    assert_equal(out_test->num_ways,        140L);
+    assert_equal(out_test->num_relations,    40L);
+    assert_equal(out_test->num_nds,         495L);
+    assert_equal(out_test->num_members,     146L);
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  std::string inputfile = "tests/test_multipolygon.osm";
 
-  assert_equal(out_test->sum_ids,       73514L);
-  assert_equal(out_test->num_nodes,       353L);
-  assert_equal(out_test->num_ways,        140L);
-  assert_equal(out_test->num_relations,    40L);
-  assert_equal(out_test->num_nds,         495L);
-  assert_equal(out_test->num_members,     146L);
+  check_parse(inputfile, 0, 1);
+  // pipelined parsing must hand over the same objects
+  check_parse(inputfile, 3, 1);
+  // several outputs are fed concurrently and must all see everything
+  check_parse(inputfile, 0, 3);
 
   return 0;
 }
@@ -0,0 +1,84 @@
+#include "reprojection.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+std::vector<osmium::Location> some_locations()
+{
+    std::vector<osmium::Location> locs;
+    for (int i = 0; i < 999; ++i) {
+        locs.emplace_back(-179.9 + i * 0.36, -89.9 + i * 0.18);
+    }
+    return locs;
+}
+
+/// The batch functions must give the same results as the single ones.
+void check_batch(int srs)
+{
+    std::unique_ptr<reprojection> proj(reprojection::create_projection(srs));
+    auto const locs = some_locations();
+
+    nodelist_t coords(locs.size());
+    proj->reproject_batch(locs.data(), coords.data(), locs.size());
+    nodelist_t tiles(coords);
+    proj->coords_to_tile_batch(tiles.data(), tiles.size(), 1 << 14);
+
+    for (size_t i = 0; i < locs.size(); ++i) {
+        auto const c = proj->reproject(locs[i]);
+        ASSERT_EQ(coords[i].lon, c.x);
+        ASSERT_EQ(coords[i].lat, c.y);
+
+        double x, y;
+        proj->coords_to_tile(&x, &y, c.x, c.y, 1 << 14);
+        ASSERT_EQ(tiles[i].lon, x);
+        ASSERT_EQ(tiles[i].lat, y);
+    }
+}
+
+void test_latlon_batch()
+{
+    check_batch(PROJ_LATLONG);
+}
+
+void test_merc_batch()
+{
+    check_batch(PROJ_SPHERE_MERC);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_latlon_batch);
+    RUN_TEST(test_merc_batch);
+
+    //passed
+    return 0;
+}
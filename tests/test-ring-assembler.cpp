@@ -0,0 +1,218 @@
+#include "ring-assembler.hpp"
+#include "wkb-writer.hpp"
+
+#include <cstdio>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+nodelist_t line(std::initializer_list<std::pair<double, double>> points)
+{
+    nodelist_t nodes;
+    for (auto const &p : points) {
+        nodes.emplace_back(p.first, p.second);
+    }
+    return nodes;
+}
+
+std::string polygon_wkb(std::initializer_list<nodelist_t> rings)
+{
+    std::string wkb;
+    wkb_writer_t writer(wkb);
+    writer.header(wkb_writer_t::wkb_polygon);
+    writer.count(rings.size());
+    for (auto const &ring : rings) {
+        writer.points(ring);
+    }
+    return wkb;
+}
+
+void test_merge_lines()
+{
+    ring_assembler_t assembler;
+    // joined at (1,0) with the second way reversed, then at (3,0)
+    ASSERT_EQ(assembler.merge({line({{0, 0}, {1, 0}}),
+                               line({{3, 0}, {2, 0}, {1, 0}}),
+                               line({{3, 0}, {4, 0}, {4, 0}})}), true);
+    ASSERT_EQ(assembler.lines().size(), 1);
+    ASSERT_EQ(assembler.lines()[0].size(), 5);
+
+    // nothing is joined where three ways end
+    ASSERT_EQ(assembler.merge({line({{0, 0}, {1, 0}}),
+                               line({{1, 0}, {2, 0}}),
+                               line({{1, 0}, {1, 1}}),
+                               line({{5, 5}})}), true);
+    ASSERT_EQ(assembler.lines().size(), 3);
+    ASSERT_EQ(assembler.assemble(), true);
+    ASSERT_EQ(assembler.polygons().size(), 0);
+
+    nodelist_t invalid = line({{0, 0}});
+    invalid.emplace_back();
+    ASSERT_EQ(assembler.merge({invalid}), false);
+}
+
+void test_polygon_with_hole()
+{
+    ring_assembler_t assembler;
+    assembler.merge({line({{0, 0}, {10, 0}, {10, 10}}),
+                     line({{10, 10}, {0, 10}, {0, 0}}),
+                     line({{2, 2}, {2, 4}, {4, 4}, {4, 2}, {2, 2}}),
+                     line({{20, 20}, {21, 20}})});
+    ASSERT_EQ(assembler.assemble(), true);
+
+    ASSERT_EQ(assembler.lines().size(), 1);
+    ASSERT_EQ(assembler.polygons().size(), 1);
+    ASSERT_EQ(assembler.polygons()[0].rings.size(), 2);
+    ASSERT_EQ(assembler.polygons()[0].area, 96.0);
+
+    // shell clockwise, hole counterclockwise, both from their lowest point
+    ASSERT_EQ(assembler.polygon_wkb(0),
+              polygon_wkb({line({{0, 0}, {0, 10}, {10, 10}, {10, 0}, {0, 0}}),
+                           line({{2, 2}, {4, 2}, {4, 4}, {2, 4}, {2, 2}})}));
+}
+
+void test_nesting()
+{
+    ring_assembler_t assembler;
+    // an island in the hole of a polygon and a polygon next to it
+    assembler.merge({line({{0, 0}, {10, 0}, {10, 10}, {0, 10}, {0, 0}}),
+                     line({{1, 1}, {9, 1}, {9, 9}, {1, 9}, {1, 1}}),
+                     line({{4, 4}, {5, 4}, {5, 5}, {4, 5}, {4, 4}}),
+                     line({{20, 0}, {22, 0}, {22, 2}, {20, 2}, {20, 0}})});
+    ASSERT_EQ(assembler.assemble(), true);
+
+    auto const &polys = assembler.polygons();
+    ASSERT_EQ(polys.size(), 3);
+    ASSERT_EQ(polys[0].rings.size(), 2);
+    ASSERT_EQ(polys[0].area, 36.0);
+    ASSERT_EQ(polys[1].area, 4.0);
+    ASSERT_EQ(polys[2].area, 1.0);
+
+    std::string multi;
+    wkb_writer_t writer(multi);
+    writer.header(wkb_writer_t::wkb_multi_polygon);
+    writer.count(3);
+    // the polygons are ordered by their shells, the largest first
+    multi += assembler.polygon_wkb(1);
+    multi += assembler.polygon_wkb(2);
+    multi += assembler.polygon_wkb(0);
+    ASSERT_EQ(assembler.multipolygon_wkb(), multi);
+}
+
+void test_many_rings()
+{
+    ring_assembler_t assembler;
+    // a grid of holes, each with an island in it
+    multinodelist_t ways;
+    ways.push_back(line({{0, 0}, {100, 0}, {100, 100}, {0, 100}, {0, 0}}));
+    for (int x = 0; x < 100; x += 10) {
+        for (int y = 0; y < 100; y += 10) {
+            ways.push_back(line({{x + 2., y + 2.}, {x + 8., y + 2.}, {x + 8., y + 8.},
+                                 {x + 2., y + 8.}, {x + 2., y + 2.}}));
+            ways.push_back(line({{x + 4., y + 4.}, {x + 6., y + 4.}, {x + 6., y + 6.},
+                                 {x + 4., y + 6.}, {x + 4., y + 4.}}));
+        }
+    }
+    ASSERT_EQ(assembler.merge(ways), true);
+    ASSERT_EQ(assembler.assemble(), true);
+
+    auto const &polys = assembler.polygons();
+    ASSERT_EQ(polys.size(), 101);
+    ASSERT_EQ(polys[0].rings.size(), 101);
+    ASSERT_EQ(polys[0].area, 6400.0);
+    for (size_t i = 1; i < polys.size(); ++i) {
+        ASSERT_EQ(polys[i].rings.size(), 1);
+        ASSERT_EQ(polys[i].area, 4.0);
+    }
+}
+
+void test_unclean_rings()
+{
+    ring_assembler_t assembler;
+
+    // a hole touching the shell
+    assembler.merge({line({{0, 0}, {10, 0}, {10, 10}, {0, 10}, {0, 0}}),
+                     line({{0, 0}, {2, 4}, {4, 2}, {0, 0}})});
+    ASSERT_EQ(assembler.assemble(), false);
+
+    // crossing rings
+    assembler.merge({line({{0, 0}, {10, 0}, {10, 10}, {0, 10}, {0, 0}}),
+                     line({{5, 5}, {15, 5}, {15, 15}, {5, 15}, {5, 5}})});
+    ASSERT_EQ(assembler.assemble(), false);
+
+    // a ring crossing itself
+    assembler.merge({line({{0, 0}, {10, 10}, {10, 0}, {0, 20}, {0, 0}})});
+    ASSERT_EQ(assembler.assemble(), false);
+
+    // a ring running back along itself
+    assembler.merge({line({{0, 0}, {10, 0}, {5, 0}, {5, 5}, {0, 0}})});
+    ASSERT_EQ(assembler.assemble(), false);
+
+    // rings without area are dropped
+    assembler.merge({line({{0, 0}, {10, 0}, {20, 0}, {0, 0}})});
+    ASSERT_EQ(assembler.assemble(), true);
+    ASSERT_EQ(assembler.polygons().size(), 0);
+}
+
+void test_single_ring()
+{
+    ring_assembler_t assembler;
+
+    // repeated nodes are kept, the ring is turned clockwise
+    ASSERT_EQ(assembler.assemble_ring(line({{10, 0}, {10, 10}, {10, 10}, {0, 10},
+                                            {0, 0}, {10, 0}})), true);
+    ASSERT_EQ(assembler.polygons().size(), 1);
+    ASSERT_EQ(assembler.polygons()[0].area, 100.0);
+    ASSERT_EQ(assembler.polygon_wkb(0),
+              polygon_wkb({line({{0, 0}, {0, 10}, {10, 10}, {10, 10}, {10, 0},
+                                 {0, 0}})}));
+
+    // also where the ring starts, turning it around moves it to the end
+    ASSERT_EQ(assembler.assemble_ring(line({{0, 0}, {0, 0}, {10, 0}, {10, 10},
+                                            {0, 10}, {0, 0}})), true);
+    ASSERT_EQ(assembler.polygon_wkb(0),
+              polygon_wkb({line({{0, 0}, {0, 10}, {10, 10}, {10, 0}, {0, 0},
+                                 {0, 0}})}));
+
+    ASSERT_EQ(assembler.assemble_ring(line({{0, 0}, {10, 10}, {10, 0}, {0, 20}, {0, 0}})), false);
+    ASSERT_EQ(assembler.assemble_ring(line({{0, 0}, {10, 0}, {20, 0}, {0, 0}})), false);
+    ASSERT_EQ(assembler.assemble_ring(line({{0, 0}, {10, 0}, {10, 10}})), false);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_merge_lines);
+    RUN_TEST(test_polygon_with_hole);
+    RUN_TEST(test_nesting);
+    RUN_TEST(test_many_rings);
+    RUN_TEST(test_unclean_rings);
+    RUN_TEST(test_single_ring);
+
+    //passed
+    return 0;
+}
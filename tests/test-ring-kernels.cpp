@@ -0,0 +1,122 @@
+#include "reprojection.hpp"
+#include "ring-kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+/// Doubles the x coordinates on the way to the tile projection.
+class stretch_reprojection_t : public reprojection
+{
+public:
+    explicit stretch_reprojection_t(int srs) : m_srs(srs) {}
+
+    osmium::geom::Coordinates reproject(osmium::Location loc) const override
+    {
+        return osmium::geom::Coordinates(loc.lon(), loc.lat());
+    }
+
+    void target_to_tile(double *, double *lon) const override { *lon *= 2; }
+
+    int target_srs() const override { return m_srs; }
+    const char *target_desc() const override { return "stretch"; }
+
+private:
+    int m_srs;
+};
+
+/// A square from (0,0) to (size,size) with n points on each side.
+nodelist_t square(double size, int n)
+{
+    nodelist_t ring;
+    for (int i = 0; i < n; ++i) ring.emplace_back(size * i / n, 0);
+    for (int i = 0; i < n; ++i) ring.emplace_back(size, size * i / n);
+    for (int i = 0; i < n; ++i) ring.emplace_back(size - size * i / n, size);
+    for (int i = 0; i < n; ++i) ring.emplace_back(0, size - size * i / n);
+    ring.emplace_back(0, 0);
+    return ring;
+}
+
+void test_area()
+{
+    // counts that do and do not fill the partial sums evenly
+    for (int n : {1, 2, 3, 100, 333}) {
+        auto ring = square(8, n);
+        ASSERT_EQ(ring_signed_area2(ring), 128.0);
+        ASSERT_EQ(ring_is_ccw(ring), true);
+
+        std::reverse(ring.begin(), ring.end());
+        ASSERT_EQ(ring_signed_area2(ring), -128.0);
+        ASSERT_EQ(ring_is_ccw(ring), false);
+    }
+    ASSERT_EQ(ring_signed_area2(nodelist_t()), 0.0);
+}
+
+void test_tile_area()
+{
+    // spans several of the blocks the points are converted in
+    auto const ring = square(8, 1000);
+
+    stretch_reprojection_t stretch(4326);
+    ASSERT_EQ(ring_tile_area(ring, &stretch), 128.0);
+
+    // nothing to convert if the target is the tile projection
+    stretch_reprojection_t merc(PROJ_SPHERE_MERC);
+    ASSERT_EQ(ring_tile_area(ring, &merc), 64.0);
+}
+
+void test_box()
+{
+    for (int n : {1, 2, 7}) {
+        nodelist_t ring = square(8, n);
+        ring[1].lat = -3;
+        auto const box = ring_box(ring);
+        ASSERT_EQ(box.minx, 0.0);
+        ASSERT_EQ(box.miny, -3.0);
+        ASSERT_EQ(box.maxx, 8.0);
+        ASSERT_EQ(box.maxy, 8.0);
+    }
+
+    nodelist_t const point{osmNode(2, 5)};
+    auto const box = ring_box(point);
+    ASSERT_EQ(box.minx, 2.0);
+    ASSERT_EQ(box.maxy, 5.0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_area);
+    RUN_TEST(test_tile_area);
+    RUN_TEST(test_box);
+
+    //passed
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "stop-tasks.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+// tasks that record how many of them were running at the same time
+struct counting_tasks {
+    std::atomic<int> running, max_running, done;
+
+    counting_tasks() : running(0), max_running(0), done(0) {}
+
+    stop_tasks_t make(int count)
+    {
+        stop_tasks_t tasks;
+        for (int i = 0; i < count; ++i) {
+            tasks.emplace_back("task " + std::to_string(i), [this]() {
+                int const now = ++running;
+                int prev = max_running;
+                while (now > prev && !max_running.compare_exchange_weak(prev, now)) {}
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                --running;
+                ++done;
+            });
+        }
+        return tasks;
+    }
+};
+
+void test_all_parallel()
+{
+    counting_tasks c;
+    run_stop_tasks(c.make(4), 0);
+    ASSERT_EQ(c.done.load(), 4);
+    ASSERT_EQ(c.max_running.load(), 4);
+}
+
+void test_limited()
+{
+    counting_tasks c;
+    run_stop_tasks(c.make(6), 2);
+    ASSERT_EQ(c.done.load(), 6);
+    if (c.max_running.load() > 2) {
+        throw std::runtime_error("More than two tasks ran at the same time.");
+    }
+}
+
+void test_sequential()
+{
+    counting_tasks c;
+    run_stop_tasks(c.make(3), 1);
+    ASSERT_EQ(c.done.load(), 3);
+    ASSERT_EQ(c.max_running.load(), 1);
+}
+
+void test_error()
+{
+    counting_tasks c;
+    stop_tasks_t tasks;
+    tasks.emplace_back("failing", []() { throw std::runtime_error("task failed"); });
+    stop_tasks_t more = c.make(3);
+    tasks.insert(tasks.end(), more.begin(), more.end());
+
+    bool caught = false;
+    try {
+        run_stop_tasks(tasks, 1);
+    } catch (const std::runtime_error &e) {
+        caught = true;
+        ASSERT_EQ(std::string(e.what()), std::string("task failed"));
+    }
+    ASSERT_EQ(caught, true);
+    // no further tasks are started after a failure
+    ASSERT_EQ(c.done.load(), 0);
+}
+
+// tasks added later start while the earlier ones are still running
+void test_runner_add_later()
+{
+    counting_tasks c;
+    stop_task_runner_t runner(0);
+    runner.add(c.make(2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(c.done.load(), 0);
+    runner.add(c.make(2));
+    runner.finish();
+    ASSERT_EQ(c.done.load(), 4);
+    ASSERT_EQ(c.max_running.load(), 4);
+}
+
+void test_runner_limited()
+{
+    counting_tasks c;
+    stop_task_runner_t runner(2);
+    runner.add(c.make(1));
+    runner.add(c.make(3));
+    runner.finish();
+    ASSERT_EQ(c.done.load(), 4);
+    ASSERT_EQ(c.max_running.load(), 2);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(test_all_parallel);
+    RUN_TEST(test_limited);
+    RUN_TEST(test_sequential);
+    RUN_TEST(test_error);
+    RUN_TEST(test_runner_add_later);
+    RUN_TEST(test_runner_limited);
+
+    return 0;
+}
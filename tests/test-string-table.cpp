@@ -0,0 +1,118 @@
+#include "string-table.hpp"
+
+#include <cstdio>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+void test_add()
+{
+    string_table_t strings;
+
+    auto const highway = strings.add("highway");
+    auto const empty = strings.add("");
+    auto const nul = strings.add(std::string("a\0b", 3));
+
+    ASSERT_EQ(strings.add("highway"), highway);
+    ASSERT_EQ(strings.add("", 0), empty);
+    ASSERT_EQ(strings.add("highways", 7), highway);
+    ASSERT_EQ(strings.add(std::string("a\0b", 3)), nul);
+    ASSERT_EQ(strings.size(), 3);
+
+    ASSERT_EQ(strings.get(highway), std::string("highway"));
+    ASSERT_EQ(strings.get(empty), std::string(""));
+    ASSERT_EQ(strings.get(nul), std::string("a\0b", 3));
+
+    size_t len;
+    const char *str = strings.data(highway, &len);
+    ASSERT_EQ(std::string(str, len), std::string("highway"));
+
+    strings.clear();
+    ASSERT_EQ(strings.size(), 0);
+    ASSERT_EQ(strings.get(strings.add("building")), std::string("building"));
+}
+
+void test_many()
+{
+    string_table_t strings;
+    std::vector<string_table_t::handle_t> handles;
+
+    // more than fit into one chunk of the directory
+    for (int i = 0; i < 1100000; ++i) {
+        handles.push_back(strings.add(std::to_string(i)));
+    }
+    ASSERT_EQ(strings.size(), 1100000);
+
+    for (int i = 0; i < 1100000; i += 997) {
+        ASSERT_EQ(strings.add(std::to_string(i)), handles[i]);
+        ASSERT_EQ(strings.get(handles[i]), std::to_string(i));
+    }
+}
+
+void test_threads()
+{
+    string_table_t strings;
+    int const num_threads = 4;
+    int const num_strings = 10000;
+    std::vector<std::vector<string_table_t::handle_t>> handles(num_threads);
+
+    // all threads add the same strings, in a different order
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < num_strings; ++i) {
+                int const n = (i * (t + 1)) % num_strings;
+                handles[t].push_back(strings.add("key" + std::to_string(n)));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(strings.size(), num_strings);
+    for (int t = 0; t < num_threads; ++t) {
+        for (int i = 0; i < num_strings; ++i) {
+            int const n = (i * (t + 1)) % num_strings;
+            ASSERT_EQ(strings.get(handles[t][i]), "key" + std::to_string(n));
+            ASSERT_EQ(handles[t][i], strings.add("key" + std::to_string(n)));
+        }
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_add);
+    RUN_TEST(test_many);
+    RUN_TEST(test_threads);
+
+    //passed
+    return 0;
+}
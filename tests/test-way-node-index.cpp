@@ -0,0 +1,152 @@
+#include "way-node-index.hpp"
+
+#include <cstdio>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <boost/format.hpp>
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+const std::string filename = "tests/test-way-node-index.idx";
+
+// way i uses the nodes i to i + 4, so node n is used by ways n - 4 to n
+void fill(way_node_index_t &index, osmid_t count)
+{
+    for (osmid_t way = 1; way <= count; ++way) {
+        idlist_t nodes;
+        for (osmid_t node = way; node < way + 5; ++node) {
+            nodes.push_back(node);
+        }
+        // closed ways use their first node twice
+        if (way % 2 == 0) {
+            nodes.push_back(way);
+        }
+        index.set(way, nodes);
+    }
+}
+
+void test_import()
+{
+    // small runs so that the merge is needed
+    way_node_index_t index(filename, false, 100);
+    fill(index, 1000);
+    index.flush();
+    index.commit();
+
+    ASSERT_EQ(index.size(), 5000);
+    ASSERT_EQ(index.ways_using({ 1 }) == idlist_t({ 1 }), true);
+    ASSERT_EQ(index.ways_using({ 500 }) == idlist_t({ 496, 497, 498, 499, 500 }), true);
+    ASSERT_EQ(index.ways_using({ 3, 1004, 2000 }) == idlist_t({ 1, 2, 3, 1000 }), true);
+    ASSERT_EQ(index.ways_using({ 0, 5000 }).empty(), true);
+}
+
+void test_update()
+{
+    {
+        way_node_index_t index(filename, false, 100);
+        fill(index, 1000);
+        index.flush();
+        index.commit();
+    }
+
+    way_node_index_t index(filename, true);
+    ASSERT_EQ(index.size(), 5000);
+
+    // a changed way, a deleted one and a new one
+    index.set(10, { 20, 3000 });
+    index.remove(11);
+    index.set(2000, { 12 });
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(index.ways_using({ 10 }) == idlist_t({ 6, 7, 8, 9 }), true);
+        ASSERT_EQ(index.ways_using({ 12 }) == idlist_t({ 8, 9, 12, 2000 }), true);
+        ASSERT_EQ(index.ways_using({ 20, 3000 }) == idlist_t({ 10, 16, 17, 18, 19, 20 }), true);
+        // the file only changes on commit, after that the changes come
+        // from the file
+        index.flush();
+        if (i == 0) {
+            ASSERT_EQ(index.size(), 5000);
+        } else {
+            index.commit();
+        }
+    }
+    ASSERT_EQ(index.size(), 5000 - 5 + 2 - 5 + 1);
+
+    way_node_index_t reopened(filename, true);
+    ASSERT_EQ(reopened.ways_using({ 3000 }) == idlist_t({ 10 }), true);
+}
+
+void test_uncommitted()
+{
+    {
+        way_node_index_t index(filename, false, 100);
+        fill(index, 1000);
+        index.flush();
+        index.commit();
+    }
+
+    {
+        way_node_index_t index(filename, true);
+        index.set(10, { 3000 });
+        index.flush();
+    }
+
+    // the flushed changes were never committed
+    way_node_index_t index(filename, true);
+    ASSERT_EQ(index.size(), 5000);
+    ASSERT_EQ(index.ways_using({ 3000 }).empty(), true);
+    ASSERT_EQ(index.ways_using({ 10 }) == idlist_t({ 6, 7, 8, 9, 10 }), true);
+}
+
+void test_invalid_file()
+{
+    {
+        FILE *f = fopen(filename.c_str(), "w");
+        fputs("not an index", f);
+        fclose(f);
+    }
+
+    bool thrown = false;
+    try {
+        way_node_index_t index(filename, true);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    ASSERT_EQ(thrown, true);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    //try each test if any fail we will exit
+    RUN_TEST(test_import);
+    RUN_TEST(test_update);
+    RUN_TEST(test_uncommitted);
+    RUN_TEST(test_invalid_file);
+
+    std::remove(filename.c_str());
+
+    //passed
+    return 0;
+}
@@ -0,0 +1,407 @@
+#include "config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "way-node-index.hpp"
+
+namespace {
+
+const char index_magic[8] = { 'o', '2', 'p', 'w', 'n', 'i', 'd', 'x' };
+const uint32_t index_format_version = 1;
+
+struct index_header_t
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t entry_size;
+};
+
+// pairs read or written at a time while merging
+const size_t merge_chunk_size = 4096;
+
+std::runtime_error file_error(const char *what, std::string const &filename)
+{
+    return std::runtime_error((boost::format("%1% way node index %2%: %3%\n")
+                               % what % filename % strerror(errno)).str());
+}
+
+/**
+ * Sorted and deduplicated pairs.
+ */
+void sort_pairs(std::vector<way_node_index_t::entry_t> &entries)
+{
+    std::sort(entries.begin(), entries.end());
+    // ways can use a node more than once
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](way_node_index_t::entry_t const &a,
+                                 way_node_index_t::entry_t const &b) {
+                                  return a.node == b.node && a.way == b.way;
+                              }),
+                  entries.end());
+}
+
+/**
+ * Sorted pairs from a part of a file, read in chunks, or from memory.
+ * All parts of the same file share one stream.
+ */
+class run_cursor_t
+{
+public:
+    run_cursor_t(std::ifstream *file, std::streamoff offset, size_t count)
+    : m_file(file), m_offset(offset), m_left(count), m_pos(0) {}
+
+    explicit run_cursor_t(std::vector<way_node_index_t::entry_t> &&entries)
+    : m_file(nullptr), m_offset(0), m_left(0), m_chunk(std::move(entries)),
+      m_pos(0) {}
+
+    bool next(way_node_index_t::entry_t &entry)
+    {
+        if (m_pos == m_chunk.size()) {
+            if (m_left == 0) {
+                return false;
+            }
+            m_chunk.resize(std::min(m_left, merge_chunk_size));
+            m_file->seekg(m_offset);
+            m_file->read(reinterpret_cast<char *>(m_chunk.data()),
+                         m_chunk.size() * sizeof(way_node_index_t::entry_t));
+            if (!*m_file) {
+                throw std::runtime_error("Failed to read way node index data.\n");
+            }
+            m_offset += m_chunk.size() * sizeof(way_node_index_t::entry_t);
+            m_left -= m_chunk.size();
+            m_pos = 0;
+        }
+        entry = m_chunk[m_pos++];
+        return true;
+    }
+
+private:
+    std::ifstream *m_file;
+    std::streamoff m_offset;
+    size_t m_left;
+    std::vector<way_node_index_t::entry_t> m_chunk;
+    size_t m_pos;
+};
+
+} // anonymous namespace
+
+way_node_index_t::way_node_index_t(const std::string &filename, bool append,
+                                   size_t run_size)
+: m_filename(filename), m_runs_filename(filename + ".runs"),
+  m_run_size(run_size), m_append(append), m_runs_count(0), m_flushed(false),
+  m_count(0), m_map_base(nullptr), m_map_size(0), m_entries(nullptr)
+{
+    if (!append) {
+        std::ofstream out(m_filename, std::ios::binary | std::ios::trunc);
+        index_header_t header;
+        memcpy(header.magic, index_magic, sizeof(header.magic));
+        header.format_version = index_format_version;
+        header.entry_size = sizeof(entry_t);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!out) {
+            throw file_error("Failed to create", m_filename);
+        }
+    }
+
+    open_index();
+}
+
+way_node_index_t::~way_node_index_t()
+{
+    close_index();
+    std::remove(m_runs_filename.c_str());
+    // changes that were never committed are dropped
+    if (m_flushed) {
+        std::remove(new_filename().c_str());
+    }
+}
+
+void way_node_index_t::set(osmid_t way_id, const idlist_t &nodes)
+{
+    if (m_append) {
+        m_changed[way_id] = nodes;
+        return;
+    }
+
+    for (auto const node : nodes) {
+        m_pairs.push_back(entry_t{node, way_id});
+    }
+    if (m_pairs.size() >= m_run_size) {
+        write_run(m_pairs);
+    }
+}
+
+void way_node_index_t::remove(osmid_t way_id)
+{
+    m_changed[way_id].clear();
+}
+
+void way_node_index_t::write_run(std::vector<entry_t> &entries)
+{
+    sort_pairs(entries);
+
+    std::ofstream out(m_runs_filename, std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(entry_t));
+    if (!out) {
+        throw file_error("Failed to write sorted run of", m_filename);
+    }
+
+    m_runs.push_back(m_runs_count);
+    m_runs_count += entries.size();
+    entries.clear();
+}
+
+void way_node_index_t::flush()
+{
+    if (!m_pairs.empty()) {
+        write_run(m_pairs);
+    }
+    if (m_runs.empty() && m_changed.empty()) {
+        return;
+    }
+
+    // merge the existing index, minus the changed ways, with all runs and
+    // the changed ways
+    std::ifstream index(m_filename, std::ios::binary);
+    if (!index) {
+        throw file_error("Failed to open", m_filename);
+    }
+    std::vector<run_cursor_t> cursors;
+    cursors.emplace_back(&index, sizeof(index_header_t), m_count);
+
+    std::ifstream runs;
+    if (!m_runs.empty()) {
+        runs.open(m_runs_filename, std::ios::binary);
+        if (!runs) {
+            throw file_error("Failed to open", m_runs_filename);
+        }
+    }
+    for (size_t i = 0; i < m_runs.size(); ++i) {
+        size_t const end = (i + 1 < m_runs.size()) ? m_runs[i + 1] : m_runs_count;
+        cursors.emplace_back(&runs, m_runs[i] * sizeof(entry_t), end - m_runs[i]);
+    }
+
+    // the changes stay in memory until commit(), so flush() can be repeated
+    if (!m_changed.empty()) {
+        std::vector<entry_t> entries;
+        for (auto const &way : m_changed) {
+            for (auto const node : way.second) {
+                entries.push_back(entry_t{node, way.first});
+            }
+        }
+        sort_pairs(entries);
+        cursors.emplace_back(std::move(entries));
+    }
+
+    typedef std::pair<entry_t, size_t> head_t;
+    auto const later = [](head_t const &a, head_t const &b) {
+        return b.first < a.first;
+    };
+    std::priority_queue<head_t, std::vector<head_t>, decltype(later)> heads(later);
+    auto const advance = [&](size_t i) {
+        entry_t entry;
+        while (cursors[i].next(entry)) {
+            // the changed ways come from the last cursor
+            if (i == 0 && m_changed.count(entry.way)) {
+                continue;
+            }
+            heads.push(head_t(entry, i));
+            return;
+        }
+    };
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        advance(i);
+    }
+
+    std::ofstream out(new_filename(), std::ios::binary | std::ios::trunc);
+    index_header_t header;
+    memcpy(header.magic, index_magic, sizeof(header.magic));
+    header.format_version = index_format_version;
+    header.entry_size = sizeof(entry_t);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    std::vector<entry_t> chunk;
+    chunk.reserve(merge_chunk_size);
+    while (!heads.empty()) {
+        head_t const head = heads.top();
+        heads.pop();
+        chunk.push_back(head.first);
+        if (chunk.size() == merge_chunk_size) {
+            out.write(reinterpret_cast<const char *>(chunk.data()),
+                      chunk.size() * sizeof(entry_t));
+            chunk.clear();
+        }
+        advance(head.second);
+    }
+    out.write(reinterpret_cast<const char *>(chunk.data()),
+              chunk.size() * sizeof(entry_t));
+    out.close();
+    if (!out) {
+        throw file_error("Failed to write", new_filename());
+    }
+    m_flushed = true;
+}
+
+void way_node_index_t::commit()
+{
+    if (!m_flushed) {
+        return;
+    }
+
+    close_index();
+    if (std::rename(new_filename().c_str(), m_filename.c_str()) != 0) {
+        throw file_error("Failed to replace", m_filename);
+    }
+    m_flushed = false;
+    std::remove(m_runs_filename.c_str());
+    m_runs.clear();
+    m_runs_count = 0;
+    m_changed.clear();
+
+    open_index();
+}
+
+void way_node_index_t::open_index()
+{
+    std::ifstream in(m_filename, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw file_error("Failed to open", m_filename);
+    }
+    std::streamoff const size = in.tellg();
+    in.seekg(0);
+    index_header_t header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in || memcmp(header.magic, index_magic, sizeof(header.magic)) != 0 ||
+        header.format_version != index_format_version ||
+        header.entry_size != sizeof(entry_t)) {
+        throw std::runtime_error((boost::format("File %1% is not a way node index of this version of osm2pgsql.\n")
+                                  % m_filename).str());
+    }
+    m_count = (size - sizeof(header)) / sizeof(entry_t);
+
+#ifdef HAVE_MMAP
+    if (m_count > 0) {
+        int fd = open(m_filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw file_error("Failed to open", m_filename);
+        }
+        m_map_size = size;
+        m_map_base = mmap(nullptr, m_map_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (m_map_base == MAP_FAILED) {
+            m_map_base = nullptr;
+            throw file_error("Failed to map", m_filename);
+        }
+        // lookups are binary searches all over the file
+        madvise(m_map_base, m_map_size, MADV_RANDOM);
+        m_entries = reinterpret_cast<const entry_t *>(
+            static_cast<const char *>(m_map_base) + sizeof(header));
+    }
+#endif
+
+    if (m_count > 0 && !m_entries) {
+        m_file.open(m_filename, std::ios::binary);
+        if (!m_file) {
+            throw file_error("Failed to open", m_filename);
+        }
+    }
+}
+
+void way_node_index_t::close_index()
+{
+#ifdef HAVE_MMAP
+    if (m_map_base) {
+        munmap(m_map_base, m_map_size);
+    }
+#endif
+    m_map_base = nullptr;
+    m_entries = nullptr;
+    if (m_file.is_open()) {
+        m_file.close();
+    }
+    m_count = 0;
+}
+
+way_node_index_t::entry_t way_node_index_t::entry_at(size_t i) const
+{
+    if (m_entries) {
+        return m_entries[i];
+    }
+
+    // without mmap every lookup reads from the file
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    m_file.seekg(sizeof(index_header_t) + i * sizeof(entry_t));
+    entry_t entry;
+    m_file.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+    if (!m_file) {
+        throw file_error("Failed to read from", m_filename);
+    }
+    return entry;
+}
+
+size_t way_node_index_t::lower_bound(size_t first, osmid_t node) const
+{
+    size_t count = m_count - first;
+    while (count > 0) {
+        size_t const step = count / 2;
+        if (entry_at(first + step).node < node) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+idlist_t way_node_index_t::ways_using(const idlist_t &node_ids) const
+{
+    idlist_t ways;
+
+    // the node ids are sorted, so every search can start where the last
+    // one ended
+    size_t pos = 0;
+    for (auto const node : node_ids) {
+        pos = lower_bound(pos, node);
+        for (size_t i = pos; i < m_count; ++i) {
+            entry_t const entry = entry_at(i);
+            if (entry.node != node) {
+                break;
+            }
+            if (!m_changed.count(entry.way)) {
+                ways.push_back(entry.way);
+            }
+        }
+    }
+
+    for (auto const &way : m_changed) {
+        for (auto const node : way.second) {
+            if (std::binary_search(node_ids.begin(), node_ids.end(), node)) {
+                ways.push_back(way.first);
+                break;
+            }
+        }
+    }
+
+    std::sort(ways.begin(), ways.end());
+    ways.erase(std::unique(ways.begin(), ways.end()), ways.end());
+    return ways;
+}
@@ -0,0 +1,111 @@
+#ifndef WAY_NODE_INDEX_HPP
+#define WAY_NODE_INDEX_HPP
+
+#include "osmtypes.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Index from nodes to the ways using them, kept in a file by osm2pgsql
+ * itself instead of the GIN index over the node lists of the slim ways
+ * table.
+ *
+ * The file holds (node, way) pairs sorted by node. On import the pairs
+ * are collected in memory, written out as sorted runs to a temporary file
+ * next to the index and merged into a new index file by flush(). Updates
+ * keep the new node lists of changed ways in memory. Lookups combine them
+ * with the file, which is memory mapped where possible, and flush() writes
+ * a new file with the changes merged in. The new file only replaces the
+ * old one on commit(), so that the index can be kept in step with the
+ * database transactions.
+ */
+class way_node_index_t : public boost::noncopyable
+{
+public:
+    struct entry_t
+    {
+        osmid_t node;
+        osmid_t way;
+
+        bool operator<(entry_t const &other) const
+        {
+            return node < other.node || (node == other.node && way < other.way);
+        }
+    };
+
+    /**
+     * Create a new index file, or open the existing one for updates if
+     * append is set. run_size is the number of pairs sorted in memory at
+     * a time on import.
+     */
+    way_node_index_t(const std::string &filename, bool append,
+                     size_t run_size = 1 << 23);
+    ~way_node_index_t();
+
+    /// Set the nodes of a way, replacing any it had before.
+    void set(osmid_t way_id, const idlist_t &nodes);
+
+    /// Remove a way. Only used for updates.
+    void remove(osmid_t way_id);
+
+    /**
+     * Sorted ids of the ways using any of the sorted node ids. Only sees
+     * the ways of an import after commit().
+     */
+    idlist_t ways_using(const idlist_t &node_ids) const;
+
+    /**
+     * Write a new index file with all changes merged in, next to the
+     * current one. Can be repeated until commit().
+     */
+    void flush();
+
+    /// Replace the index file by the one written by flush().
+    void commit();
+
+    /// Number of pairs in the index file.
+    size_t size() const { return m_count; }
+
+private:
+    void write_run(std::vector<entry_t> &entries);
+    std::string new_filename() const { return m_filename + ".new"; }
+    entry_t entry_at(size_t i) const;
+    size_t lower_bound(size_t first, osmid_t node) const;
+    void open_index();
+    void close_index();
+
+    std::string m_filename;
+    std::string m_runs_filename;
+    size_t m_run_size;
+    bool m_append;
+
+    // pairs of the import not written to a run yet
+    std::vector<entry_t> m_pairs;
+    // start of each run in the runs file, counted in pairs
+    std::vector<size_t> m_runs;
+    size_t m_runs_count;
+
+    // new node lists of the ways changed by an update, empty if deleted
+    std::unordered_map<osmid_t, idlist_t> m_changed;
+
+    // true once flush() has written a new index file
+    bool m_flushed;
+
+    // the index file
+    size_t m_count;
+    void *m_map_base;
+    size_t m_map_size;
+    const entry_t *m_entries;
+    // read from if the file is not mapped, shared by all lookups
+    mutable std::ifstream m_file;
+    mutable std::mutex m_file_mutex;
+};
+
+#endif // WAY_NODE_INDEX_HPP
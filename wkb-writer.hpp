@@ -0,0 +1,78 @@
+#ifndef WKB_WRITER_HPP
+#define WKB_WRITER_HPP
+
+#include "osmtypes.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Writes geometries as hex encoded WKB in machine byte order. This is
+ * what the GEOS WKBWriter in geometry_builder::pg_geom_t::set() produces
+ * for 2D geometries without SRID.
+ */
+class wkb_writer_t
+{
+public:
+    enum geometry_type : uint32_t
+    {
+        wkb_point = 1,
+        wkb_line = 2,
+        wkb_polygon = 3,
+        wkb_multi_line = 5,
+        wkb_multi_polygon = 6
+    };
+
+    explicit wkb_writer_t(std::string &out) : m_out(out) {}
+
+    /// Byte order and type, which start every (sub)geometry.
+    void header(geometry_type type)
+    {
+        uint16_t const one = 1;
+        uint8_t const order = *reinterpret_cast<const uint8_t *>(&one);
+        write(&order, sizeof(order));
+        uint32_t const type_id = type;
+        write(&type_id, sizeof(type_id));
+    }
+
+    /// Number of points, rings or geometries that follow.
+    void count(size_t num)
+    {
+        uint32_t const n = num;
+        write(&n, sizeof(n));
+    }
+
+    void point(double x, double y)
+    {
+        write(&x, sizeof(x));
+        write(&y, sizeof(y));
+    }
+
+    /// The points of a line or ring, with their number.
+    void points(const nodelist_t &nodes)
+    {
+        count(nodes.size());
+        for (auto const &n : nodes) {
+            point(n.lon, n.lat);
+        }
+    }
+
+    /// Length of the hex encoding of a line or ring with num points.
+    static size_t points_size(size_t num) { return 2 * (4 + 16 * num); }
+
+private:
+    void write(const void *data, size_t size)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        auto const *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_out += hex[bytes[i] >> 4];
+            m_out += hex[bytes[i] & 0xf];
+        }
+    }
+
+    std::string &m_out;
+};
+
+#endif // WKB_WRITER_HPP